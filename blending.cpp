@@ -62,11 +62,9 @@ int main()
   }
 
   // INIT OPEN GL
+  // blending is set up by the renderer for translucent draws
   glViewport(0, 0, SCR_WIDTH, SCR_HEIGHT);
-  glEnable(GL_BLEND);
-  glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
-  /*  glEnable(GL_DEPTH_TEST); */
-  /*   glDepthFunc(GL_ALWAYS); */
+  glEnable(GL_DEPTH_TEST);
   // init texture
   // texture wrapping
   glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_MIRRORED_REPEAT);
@@ -81,10 +79,11 @@ int main()
   auto renderer = std::make_unique<Renderer>();
   auto resourceManager = std::make_unique<ResourceManager>(*renderer);
   ModelLoader modelLoader = ModelLoader(*resourceManager);
-  SpriteRenderer spriteRenderer = SpriteRenderer();
 
   std::shared_ptr<Shader> shader(
-      new Shader("./shader/vSprite.glsl", "./shader/fSprite.glsl"));
+      new Shader("./shader/vLight.glsl", "./shader/fSprite.glsl"));
+  // vSprite.glsl reads the model matrix per instance
+  Shader shaderInstanced("./shader/vSprite.glsl", "./shader/fSprite.glsl");
 
   std::vector<Image> images = {
       Image("./texture/blending_transparent_window.png", true)};
@@ -101,7 +100,13 @@ int main()
 
   resourceManager->addMaterial(mat);
 
-  MeshRenderer render;
+  Mesh pane = createPlane();
+  renderer->createBuffer(pane);
+
+  MeshRenderer render(renderer->getResidency());
+  render.setInstancedShader(*shader, shaderInstanced);
+  // windows are drawn back to front, sorted on the job system
+  RenderQueue queue(&resourceManager->getJobs());
   // projection
   glm::mat4 projection;
   projection = glm::perspective(
@@ -128,11 +133,18 @@ int main()
   vegetation.push_back(
       glm::translate(glm::mat4(1.0f), glm::vec3(0.5f, 0.0f, -0.6f)));
 
-  std::vector<Sprite> sprites((int)vegetation.size());
-  /* for (int i = 0; i < sprites.size(); ++i) {
-    Sprite sprite;
-    sprites[i] = sprite;
-  } */
+  // rows of windows further back, neighbours in depth share a draw
+  for (int row = 0; row < 8; ++row)
+  {
+    for (int column = -4; column <= 4; ++column)
+    {
+      vegetation.push_back(glm::translate(
+          glm::mat4(1.0f),
+          glm::vec3(column * 0.8f, 0.0f, -4.0f - row * 1.5f)));
+    }
+  }
+
+  unsigned int frame = 0;
   while (!glfwWindowShouldClose(window))
   {
     double currentFrame = glfwGetTime();
@@ -146,12 +158,23 @@ int main()
     glClearColor(0.2f, 0.3f, 0.3f, 1.0f);
     glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
 
-    camera.Position = glm::vec3(0.2f, 0.0f, 3.0f);
+    // sway sideways so the order between windows changes
+    camera.Position =
+        glm::vec3(0.2f + std::sin((float)currentFrame * 0.5f) * 1.5f, 0.0f,
+                  3.0f);
     camera.Target = glm::vec3(0.0f, 0.0f, 0.0f);
-    /*
-        render.useLight(*shader, light, camera); */
-    spriteRenderer.render(camera, sprites, 0, resourceManager->getMaterials(),
-                          vegetation);
+    for (const glm::mat4 &model : vegetation)
+    {
+      render.submit(queue, camera, pane, *shader, mat, model, 0, true);
+    }
+    render.flush(camera, queue);
+    if (++frame % 120 == 0)
+    {
+      const auto &stats = render.getQueueStats();
+      std::cout << vegetation.size() << " windows in "
+                << stats.sorted.draws / 120 << " draws per frame\n";
+      render.resetQueueStats();
+    }
     glfwSwapBuffers(window);
     glfwPollEvents();
   }
@@ -0,0 +1,206 @@
+// clang-format off
+#include <glad/glad.h>
+// clang-format on
+#include <GLFW/glfw3.h>
+#include <iostream>
+#include <random>
+#include <string>
+#include <vector>
+#include <shader.h>
+#define STB_IMAGE_IMPLEMENTATION
+#include "stb_image.h"
+#include <glm/glm.hpp>
+#include <glm/gtc/matrix_transform.hpp>
+#include <glm/gtc/type_ptr.hpp>
+#include "engine.h"
+
+// settings
+const unsigned int SCR_WIDTH = 800;
+const unsigned int SCR_HEIGHT = 600;
+// a field of containers lit by many small moving point lights
+const int GRID_SIZE = 40;
+const int POINT_LIGHT_COUNT = 2000;
+
+int viewportWidth = SCR_WIDTH;
+int viewportHeight = SCR_HEIGHT;
+
+void processInput(GLFWwindow *window)
+{
+  if (glfwGetKey(window, GLFW_KEY_ESCAPE) == GLFW_PRESS)
+    glfwSetWindowShouldClose(window, true);
+}
+
+void framebuffer_size_callback(GLFWwindow *window, int width, int height)
+{
+  glViewport(0, 0, width, height);
+  viewportWidth = width;
+  viewportHeight = height;
+}
+
+int main()
+{
+  // GLFW
+  glfwInit();
+  glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 3);
+  glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 3);
+  glfwWindowHint(GLFW_OPENGL_PROFILE, GLFW_OPENGL_CORE_PROFILE);
+
+  GLFWwindow *window = glfwCreateWindow(SCR_WIDTH, SCR_HEIGHT,
+                                        "Clustered lighting", NULL, NULL);
+  if (window == NULL)
+  {
+    std::cout << "Failed to create GLFW window" << std::endl;
+    glfwTerminate();
+    return -1;
+  }
+  glfwMakeContextCurrent(window);
+  glfwSetFramebufferSizeCallback(window, framebuffer_size_callback);
+  // vsync off so the frame time shows the cost of the lights
+  glfwSwapInterval(0);
+
+  // INIT GLAD
+  if (!gladLoadGLLoader((GLADloadproc)glfwGetProcAddress))
+  {
+    std::cout << "Failed to initialize GLAD" << std::endl;
+    return -1;
+  }
+  glViewport(0, 0, SCR_WIDTH, SCR_HEIGHT);
+  glEnable(GL_DEPTH_TEST);
+
+  auto renderer = std::make_unique<Renderer>();
+  auto resourceManager = std::make_unique<ResourceManager>(*renderer);
+
+  std::shared_ptr<Shader> clusteredShader(
+      new Shader("./shader/vLight.glsl", "./shader/fClusteredModel.glsl"));
+  Shader clusteredShaderInstanced("./shader/vLightInstanced.glsl",
+                                  "./shader/fClusteredModel.glsl");
+
+  Material mat = Material(clusteredShader);
+  resourceManager->addMaterial(mat);
+  Image diffuseImage("./texture/container2.png", false);
+  Texture diffuse = resourceManager->loadTexture2D(diffuseImage);
+  diffuse.type = TextureType::Diffuse;
+  mat.textures.push_back(diffuse);
+  Image specularImage("./texture/container2_specular.png", false);
+  Texture specular = resourceManager->loadTexture2D(specularImage);
+  specular.type = TextureType::Specular;
+  mat.textures.push_back(specular);
+
+  Mesh mesh = createCube();
+  renderer->createBuffer(mesh);
+
+  MeshRenderer render(renderer->getResidency());
+  render.setInstancedShader(*clusteredShader, clusteredShaderInstanced);
+  RenderQueue queue;
+  ClusteredLights clustered(resourceManager->getJobs());
+
+  glm::mat4 projection = glm::perspective(
+      glm::radians(60.0f), (float)SCR_WIDTH / (float)SCR_HEIGHT, 0.1f, 100.0f);
+  auto camera = Camera(projection);
+
+  // only a faint directional light, the rest comes from the clusters
+  Light sun = Light();
+  sun.Position = glm::vec3(0.0f);
+  sun.Direction = glm::vec3(-0.3f, -1.0f, -0.2f);
+  sun.Ambiant = glm::vec3(0.05f);
+  sun.Diffuse = glm::vec3(0.1f);
+  sun.Specular = glm::vec3(0.1f);
+
+  std::vector<glm::mat4> cubeModels;
+  for (int x = 0; x < GRID_SIZE; ++x)
+  {
+    for (int z = 0; z < GRID_SIZE; ++z)
+    {
+      glm::mat4 model = glm::translate(
+          glm::mat4(1.0f),
+          glm::vec3((x - GRID_SIZE / 2) * 2.0f, 0.0f, (z - GRID_SIZE / 2) * 2.0f));
+      cubeModels.push_back(glm::scale(model, glm::vec3(0.8f)));
+    }
+  }
+
+  std::mt19937 rng(7);
+  std::uniform_real_distribution<float> unit(0.0f, 1.0f);
+  std::vector<Light> pointLights(POINT_LIGHT_COUNT);
+  std::vector<glm::vec3> orbitCenters(POINT_LIGHT_COUNT);
+  for (int i = 0; i < POINT_LIGHT_COUNT; ++i)
+  {
+    Light &light = pointLights[i];
+    glm::vec3 color(unit(rng), unit(rng), unit(rng));
+    light.Ambiant = color * 0.02f;
+    light.Diffuse = color * 0.5f;
+    light.Specular = color * 0.5f;
+    // short range lights, about 4 units
+    light.Constant = 1.0f;
+    light.Linear = 0.7f;
+    light.Quadratic = 8.0f;
+    orbitCenters[i] = glm::vec3((unit(rng) - 0.5f) * GRID_SIZE * 2.0f,
+                                0.5f + unit(rng) * 2.0f,
+                                (unit(rng) - 0.5f) * GRID_SIZE * 2.0f);
+  }
+  // two headlights sweeping the field
+  std::vector<Light> spotLights(2);
+  for (Light &light : spotLights)
+  {
+    light.Ambiant = glm::vec3(0.0f);
+    light.Diffuse = glm::vec3(1.0f, 0.9f, 0.7f);
+    light.Specular = glm::vec3(1.0f);
+    light.Linear = 0.045f;
+    light.Quadratic = 0.0075f;
+  }
+
+  double frameTimes = 0.0;
+  unsigned int frame = 0;
+  while (!glfwWindowShouldClose(window))
+  {
+    double frameStart = glfwGetTime();
+    processInput(window);
+    float time = (float)glfwGetTime();
+
+    glClearColor(0.02f, 0.02f, 0.03f, 1.0f);
+    glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+
+    camera.Position = glm::vec3(std::sin(time * 0.1f) * 20.0f, 12.0f, 30.0f);
+    camera.Target = glm::vec3(0.0f);
+    for (int i = 0; i < POINT_LIGHT_COUNT; ++i)
+    {
+      float phase = time + i * 0.37f;
+      pointLights[i].Position =
+          orbitCenters[i] + glm::vec3(std::cos(phase), 0.0f, std::sin(phase));
+    }
+    for (size_t i = 0; i < spotLights.size(); ++i)
+    {
+      float angle = time * 0.5f + i * 3.14159f;
+      spotLights[i].Position = glm::vec3(0.0f, 6.0f, 0.0f);
+      spotLights[i].Direction =
+          glm::normalize(glm::vec3(std::cos(angle), -0.5f, std::sin(angle)));
+    }
+    clustered.update(camera, pointLights, spotLights, viewportWidth,
+                     viewportHeight);
+    for (Shader *shader : {clusteredShader.get(), &clusteredShaderInstanced})
+    {
+      render.useLight(*shader, sun, camera);
+      clustered.bind(*shader);
+    }
+    for (const glm::mat4 &model : cubeModels)
+    {
+      render.submit(queue, camera, mesh, *mat.shader, mat, model);
+    }
+    render.flush(camera, queue);
+    render.resetQueueStats();
+
+    glfwSwapBuffers(window);
+    glfwPollEvents();
+    frameTimes += glfwGetTime() - frameStart;
+    if (++frame % 120 == 0)
+    {
+      const auto &stats = clustered.getStats();
+      std::cout << stats.lights << " lights, " << stats.indices
+                << " cluster entries, largest cluster " << stats.largestCluster
+                << ", assignment " << stats.assignMs << " ms, frame "
+                << frameTimes * 1000.0 / 120 << " ms\n";
+      frameTimes = 0.0;
+    }
+  }
+  glfwTerminate();
+  return 0;
+}
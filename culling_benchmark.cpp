@@ -0,0 +1,95 @@
+#include <frustum_culling.h>
+#include <glm/glm.hpp>
+#include <glm/gtc/matrix_transform.hpp>
+#include <glm/gtc/type_ptr.hpp>
+#include <algorithm>
+#include <chrono>
+#include <functional>
+#include <iostream>
+#include <random>
+#include <string>
+#include <vector>
+
+// Frustum culls 1M random boxes with every kernel the build and the CPU
+// support and prints the best of several runs.
+const size_t BOX_COUNT = 1000000;
+const int RUNS = 20;
+
+double bestRunMs(const std::function<size_t()> &cull, size_t &visible)
+{
+  double best = 1e30;
+  for (int run = 0; run < RUNS; ++run)
+  {
+    auto start = std::chrono::steady_clock::now();
+    visible = cull();
+    std::chrono::duration<double, std::milli> elapsed =
+        std::chrono::steady_clock::now() - start;
+    best = std::min(best, elapsed.count());
+  }
+  return best;
+}
+
+void report(const std::string &name, double ms, size_t visible)
+{
+  std::cout << name << ": " << ms << " ms, " << ms * 1e6 / BOX_COUNT
+            << " ns/box, " << visible << " visible\n";
+}
+
+int main()
+{
+  std::mt19937 rng(42);
+  std::uniform_real_distribution<float> position(-100.0f, 100.0f);
+  std::uniform_real_distribution<float> extent(0.1f, 2.0f);
+  BoxList boxes;
+  for (size_t i = 0; i < BOX_COUNT; ++i)
+  {
+    float center[3] = {position(rng), position(rng), position(rng)};
+    float half[3] = {extent(rng), extent(rng), extent(rng)};
+    float min[3] = {center[0] - half[0], center[1] - half[1],
+                    center[2] - half[2]};
+    float max[3] = {center[0] + half[0], center[1] + half[1],
+                    center[2] + half[2]};
+    boxes.add(min, max);
+  }
+  glm::mat4 projection =
+      glm::perspective(glm::radians(60.0f), 800.0f / 600.0f, 0.1f, 100.0f);
+  glm::mat4 view = glm::lookAt(glm::vec3(0.0f), glm::vec3(0.0f, 0.0f, -1.0f),
+                               glm::vec3(0.0f, 1.0f, 0.0f));
+  glm::mat4 viewProjection = projection * view;
+  float planes[6][4];
+  extractFrustumPlanes(glm::value_ptr(viewProjection), planes);
+
+  std::vector<uint8_t> reference(BOX_COUNT), visible(BOX_COUNT);
+  size_t count;
+  double ms = bestRunMs(
+      [&]() {
+        return cullBoxesScalar(planes, boxes, 0, BOX_COUNT, reference.data());
+      },
+      count);
+  report("scalar", ms, count);
+#ifdef FRUSTUM_CULLING_SSE
+  ms = bestRunMs([&]() { return cullBoxesSSE(planes, boxes, visible.data()); },
+                 count);
+  report("SSE (4 boxes)", ms, count);
+  if (visible != reference)
+  {
+    std::cout << "SSE result differs from scalar\n";
+    return 1;
+  }
+#endif
+#ifdef FRUSTUM_CULLING_AVX
+  if (!cpuHasAVX())
+  {
+    return 0;
+  }
+  ms = bestRunMs([&]() { return cullBoxesAVX(planes, boxes, visible.data()); },
+                 count);
+  report("AVX (8 boxes)", ms, count);
+  if (visible != reference)
+  {
+    std::cout << "AVX result differs from scalar\n";
+    return 1;
+  }
+#endif
+  return 0;
+}
@@ -101,7 +101,7 @@ int main()
     mat.textures.push_back(texture);
   }
 
-  resourceManager->addMaterial(mat);
+  MaterialHandle spriteMaterial = resourceManager->addMaterial(mat);
 
   MeshRenderer render;
   // projection
@@ -149,7 +149,8 @@ int main()
     camera.Target = glm::vec3(0.0f, 0.0f, 0.0f);
     /*
         render.useLight(*shader, light, camera); */
-    spriteRenderer.render(camera, sprites, 0, resourceManager->getMaterials(),
+    spriteRenderer.render(camera, sprites, spriteMaterial,
+                          resourceManager->getMaterials(),
                           vegetation);
     glfwSwapBuffers(window);
     glfwPollEvents();
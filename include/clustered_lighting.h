@@ -0,0 +1,292 @@
+#ifndef CLUSTERED_LIGHTING_H
+#define CLUSTERED_LIGHTING_H
+
+#include <glm/glm.hpp>
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <vector>
+
+// Light volume in view space. Point lights are spheres; spot lights are
+// cones clipped by the sphere, with the cosine and sine of the outer angle.
+struct ClusterLight
+{
+  glm::vec3 position;
+  float radius;
+  glm::vec3 direction;
+  float cosAngle;
+  float sinAngle;
+  bool spot;
+};
+
+// The view frustum cut into a grid of tiles on screen and slices in depth,
+// with the slices spaced exponentially so clusters stay roughly cubic.
+// assign() lists for every cluster the lights that may touch it; fragments
+// then only shade with the lights of their own cluster.
+class LightClusters
+{
+public:
+  LightClusters(int tilesX = 16, int tilesY = 9, int slices = 24)
+      : tilesX(tilesX), tilesY(tilesY), slices(slices),
+        sliceLights(slices), sliceCounts(slices), candidates(slices),
+        sliceHits(slices), sliceOffsets(slices), columnMin(slices),
+        columnMax(slices), rowMin(slices), rowMax(slices)
+  {
+  }
+  int countX() const { return tilesX; }
+  int countY() const { return tilesY; }
+  int countZ() const { return slices; }
+  size_t clusterCount() const { return (size_t)tilesX * tilesY * slices; }
+  float nearPlane() const { return zNear; }
+  float farPlane() const { return zFar; }
+  // slice = log(depth) * sliceScale + sliceBias, depth along -z
+  float sliceScale() const { return scale; }
+  float sliceBias() const { return bias; }
+  int sliceOf(float depth) const
+  {
+    int slice = (int)std::floor(std::log(std::max(depth, zNear)) * scale + bias);
+    return std::min(std::max(slice, 0), slices - 1);
+  }
+
+  // Rebuilds the cluster bounds when the perspective projection changed
+  void setProjection(const glm::mat4 &projection)
+  {
+    if (projection == currentProjection && !bounds.empty())
+    {
+      return;
+    }
+    currentProjection = projection;
+    zNear = projection[3][2] / (projection[2][2] - 1.0f);
+    zFar = projection[3][2] / (projection[2][2] + 1.0f);
+    scale = slices / std::log(zFar / zNear);
+    bias = -slices * std::log(zNear) / std::log(zFar / zNear);
+    glm::mat4 inverse = glm::inverse(projection);
+    bounds.resize(clusterCount());
+    for (int z = 0; z < slices; ++z)
+    {
+      float depth0 = sliceDepth(z);
+      float depth1 = sliceDepth(z + 1);
+      for (int y = 0; y < tilesY; ++y)
+      {
+        for (int x = 0; x < tilesX; ++x)
+        {
+          Bounds &box = bounds[index(x, y, z)];
+          box.min = glm::vec3(1e30f);
+          box.max = glm::vec3(-1e30f);
+          for (int corner = 0; corner < 4; ++corner)
+          {
+            float ndcX = -1.0f + 2.0f * (x + (corner & 1)) / tilesX;
+            float ndcY = -1.0f + 2.0f * (y + (corner >> 1)) / tilesY;
+            glm::vec4 point = inverse * glm::vec4(ndcX, ndcY, -1.0f, 1.0f);
+            glm::vec3 ray = glm::vec3(point) / -point.z;
+            for (float depth : {depth0, depth1})
+            {
+              box.min = glm::min(box.min, ray * depth);
+              box.max = glm::max(box.max, ray * depth);
+            }
+          }
+          box.center = (box.min + box.max) * 0.5f;
+          box.radius = glm::length(box.max - box.center);
+        }
+      }
+      columnMin[z].assign(tilesX, 1e30f);
+      columnMax[z].assign(tilesX, -1e30f);
+      rowMin[z].assign(tilesY, 1e30f);
+      rowMax[z].assign(tilesY, -1e30f);
+      for (int y = 0; y < tilesY; ++y)
+      {
+        for (int x = 0; x < tilesX; ++x)
+        {
+          const Bounds &box = bounds[index(x, y, z)];
+          columnMin[z][x] = std::min(columnMin[z][x], box.min.x);
+          columnMax[z][x] = std::max(columnMax[z][x], box.max.x);
+          rowMin[z][y] = std::min(rowMin[z][y], box.min.y);
+          rowMax[z][y] = std::max(rowMax[z][y], box.max.y);
+        }
+      }
+    }
+  }
+
+  // Assignment in three steps so the slices can run on different threads:
+  // beginAssign, assignSlice for every slice, then finishAssign.
+  void beginAssign(const std::vector<ClusterLight> &viewLights)
+  {
+    lights = &viewLights;
+  }
+  void assignSlice(int z)
+  {
+    std::vector<uint32_t> &indices = sliceLights[z];
+    std::vector<uint32_t> &counts = sliceCounts[z];
+    indices.clear();
+    counts.assign((size_t)tilesX * tilesY, 0);
+    float depth0 = sliceDepth(z);
+    float depth1 = sliceDepth(z + 1);
+    // lights whose sphere reaches into the slice
+    std::vector<uint32_t> &sliceCandidates = candidates[z];
+    sliceCandidates.clear();
+    for (uint32_t i = 0; i < lights->size(); ++i)
+    {
+      const ClusterLight &light = (*lights)[i];
+      float depth = -light.position.z;
+      if (depth + light.radius >= depth0 && depth - light.radius <= depth1)
+      {
+        sliceCandidates.push_back(i);
+      }
+    }
+    // each light only visits the tiles its sphere overlaps; the x extent
+    // of a cluster depends on its column only and the y extent on its row
+    std::vector<uint32_t> &hits = sliceHits[z];
+    hits.clear();
+    for (uint32_t i : sliceCandidates)
+    {
+      const ClusterLight &light = (*lights)[i];
+      int x0 = 0, x1 = tilesX - 1, y0 = 0, y1 = tilesY - 1;
+      while (x0 <= x1 && columnMax[z][x0] < light.position.x - light.radius)
+      {
+        ++x0;
+      }
+      while (x1 >= x0 && columnMin[z][x1] > light.position.x + light.radius)
+      {
+        --x1;
+      }
+      while (y0 <= y1 && rowMax[z][y0] < light.position.y - light.radius)
+      {
+        ++y0;
+      }
+      while (y1 >= y0 && rowMin[z][y1] > light.position.y + light.radius)
+      {
+        --y1;
+      }
+      for (int y = y0; y <= y1; ++y)
+      {
+        for (int x = x0; x <= x1; ++x)
+        {
+          if (touches(light, bounds[index(x, y, z)]))
+          {
+            uint32_t tile = (uint32_t)(y * tilesX + x);
+            hits.push_back(tile);
+            hits.push_back(i);
+            ++counts[tile];
+          }
+        }
+      }
+    }
+    // counting sort of the hits by tile, lights stay in ascending order
+    std::vector<uint32_t> &offsets = sliceOffsets[z];
+    offsets.resize(counts.size());
+    uint32_t offset = 0;
+    for (size_t tile = 0; tile < counts.size(); ++tile)
+    {
+      offsets[tile] = offset;
+      offset += counts[tile];
+    }
+    indices.resize(offset);
+    for (size_t hit = 0; hit < hits.size(); hit += 2)
+    {
+      indices[offsets[hits[hit]]++] = hits[hit + 1];
+    }
+  }
+  // Joins the slices into grid (offset and count per cluster) and indices,
+  // keeping at most maxIndices light indices
+  void finishAssign(size_t maxIndices = ~(size_t)0)
+  {
+    grid.resize(clusterCount() * 2);
+    indices.clear();
+    largestCluster = 0;
+    truncated = false;
+    for (int z = 0; z < slices; ++z)
+    {
+      const uint32_t *sliceIndex = sliceLights[z].data();
+      for (size_t tile = 0; tile < (size_t)tilesX * tilesY; ++tile)
+      {
+        uint32_t count = sliceCounts[z][tile];
+        size_t cluster = (size_t)z * tilesX * tilesY + tile;
+        uint32_t kept = (uint32_t)std::min<size_t>(
+            count, maxIndices - std::min(maxIndices, indices.size()));
+        truncated = truncated || kept < count;
+        grid[cluster * 2] = (uint32_t)indices.size();
+        grid[cluster * 2 + 1] = kept;
+        indices.insert(indices.end(), sliceIndex, sliceIndex + kept);
+        sliceIndex += count;
+        largestCluster = std::max(largestCluster, count);
+      }
+    }
+    lights = nullptr;
+  }
+  void assign(const std::vector<ClusterLight> &viewLights)
+  {
+    beginAssign(viewLights);
+    for (int z = 0; z < slices; ++z)
+    {
+      assignSlice(z);
+    }
+    finishAssign();
+  }
+  // offset into indices and light count, two values per cluster in x, y, z
+  // order
+  const std::vector<uint32_t> &getGrid() const { return grid; }
+  const std::vector<uint32_t> &getIndices() const { return indices; }
+  uint32_t getLargestCluster() const { return largestCluster; }
+  // whether finishAssign dropped indices to stay under its limit
+  bool wasTruncated() const { return truncated; }
+
+  // Whether a light may touch the box: sphere against box, then for spot
+  // lights the cone against the box's bounding sphere
+  struct Bounds
+  {
+    glm::vec3 min, max, center;
+    float radius;
+  };
+  static bool touches(const ClusterLight &light, const Bounds &box)
+  {
+    glm::vec3 closest = glm::clamp(light.position, box.min, box.max);
+    glm::vec3 offset = closest - light.position;
+    if (glm::dot(offset, offset) > light.radius * light.radius)
+    {
+      return false;
+    }
+    if (!light.spot)
+    {
+      return true;
+    }
+    glm::vec3 toCenter = box.center - light.position;
+    float along = glm::dot(toCenter, light.direction);
+    float across =
+        std::sqrt(std::max(glm::dot(toCenter, toCenter) - along * along, 0.0f));
+    float distance = light.cosAngle * across - along * light.sinAngle;
+    return distance <= box.radius && along >= -box.radius;
+  }
+  const Bounds &clusterBounds(int x, int y, int z) const
+  {
+    return bounds[index(x, y, z)];
+  }
+
+private:
+  size_t index(int x, int y, int z) const
+  {
+    return ((size_t)z * tilesY + y) * tilesX + x;
+  }
+  float sliceDepth(int z) const
+  {
+    return zNear * std::pow(zFar / zNear, (float)z / slices);
+  }
+  int tilesX, tilesY, slices;
+  glm::mat4 currentProjection = glm::mat4(0.0f);
+  float zNear = 0.1f, zFar = 100.0f, scale = 1.0f, bias = 0.0f;
+  std::vector<Bounds> bounds;
+  const std::vector<ClusterLight> *lights = nullptr;
+  std::vector<std::vector<uint32_t>> sliceLights;
+  std::vector<std::vector<uint32_t>> sliceCounts;
+  std::vector<std::vector<uint32_t>> candidates;
+  // tile and light index pairs found in a slice, before sorting by tile
+  std::vector<std::vector<uint32_t>> sliceHits;
+  std::vector<std::vector<uint32_t>> sliceOffsets;
+  // view space x extent of every tile column and y extent of every row
+  std::vector<std::vector<float>> columnMin, columnMax, rowMin, rowMax;
+  std::vector<uint32_t> grid;
+  std::vector<uint32_t> indices;
+  uint32_t largestCluster = 0;
+  bool truncated = false;
+};
+
+#endif
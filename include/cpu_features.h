@@ -0,0 +1,55 @@
+#ifndef CPU_FEATURES_H
+#define CPU_FEATURES_H
+
+// Instruction sets the SIMD kernels may use beyond the build's baseline.
+// On x86 the kernels are compiled for their own instruction set with
+// CPU_TARGET_SSE41 or CPU_TARGET_AVX whatever the compile flags, and only
+// called when the running CPU reports it, so the default build ships them.
+#if (defined(__GNUC__) || defined(__clang__)) && \
+    (defined(__x86_64__) || defined(__i386__))
+#include <immintrin.h>
+#define CPU_FEATURES_X86 1
+#define CPU_TARGET_SSE41 __attribute__((target("sse4.1")))
+#define CPU_TARGET_AVX __attribute__((target("avx")))
+#elif defined(_MSC_VER) && (defined(_M_X64) || defined(_M_IX86))
+#include <immintrin.h>
+#include <intrin.h>
+#define CPU_FEATURES_X86 1
+// MSVC emits any intrinsic without flags
+#define CPU_TARGET_SSE41
+#define CPU_TARGET_AVX
+#endif
+
+#ifdef CPU_FEATURES_X86
+inline bool cpuHasSSE41()
+{
+#if defined(_MSC_VER) && !defined(__clang__)
+  static const bool supported = []() {
+    int info[4];
+    __cpuid(info, 1);
+    return (info[2] & (1 << 19)) != 0;
+  }();
+  return supported;
+#else
+  return __builtin_cpu_supports("sse4.1");
+#endif
+}
+// AVX also needs the OS to save the ymm registers
+inline bool cpuHasAVX()
+{
+#if defined(_MSC_VER) && !defined(__clang__)
+  static const bool supported = []() {
+    int info[4];
+    __cpuid(info, 1);
+    bool avx = (info[2] & (1 << 28)) != 0;
+    bool osxsave = (info[2] & (1 << 27)) != 0;
+    return avx && osxsave && (_xgetbv(0) & 6) == 6;
+  }();
+  return supported;
+#else
+  return __builtin_cpu_supports("avx");
+#endif
+}
+#endif
+
+#endif
@@ -9,14 +9,37 @@
 #include <numeric>
 #include <ostream>
 #include <shader.h>
+#include <hash.h>
+#include <pool.h>
 #define STB_IMAGE_IMPLEMENTATION
 #include <glm/glm.hpp>
 #include <glm/gtc/matrix_transform.hpp>
 #include <glm/gtc/type_ptr.hpp>
+#include <glm/gtc/constants.hpp>
 #include <assimp/Importer.hpp>
 #include <assimp/scene.h>
 #include <assimp/postprocess.h>
 #include <functional>
+#include <algorithm>
+#include <cstdint>
+#include <chrono>
+#include <deque>
+#include <map>
+#include <limits>
+#include <job_system.h>
+#include <mapped_file.h>
+#include <mesh_optimizer.h>
+#include <mesh_simplifier.h>
+#include <meshlet.h>
+#include <frustum_culling.h>
+#include <occlusion_culling.h>
+#include <clustered_lighting.h>
+#include <light_grid.h>
+#include <scene_graph.h>
+#include <vertex_conversion.h>
+#include <render_queue.h>
+#include <type_traits>
+#include <cstdio>
 
 struct Light
 {
@@ -50,10 +73,108 @@ enum TextureType
   Diffuse,
   Specular
 };
+struct Texture;
+struct Material;
+using TextureHandle = Handle<Texture>;
+using MaterialHandle = Handle<Material>;
 struct Texture
 {
   unsigned int id;
   TextureType type = TextureType::Diffuse;
+  TextureHandle handle;
+};
+struct BoundingBox
+{
+  glm::vec3 Min = glm::vec3(std::numeric_limits<float>::max());
+  glm::vec3 Max = glm::vec3(std::numeric_limits<float>::lowest());
+  bool valid() const { return Min.x <= Max.x; }
+  void extend(const glm::vec3 &point)
+  {
+    Min = glm::min(Min, point);
+    Max = glm::max(Max, point);
+  }
+  void extend(const BoundingBox &box)
+  {
+    if (box.valid())
+    {
+      extend(box.Min);
+      extend(box.Max);
+    }
+  }
+  glm::vec3 center() const { return (Min + Max) * 0.5f; }
+  glm::vec3 size() const { return Max - Min; }
+  // box around this one after transform, from the absolute matrix (Arvo)
+  BoundingBox transformed(const glm::mat4 &transform) const
+  {
+    if (!valid())
+    {
+      return *this;
+    }
+    glm::vec3 c(transform * glm::vec4(center(), 1.0f));
+    glm::vec3 half = size() * 0.5f;
+    glm::vec3 extent(0.0f);
+    for (int col = 0; col < 3; ++col)
+    {
+      extent += glm::abs(glm::vec3(transform[col])) * half[col];
+    }
+    BoundingBox box;
+    box.Min = c - extent;
+    box.Max = c + extent;
+    return box;
+  }
+};
+struct BoundingSphere
+{
+  glm::vec3 center = glm::vec3(0.0f);
+  float radius = -1.0f;
+  bool valid() const { return radius >= 0.0f; }
+};
+// Planes of a view frustum, pointing inwards. Built from a projection *
+// view matrix the planes are in world space; multiplying in a model matrix
+// gives them in that model's object space.
+struct Frustum
+{
+  float planes[6][4];
+  Frustum(const glm::mat4 &m) { extractFrustumPlanes(glm::value_ptr(m), planes); }
+  bool intersectsSphere(const glm::vec3 &center, float radius) const
+  {
+    for (const auto &plane : planes)
+    {
+      if (plane[0] * center.x + plane[1] * center.y + plane[2] * center.z +
+              plane[3] <
+          -radius)
+      {
+        return false;
+      }
+    }
+    return true;
+  }
+  bool intersectsBox(const BoundingBox &box) const
+  {
+    glm::vec3 center = box.center();
+    glm::vec3 extent = box.size() * 0.5f;
+    for (const auto &plane : planes)
+    {
+      float distance = plane[0] * center.x + plane[1] * center.y +
+                       plane[2] * center.z + plane[3];
+      float radius = std::fabs(plane[0]) * extent.x +
+                     std::fabs(plane[1]) * extent.y +
+                     std::fabs(plane[2]) * extent.z;
+      if (distance + radius < 0.0f)
+      {
+        return false;
+      }
+    }
+    return true;
+  }
+};
+// Range of Mesh::Indices drawing one detail level
+struct MeshLod
+{
+  uint32_t indexOffset;
+  uint32_t indexCount;
+  // largest object space distance between this level and the full mesh
+  float error;
 };
 struct Mesh
 {
@@ -61,8 +182,29 @@ public:
   // mesh data
   std::vector<Vertex> Vertices;
   std::vector<unsigned int> Indices;
-  unsigned int Id;
-  int MaterialID;
+  unsigned int Id = 0;
+  // object space bounds, see computeBounds
+  BoundingBox Bounds;
+  BoundingSphere Sphere;
+  // detail levels stored one after the other in Indices, finest first;
+  // empty when the whole index buffer is the only level
+  std::vector<MeshLod> Lods;
+  // clusters of the finest level, for per cluster culling
+  std::vector<Meshlet> Meshlets;
+  MaterialHandle MaterialID;
+  // sizes of the uploaded buffers, set by Renderer::createBuffer; draws use
+  // these so the CPU copies can be released, see CpuMeshData
+  uint32_t VertexCount = 0;
+  uint32_t IndexCount = 0;
+  // vertex array of packed positions sharing the index buffer, for depth
+  // only passes; 0 unless Renderer::setPositionStreams was on at upload
+  unsigned int PositionId = 0;
+  // where the mesh starts in buffers shared with other meshes, see
+  // Renderer::setSharedBuffers; 0 when it has buffers of its own
+  uint32_t BaseVertex = 0;
+  uint32_t FirstIndex = 0;
+  // vertex positions kept by CpuMeshData::Collision
+  std::vector<glm::vec3> Positions;
   Mesh() {}
   Mesh(std::vector<Vertex> &vertices, std::vector<unsigned int> &indices)
   {
@@ -70,14 +212,160 @@ public:
     Indices = indices;
   }
 };
+// Byte offset of the mesh's index first in its element buffer; draws add
+// Mesh::BaseVertex to the indices
+inline const void *elementOffset(const Mesh &mesh, uint32_t first = 0)
+{
+  return (const void *)((size_t)(mesh.FirstIndex + first) *
+                        sizeof(unsigned int));
+}
+// What stays in memory once a mesh is on the GPU
+enum class CpuMeshData
+{
+  // Vertices and Indices as they were uploaded
+  Keep,
+  // Positions and the finest level of Indices, for picking and physics
+  Collision,
+  // nothing but counts, bounds, detail levels and meshlets
+  Release
+};
+inline void releaseCpuData(Mesh &mesh, CpuMeshData keep)
+{
+  if (keep == CpuMeshData::Keep)
+  {
+    return;
+  }
+  if (keep == CpuMeshData::Collision)
+  {
+    mesh.Positions.resize(mesh.Vertices.size());
+    for (size_t i = 0; i < mesh.Vertices.size(); ++i)
+    {
+      mesh.Positions[i] = mesh.Vertices[i].Position;
+    }
+    if (!mesh.Lods.empty())
+    {
+      mesh.Indices.resize(mesh.Lods[0].indexCount);
+      mesh.Indices.shrink_to_fit();
+    }
+  }
+  else
+  {
+    std::vector<unsigned int>().swap(mesh.Indices);
+  }
+  std::vector<Vertex>().swap(mesh.Vertices);
+}
+// Box and sphere around the vertices; the sphere is centred on the box
+inline void computeBounds(Mesh &mesh)
+{
+  mesh.Bounds = BoundingBox();
+  for (const auto &vertex : mesh.Vertices)
+  {
+    mesh.Bounds.extend(vertex.Position);
+  }
+  mesh.Sphere = BoundingSphere();
+  if (!mesh.Bounds.valid())
+  {
+    return;
+  }
+  mesh.Sphere.center = mesh.Bounds.center();
+  float radius2 = 0.0f;
+  for (const auto &vertex : mesh.Vertices)
+  {
+    glm::vec3 d = vertex.Position - mesh.Sphere.center;
+    radius2 = std::max(radius2, glm::dot(d, d));
+  }
+  mesh.Sphere.radius = std::sqrt(radius2);
+}
 struct Model
 {
   std::vector<Mesh> meshes;
+  BoundingBox bounds;
+  // node hierarchy of the source file, meshNodes[i] is the node that places
+  // meshes[i]; empty for models built by hand
+  SceneGraph nodes;
+  std::vector<uint32_t> meshNodes;
+  glm::mat4 meshTransform(size_t mesh) const
+  {
+    return mesh < meshNodes.size() ? nodes.world(meshNodes[mesh])
+                                   : glm::mat4(1.0f);
+  }
+  struct MemoryUsage
+  {
+    size_t meshes = 0;
+    // CPU copies: vertices, indices and collision positions
+    size_t vertexBytes = 0;
+    size_t indexBytes = 0;
+    size_t positionBytes = 0;
+    // detail level tables and meshlets
+    size_t metadataBytes = 0;
+    // uploaded vertex and index buffers
+    size_t gpuBytes = 0;
+    size_t cpuBytes() const
+    {
+      return vertexBytes + indexBytes + positionBytes + metadataBytes;
+    }
+  };
+  MemoryUsage memoryUsage() const
+  {
+    MemoryUsage usage;
+    usage.meshes = meshes.size();
+    for (const auto &mesh : meshes)
+    {
+      usage.vertexBytes += mesh.Vertices.capacity() * sizeof(Vertex);
+      usage.indexBytes += mesh.Indices.capacity() * sizeof(unsigned int);
+      usage.positionBytes += mesh.Positions.capacity() * sizeof(glm::vec3);
+      usage.metadataBytes += mesh.Lods.capacity() * sizeof(MeshLod) +
+                             mesh.Meshlets.capacity() * sizeof(Meshlet);
+      if (mesh.Id != 0)
+      {
+        usage.gpuBytes += (size_t)mesh.VertexCount * sizeof(Vertex) +
+                          (size_t)mesh.IndexCount * sizeof(unsigned int);
+      }
+    }
+    return usage;
+  }
+  // union of the mesh bounds placed by their nodes
+  void updateBounds()
+  {
+    nodes.update();
+    bounds = BoundingBox();
+    for (size_t i = 0; i < meshes.size(); ++i)
+    {
+      bounds.extend(meshes[i].Bounds.transformed(meshTransform(i)));
+    }
+  }
+};
+enum class LoadState
+{
+  Pending,
+  // some meshes can be drawn, the rest are on their way
+  Streaming,
+  Ready,
+  Failed,
+  Cancelled
+};
+// Model filled in over several frames by ModelLoader::loadModelAsync. Until
+// it is Ready, bounds is a unit box the renderer can draw a placeholder with.
+// Streaming models (loadModelStreaming) already know every mesh's bounds
+// and draw those that are uploaded (Mesh::Id != 0).
+struct AsyncModel
+{
+  Model model;
+  LoadState state = LoadState::Pending;
+  BoundingBox bounds = BoundingBox{glm::vec3(-0.5f), glm::vec3(0.5f)};
+  // projected size of each mesh when last drawn, 0 outside the view;
+  // streaming loads the largest first
+  std::vector<float> screenSize;
+  std::shared_ptr<std::atomic<bool>> cancelled =
+      std::make_shared<std::atomic<bool>>(false);
+  bool ready() const { return state == LoadState::Ready; }
+  void cancel() { *cancelled = true; }
 };
 struct OpenGLVAO
 {
 public:
   unsigned int VBO, EBO, VAO;
+  unsigned int PositionVBO = 0, PositionVAO = 0;
 };
 
 struct Material
@@ -138,6 +426,8 @@ public:
   {
     return glm::lookAt(Position, Position + Front, Up);
   }
+  // world space view frustum
+  Frustum frustum() { return Frustum(Projection * calculateViewMatrix()); }
   // calculates the front vector from the Camera's (updated) Euler Angles
   void updateCameraVectors()
   {
@@ -284,11 +574,297 @@ private:
   double lastY = 0;
   bool firstMouse = true;
 };
+struct ResidencyStats
+{
+  size_t textureBytes = 0;
+  size_t bufferBytes = 0;
+  size_t textureBudget = SIZE_MAX;
+  // top mip levels released under budget pressure
+  unsigned int mipDrops = 0;
+  // textures reduced to their smallest mip
+  unsigned int evictions = 0;
+  // evicted textures decoded and uploaded again on use
+  unsigned int reloads = 0;
+};
+// Estimated GPU memory of every texture and buffer created by the Renderer.
+// When a texture budget is set, textures not bound for unusedFrames frames
+// give their top mips back in LRU order and are reloaded on the next touch.
+class GpuResidency
+{
+public:
+  void setTextureBudget(size_t bytes, unsigned int unusedFrames = 120)
+  {
+    stats.textureBudget = bytes;
+    this->unusedFrames = unusedFrames;
+  }
+  void trackTexture(unsigned int id, int width, int height, int channels,
+                    bool mipmapped, int faces = 1)
+  {
+    ResidentTexture texture;
+    texture.width = width;
+    texture.height = height;
+    texture.channels = channels;
+    texture.faces = faces;
+    texture.levels =
+        mipmapped ? 1 + (int)std::floor(std::log2(std::max(width, height)))
+                  : 1;
+    texture.lastUsedFrame = frame;
+    texture.bytes = levelBytes(texture, 0, texture.levels);
+    untrackTexture(id);
+    stats.textureBytes += texture.bytes;
+    textures[id] = texture;
+  }
+  // textures without a source can't be reloaded so they are never evicted
+  void setTextureSource(unsigned int id, std::function<bool(Image &)> source)
+  {
+    auto found = textures.find(id);
+    if (found != textures.end())
+    {
+      found->second.source = source;
+    }
+  }
+  void untrackTexture(unsigned int id)
+  {
+    auto found = textures.find(id);
+    if (found != textures.end())
+    {
+      stats.textureBytes -= found->second.bytes;
+      textures.erase(found);
+    }
+  }
+  void trackBuffer(unsigned int vao, size_t bytes)
+  {
+    untrackBuffer(vao);
+    buffers[vao] = bytes;
+    stats.bufferBytes += bytes;
+  }
+  void untrackBuffer(unsigned int vao)
+  {
+    auto found = buffers.find(vao);
+    if (found != buffers.end())
+    {
+      stats.bufferBytes -= found->second;
+      buffers.erase(found);
+    }
+  }
+  // marks the texture as used this frame, reloading it if it was evicted
+  void touch(unsigned int id)
+  {
+    auto found = textures.find(id);
+    if (found == textures.end())
+    {
+      return;
+    }
+    ResidentTexture &texture = found->second;
+    texture.lastUsedFrame = frame;
+    if (texture.baseLevel > 0)
+    {
+      reload(id, texture);
+    }
+  }
+  void beginFrame()
+  {
+    ++frame;
+    if (stats.textureBytes <= stats.textureBudget)
+    {
+      return;
+    }
+    std::vector<std::pair<uint64_t, unsigned int>> candidates;
+    for (auto &entry : textures)
+    {
+      const ResidentTexture &texture = entry.second;
+      if (texture.source && texture.baseLevel < texture.levels - 1 &&
+          frame - texture.lastUsedFrame >= unusedFrames)
+      {
+        candidates.push_back({texture.lastUsedFrame, entry.first});
+      }
+    }
+    std::sort(candidates.begin(), candidates.end());
+    for (auto &candidate : candidates)
+    {
+      ResidentTexture &texture = textures[candidate.second];
+      while (stats.textureBytes > stats.textureBudget &&
+             texture.baseLevel < texture.levels - 1)
+      {
+        dropTopMip(candidate.second, texture);
+      }
+      if (texture.baseLevel == texture.levels - 1)
+      {
+        ++stats.evictions;
+      }
+      if (stats.textureBytes <= stats.textureBudget)
+      {
+        break;
+      }
+    }
+  }
+  size_t textureBytes(unsigned int id) const
+  {
+    auto found = textures.find(id);
+    return found == textures.end() ? 0 : found->second.bytes;
+  }
+  size_t bufferBytes(unsigned int vao) const
+  {
+    auto found = buffers.find(vao);
+    return found == buffers.end() ? 0 : found->second;
+  }
+  const ResidencyStats &getStats() const { return stats; }
+  void printReport(std::ostream &out = std::cout) const
+  {
+    out << "GPU memory: textures " << stats.textureBytes / 1024
+        << " KiB, buffers " << stats.bufferBytes / 1024 << " KiB, "
+        << stats.mipDrops << " mip drops, " << stats.evictions
+        << " evictions, " << stats.reloads << " reloads\n";
+  }
+
+private:
+  struct ResidentTexture
+  {
+    int width, height, channels, faces;
+    int levels;
+    int baseLevel = 0;
+    size_t bytes;
+    uint64_t lastUsedFrame;
+    std::function<bool(Image &)> source;
+  };
+  static size_t levelBytes(const ResidentTexture &texture, int first,
+                           int last)
+  {
+    // drivers store RGB textures with a padding byte
+    size_t pixelSize = texture.channels == 3 ? 4 : texture.channels;
+    size_t bytes = 0;
+    for (int level = first; level < last; ++level)
+    {
+      bytes += (size_t)std::max(1, texture.width >> level) *
+               std::max(1, texture.height >> level) * pixelSize;
+    }
+    return bytes * texture.faces;
+  }
+  static GLenum format(int channels)
+  {
+    return channels == 1 ? GL_RED : channels == 3 ? GL_RGB : GL_RGBA;
+  }
+  void dropTopMip(unsigned int id, ResidentTexture &texture)
+  {
+    glBindTexture(GL_TEXTURE_2D, id);
+    GLenum fmt = format(texture.channels);
+    // respecifying a level with no storage releases it
+    glTexImage2D(GL_TEXTURE_2D, texture.baseLevel, fmt, 0, 0, 0, fmt,
+                 GL_UNSIGNED_BYTE, nullptr);
+    size_t freed =
+        levelBytes(texture, texture.baseLevel, texture.baseLevel + 1);
+    ++texture.baseLevel;
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_BASE_LEVEL, texture.baseLevel);
+    texture.bytes -= freed;
+    stats.textureBytes -= freed;
+    ++stats.mipDrops;
+  }
+  void reload(unsigned int id, ResidentTexture &texture)
+  {
+    Image image;
+    if (!texture.source(image) || !image.data)
+    {
+      std::cout << "Failed to reload evicted texture " << id << "\n";
+      return;
+    }
+    GLenum fmt = format(image.nrChannels);
+    glBindTexture(GL_TEXTURE_2D, id);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_BASE_LEVEL, 0);
+    glTexImage2D(GL_TEXTURE_2D, 0, fmt, image.width, image.height, 0, fmt,
+                 GL_UNSIGNED_BYTE, image.data);
+    glGenerateMipmap(GL_TEXTURE_2D);
+    stbi_image_free(image.data);
+    stats.textureBytes -= texture.bytes;
+    texture.baseLevel = 0;
+    texture.bytes = levelBytes(texture, 0, texture.levels);
+    stats.textureBytes += texture.bytes;
+    ++stats.reloads;
+  }
+  std::unordered_map<unsigned int, ResidentTexture> textures;
+  std::unordered_map<unsigned int, size_t> buffers;
+  uint64_t frame = 0;
+  unsigned int unusedFrames = 120;
+  ResidencyStats stats;
+};
+// First fit allocator of element ranges in a buffer that can grow
+class RangeAllocator
+{
+public:
+  static constexpr uint32_t NONE = UINT32_MAX;
+  // offset of count free elements, NONE when no free range is that large
+  uint32_t allocate(uint32_t count)
+  {
+    if (count == 0)
+    {
+      return 0;
+    }
+    for (auto range = ranges.begin(); range != ranges.end(); ++range)
+    {
+      if (range->second >= count)
+      {
+        uint32_t offset = range->first;
+        range->first += count;
+        range->second -= count;
+        if (range->second == 0)
+        {
+          ranges.erase(range);
+        }
+        return offset;
+      }
+    }
+    return NONE;
+  }
+  void release(uint32_t offset, uint32_t count)
+  {
+    if (count == 0)
+    {
+      return;
+    }
+    auto next = std::lower_bound(ranges.begin(), ranges.end(),
+                                 std::make_pair(offset, 0u));
+    if (next != ranges.end() && offset + count == next->first)
+    {
+      next->first = offset;
+      next->second += count;
+    }
+    else
+    {
+      next = ranges.insert(next, std::make_pair(offset, count));
+    }
+    if (next != ranges.begin())
+    {
+      auto previous = next - 1;
+      if (previous->first + previous->second == next->first)
+      {
+        previous->second += next->second;
+        ranges.erase(next);
+      }
+    }
+  }
+  // frees the elements between the current capacity and capacity
+  void grow(uint32_t capacity)
+  {
+    release(this->capacity, capacity - this->capacity);
+    this->capacity = capacity;
+  }
+  uint32_t getCapacity() const { return capacity; }
+
+private:
+  // free (offset, count) pairs sorted by offset, neighbours merged
+  std::vector<std::pair<uint32_t, uint32_t>> ranges;
+  uint32_t capacity = 0;
+};
 class Renderer
 {
 public:
-  unsigned int createBuffer(Mesh &mesh)
+  // keep says which CPU copies stay once the data is on the GPU
+  unsigned int createBuffer(Mesh &mesh,
+                            CpuMeshData keep = CpuMeshData::Keep)
   {
+    if (sharedBuffers)
+    {
+      return appendShared(mesh, keep);
+    }
     OpenGLVAO openGlMesh;
     glGenVertexArrays(1, &openGlMesh.VAO);
     glGenBuffers(1, &openGlMesh.VBO);
@@ -305,25 +881,75 @@ public:
                  mesh.Indices.size() * sizeof(unsigned int),
                  mesh.Indices.data(), GL_STATIC_DRAW);
 
-    // vertex positions
-    glEnableVertexAttribArray(0);
-    glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex),
-                          (void *)offsetof(Vertex, Position));
-    // vertex normals
-    glVertexAttribPointer(2, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex),
-                          (void *)offsetof(Vertex, Normal));
-    glEnableVertexAttribArray(2);
-    // vertex texture coords
-    glEnableVertexAttribArray(1);
-    glVertexAttribPointer(1, 2, GL_FLOAT, GL_FALSE, sizeof(Vertex),
-                          (void *)offsetof(Vertex, TexCoords));
+    setVertexAttributes(openGlMesh.VBO);
 
     glBindVertexArray(0);
 
     mesh.Id = openGlMesh.VAO;
+    mesh.VertexCount = (uint32_t)mesh.Vertices.size();
+    mesh.IndexCount = (uint32_t)mesh.Indices.size();
+    size_t positionBytes = 0;
+    if (positionStreams)
+    {
+      positionBytes = createPositionStream(mesh, openGlMesh);
+    }
+    buffers[openGlMesh.VAO] = openGlMesh;
+    residency.trackBuffer(openGlMesh.VAO,
+                          mesh.Vertices.size() * sizeof(Vertex) +
+                              mesh.Indices.size() * sizeof(unsigned int) +
+                              positionBytes);
+    releaseCpuData(mesh, keep);
 
     return openGlMesh.VAO;
   }
+  void destroyBuffer(Mesh &mesh)
+  {
+    if (mesh.Id != 0 && mesh.Id == shared.VAO)
+    {
+      // the range is reused by later uploads, the buffers stay
+      sharedVertices.release(mesh.BaseVertex, mesh.VertexCount);
+      sharedIndices.release(mesh.FirstIndex, mesh.IndexCount);
+      mesh.Id = 0;
+      mesh.PositionId = 0;
+      mesh.BaseVertex = 0;
+      mesh.FirstIndex = 0;
+      return;
+    }
+    auto found = buffers.find(mesh.Id);
+    if (found == buffers.end())
+    {
+      return;
+    }
+    glDeleteBuffers(1, &found->second.VBO);
+    glDeleteBuffers(1, &found->second.EBO);
+    glDeleteVertexArrays(1, &found->second.VAO);
+    if (found->second.PositionVAO != 0)
+    {
+      glDeleteBuffers(1, &found->second.PositionVBO);
+      glDeleteVertexArrays(1, &found->second.PositionVAO);
+    }
+    residency.untrackBuffer(mesh.Id);
+    buffers.erase(found);
+    mesh.Id = 0;
+    mesh.PositionId = 0;
+  }
+  // Meshes uploaded while on also get their positions packed in a buffer
+  // of their own, so depth only passes fetch 12 bytes per vertex instead of
+  // a whole Vertex; see MeshRenderer::setDepthPrepass
+  void setPositionStreams(bool enabled) { positionStreams = enabled; }
+  // Meshes uploaded while on are appended to one vertex and one index
+  // buffer behind a single vertex array, and draw their range through
+  // Mesh::BaseVertex and Mesh::FirstIndex. Draws of different meshes then
+  // need no vertex array switch and can share a multi draw indirect call,
+  // see MeshRenderer::setMultiDrawIndirect. The buffers grow by copying on
+  // the GPU; destroyed meshes leave a hole the next uploads fill.
+  void setSharedBuffers(bool enabled) { sharedBuffers = enabled; }
+  void destroyTexture(unsigned int id)
+  {
+    glDeleteTextures(1, &id);
+    residency.untrackTexture(id);
+  }
+  GpuResidency &getResidency() { return residency; }
   unsigned int createTexture2D(const aiTexture *aiTexture)
   {
     unsigned int texture;
@@ -342,9 +968,12 @@ public:
     glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T,
                     (aiTexture->achFormatHint[0] & 0x01) ? GL_REPEAT
                                                          : GL_CLAMP);
-    // Texture specification
-    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, 500, 500, 0, GL_BGRA,
-                 GL_UNSIGNED_BYTE, (void *)aiTexture->pcData);
+    // Texture specification (uncompressed embedded textures are ARGB8888)
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, aiTexture->mWidth,
+                 aiTexture->mHeight, 0, GL_BGRA, GL_UNSIGNED_BYTE,
+                 (void *)aiTexture->pcData);
+    residency.trackTexture(texture, aiTexture->mWidth, aiTexture->mHeight, 4,
+                           false);
     return texture;
   }
   unsigned int createTextureCube(const std::vector<Image> &images)
@@ -363,6 +992,11 @@ public:
     {
       glTexImage2D(GL_TEXTURE_CUBE_MAP_POSITIVE_X + i, 0, GL_RGB, images[i].width, images[i].height, 0, GL_RGB, GL_UNSIGNED_BYTE, images[i].data);
     }
+    if (!images.empty())
+    {
+      residency.trackTexture(textureID, images[0].width, images[0].height, 3,
+                             false, (int)images.size());
+    }
 
     return textureID;
   }
@@ -370,6 +1004,12 @@ public:
   {
     unsigned int texture;
     glGenTextures(1, &texture);
+    uploadTexture2D(texture, image);
+    return texture;
+  }
+  // (re)defines every level of an existing texture name from image
+  void uploadTexture2D(unsigned int texture, const Image &image)
+  {
     if (image.data)
     {
       GLenum format;
@@ -384,6 +1024,7 @@ public:
       std::cout << "Image format: " << image.nrChannels << "\n";
       // bind texture
       glBindTexture(GL_TEXTURE_2D, texture);
+      glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_BASE_LEVEL, 0);
       glTexImage2D(GL_TEXTURE_2D, 0, format, image.width, image.height, 0,
                    format, GL_UNSIGNED_BYTE, image.data);
 
@@ -398,52 +1039,261 @@ public:
       glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
 
       glGenerateMipmap(GL_TEXTURE_2D);
+      residency.trackTexture(texture, image.width, image.height,
+                             image.nrChannels, true);
     }
-
+  }
+  // small magenta/black checker shown while the real image is decoded
+  unsigned int createPlaceholderTexture()
+  {
+    const int size = 8;
+    std::vector<unsigned char> texels(size * size * 4);
+    for (int y = 0; y < size; ++y)
+    {
+      for (int x = 0; x < size; ++x)
+      {
+        unsigned char *texel = &texels[(y * size + x) * 4];
+        bool odd = ((x / 2) + (y / 2)) % 2;
+        texel[0] = odd ? 255 : 0;
+        texel[1] = 0;
+        texel[2] = odd ? 255 : 0;
+        texel[3] = 255;
+      }
+    }
+    unsigned int texture;
+    glGenTextures(1, &texture);
+    glBindTexture(GL_TEXTURE_2D, texture);
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, size, size, 0, GL_RGBA,
+                 GL_UNSIGNED_BYTE, texels.data());
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+    residency.trackTexture(texture, size, size, 4, false);
     return texture;
   }
-};
 
-Mesh createPlane()
-{
-  const int rowSize = 5;
-  Mesh plane;
-  float normals[] = {0.0f, 0.0f, -1.0f, 0.0f, 0.0f, -1.0f, 0.0f, 0.0f, -1.0f,
-                     0.0f, 0.0f, -1.0f, 0.0f, 0.0f, -1.0f, 0.0f, 0.0f, -1.0f};
-  std::vector<float> vertices = {
-      -0.5f, -0.5f, -0.5f, 0.0f, 0.0f, 0.5f, -0.5f, -0.5f, 1.0f, 0.0f,
-      0.5f, 0.5f, -0.5f, 1.0f, 1.0f, 0.5f, 0.5f, -0.5f, 1.0f, 1.0f,
-      -0.5f, 0.5f, -0.5f, 0.0f, 1.0f, -0.5f, -0.5f, -0.5f, 0.0f, 0.0f};
-  int nbVertice = (int)vertices.size() / rowSize;
-  plane.Vertices = std::vector<Vertex>(nbVertice);
-  int j = 0;
-  for (int i = 0; i < vertices.size(); i = i + rowSize)
+private:
+  // position only vertex array reusing the mesh's index buffer, returns
+  // the bytes uploaded
+  size_t createPositionStream(Mesh &mesh, OpenGLVAO &openGlMesh)
   {
-    int indice = i / rowSize;
-    plane.Vertices[indice] =
-        Vertex(glm::vec3(vertices[i], vertices[i + 1], vertices[i + 2]),
-               glm::vec2(vertices[i + 3], vertices[i + 4]),
-               glm::vec3(normals[j], normals[j + 1], normals[j + 2]));
-    j = j + 3;
+    std::vector<glm::vec3> positions(mesh.Vertices.size());
+    for (size_t i = 0; i < positions.size(); ++i)
+    {
+      positions[i] = mesh.Vertices[i].Position;
+    }
+    glGenVertexArrays(1, &openGlMesh.PositionVAO);
+    glGenBuffers(1, &openGlMesh.PositionVBO);
+    glBindVertexArray(openGlMesh.PositionVAO);
+    glBindBuffer(GL_ARRAY_BUFFER, openGlMesh.PositionVBO);
+    glBufferData(GL_ARRAY_BUFFER, positions.size() * sizeof(glm::vec3),
+                 positions.data(), GL_STATIC_DRAW);
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, openGlMesh.EBO);
+    setPositionAttribute(openGlMesh.PositionVBO);
+    glBindVertexArray(0);
+    mesh.PositionId = openGlMesh.PositionVAO;
+    return positions.size() * sizeof(glm::vec3);
   }
-  std::vector<unsigned int> indices(nbVertice);
-  std::iota(indices.begin(), indices.end(), 0);
-  plane.Indices = indices;
-
-  return plane;
-}
-Mesh createSkybox()
-{
-  auto skyBoxMesh = Mesh();
-  std::vector<float> skyboxVertices = {
-      // positions
-      -1.0f, 1.0f, -1.0f,
-      -1.0f, -1.0f, -1.0f,
-      1.0f, -1.0f, -1.0f,
-      1.0f, -1.0f, -1.0f,
-      1.0f, 1.0f, -1.0f,
-      -1.0f, 1.0f, -1.0f,
-
+  // attributes 0 to 2 of the bound vertex array, from a buffer of Vertex
+  static void setVertexAttributes(unsigned int vertexBuffer)
+  {
+    glBindBuffer(GL_ARRAY_BUFFER, vertexBuffer);
+    // vertex positions
+    glEnableVertexAttribArray(0);
+    glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex),
+                          (void *)offsetof(Vertex, Position));
+    // vertex normals
+    glVertexAttribPointer(2, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex),
+                          (void *)offsetof(Vertex, Normal));
+    glEnableVertexAttribArray(2);
+    // vertex texture coords
+    glEnableVertexAttribArray(1);
+    glVertexAttribPointer(1, 2, GL_FLOAT, GL_FALSE, sizeof(Vertex),
+                          (void *)offsetof(Vertex, TexCoords));
+  }
+  // attribute 0 of the bound vertex array, from packed positions
+  static void setPositionAttribute(unsigned int positionBuffer)
+  {
+    glBindBuffer(GL_ARRAY_BUFFER, positionBuffer);
+    glEnableVertexAttribArray(0);
+    glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(glm::vec3),
+                          (void *)0);
+  }
+  // createBuffer with setSharedBuffers on
+  unsigned int appendShared(Mesh &mesh, CpuMeshData keep)
+  {
+    uint32_t vertexCount = (uint32_t)mesh.Vertices.size();
+    uint32_t indexCount = (uint32_t)mesh.Indices.size();
+    if (shared.VAO == 0)
+    {
+      glGenVertexArrays(1, &shared.VAO);
+    }
+    // buffers were replaced, the vertex arrays need pointing at them
+    bool rebind = false;
+    bool positions = positionStreams;
+    if (positions && shared.PositionVAO == 0)
+    {
+      // as large as the vertex buffer; meshes uploaded before have no
+      // PositionId, so their ranges are never read
+      glGenVertexArrays(1, &shared.PositionVAO);
+      shared.PositionVBO = resizeBuffer(
+          0, 0, sharedVertices.getCapacity() * sizeof(glm::vec3));
+      rebind = true;
+    }
+    uint32_t baseVertex = sharedVertices.allocate(vertexCount);
+    if (baseVertex == RangeAllocator::NONE)
+    {
+      uint32_t capacity = sharedVertices.getCapacity();
+      uint32_t grown = std::max(capacity * 2, capacity + vertexCount);
+      shared.VBO = resizeBuffer(shared.VBO, capacity * sizeof(Vertex),
+                                grown * sizeof(Vertex));
+      if (shared.PositionVAO != 0)
+      {
+        shared.PositionVBO =
+            resizeBuffer(shared.PositionVBO, capacity * sizeof(glm::vec3),
+                         grown * sizeof(glm::vec3));
+      }
+      sharedVertices.grow(grown);
+      baseVertex = sharedVertices.allocate(vertexCount);
+      rebind = true;
+    }
+    uint32_t firstIndex = sharedIndices.allocate(indexCount);
+    if (firstIndex == RangeAllocator::NONE)
+    {
+      uint32_t capacity = sharedIndices.getCapacity();
+      uint32_t grown = std::max(capacity * 2, capacity + indexCount);
+      shared.EBO = resizeBuffer(shared.EBO, capacity * sizeof(unsigned int),
+                                grown * sizeof(unsigned int));
+      sharedIndices.grow(grown);
+      firstIndex = sharedIndices.allocate(indexCount);
+      rebind = true;
+    }
+    if (rebind && shared.VBO != 0)
+    {
+      bindSharedArrays();
+    }
+    if (vertexCount > 0)
+    {
+      glBindBuffer(GL_COPY_WRITE_BUFFER, shared.VBO);
+      glBufferSubData(GL_COPY_WRITE_BUFFER, baseVertex * sizeof(Vertex),
+                      vertexCount * sizeof(Vertex), mesh.Vertices.data());
+    }
+    if (positions && vertexCount > 0)
+    {
+      std::vector<glm::vec3> packed(vertexCount);
+      for (uint32_t i = 0; i < vertexCount; ++i)
+      {
+        packed[i] = mesh.Vertices[i].Position;
+      }
+      glBindBuffer(GL_COPY_WRITE_BUFFER, shared.PositionVBO);
+      glBufferSubData(GL_COPY_WRITE_BUFFER, baseVertex * sizeof(glm::vec3),
+                      vertexCount * sizeof(glm::vec3), packed.data());
+    }
+    if (indexCount > 0)
+    {
+      glBindBuffer(GL_COPY_WRITE_BUFFER, shared.EBO);
+      glBufferSubData(GL_COPY_WRITE_BUFFER,
+                      firstIndex * sizeof(unsigned int),
+                      indexCount * sizeof(unsigned int), mesh.Indices.data());
+    }
+    mesh.Id = shared.VAO;
+    mesh.PositionId = positions ? shared.PositionVAO : 0;
+    mesh.BaseVertex = baseVertex;
+    mesh.FirstIndex = firstIndex;
+    mesh.VertexCount = vertexCount;
+    mesh.IndexCount = indexCount;
+    residency.trackBuffer(
+        shared.VAO,
+        sharedVertices.getCapacity() *
+                (sizeof(Vertex) +
+                 (shared.PositionVAO != 0 ? sizeof(glm::vec3) : 0)) +
+            sharedIndices.getCapacity() * sizeof(unsigned int));
+    releaseCpuData(mesh, keep);
+    return shared.VAO;
+  }
+  // a new buffer of newBytes starting with the bytes of buffer, which is
+  // deleted
+  static unsigned int resizeBuffer(unsigned int buffer, size_t bytes,
+                                   size_t newBytes)
+  {
+    unsigned int resized;
+    glGenBuffers(1, &resized);
+    glBindBuffer(GL_COPY_WRITE_BUFFER, resized);
+    glBufferData(GL_COPY_WRITE_BUFFER, newBytes, nullptr, GL_STATIC_DRAW);
+    if (buffer != 0)
+    {
+      glBindBuffer(GL_COPY_READ_BUFFER, buffer);
+      glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, 0, 0,
+                          bytes);
+      glDeleteBuffers(1, &buffer);
+    }
+    return resized;
+  }
+  // points the shared vertex arrays at the current shared buffers
+  void bindSharedArrays()
+  {
+    glBindVertexArray(shared.VAO);
+    setVertexAttributes(shared.VBO);
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, shared.EBO);
+    if (shared.PositionVAO != 0)
+    {
+      glBindVertexArray(shared.PositionVAO);
+      setPositionAttribute(shared.PositionVBO);
+      glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, shared.EBO);
+    }
+    glBindVertexArray(0);
+  }
+  std::unordered_map<unsigned int, OpenGLVAO> buffers;
+  GpuResidency residency;
+  bool positionStreams = false;
+  // buffers of setSharedBuffers and their free ranges, in elements
+  OpenGLVAO shared = {0, 0, 0};
+  RangeAllocator sharedVertices;
+  RangeAllocator sharedIndices;
+  bool sharedBuffers = false;
+};
+
+Mesh createPlane()
+{
+  const int rowSize = 5;
+  Mesh plane;
+  float normals[] = {0.0f, 0.0f, -1.0f, 0.0f, 0.0f, -1.0f, 0.0f, 0.0f, -1.0f,
+                     0.0f, 0.0f, -1.0f, 0.0f, 0.0f, -1.0f, 0.0f, 0.0f, -1.0f};
+  std::vector<float> vertices = {
+      -0.5f, -0.5f, -0.5f, 0.0f, 0.0f, 0.5f, -0.5f, -0.5f, 1.0f, 0.0f,
+      0.5f, 0.5f, -0.5f, 1.0f, 1.0f, 0.5f, 0.5f, -0.5f, 1.0f, 1.0f,
+      -0.5f, 0.5f, -0.5f, 0.0f, 1.0f, -0.5f, -0.5f, -0.5f, 0.0f, 0.0f};
+  int nbVertice = (int)vertices.size() / rowSize;
+  plane.Vertices = std::vector<Vertex>(nbVertice);
+  int j = 0;
+  for (int i = 0; i < vertices.size(); i = i + rowSize)
+  {
+    int indice = i / rowSize;
+    plane.Vertices[indice] =
+        Vertex(glm::vec3(vertices[i], vertices[i + 1], vertices[i + 2]),
+               glm::vec2(vertices[i + 3], vertices[i + 4]),
+               glm::vec3(normals[j], normals[j + 1], normals[j + 2]));
+    j = j + 3;
+  }
+  std::vector<unsigned int> indices(nbVertice);
+  std::iota(indices.begin(), indices.end(), 0);
+  plane.Indices = indices;
+  weldVertices(plane.Vertices, plane.Indices);
+
+  computeBounds(plane);
+  return plane;
+}
+Mesh createSkybox()
+{
+  auto skyBoxMesh = Mesh();
+  std::vector<float> skyboxVertices = {
+      // positions
+      -1.0f, 1.0f, -1.0f,
+      -1.0f, -1.0f, -1.0f,
+      1.0f, -1.0f, -1.0f,
+      1.0f, -1.0f, -1.0f,
+      1.0f, 1.0f, -1.0f,
+      -1.0f, 1.0f, -1.0f,
+
       -1.0f, -1.0f, 1.0f,
       -1.0f, -1.0f, -1.0f,
       -1.0f, 1.0f, -1.0f,
@@ -485,6 +1335,7 @@ Mesh createSkybox()
     vertex.Position = glm::vec3(skyboxVertices[i], skyboxVertices[i + 1], skyboxVertices[i + 2]);
     skyBoxMesh.Vertices.push_back(vertex);
   }
+  computeBounds(skyBoxMesh);
   return skyBoxMesh;
 }
 Mesh createCube()
@@ -549,9 +1400,78 @@ Mesh createCube()
   std::vector<unsigned int> indices(nbVertice);
   std::iota(indices.begin(), indices.end(), 0);
   cube.Indices = indices;
+  weldVertices(cube.Vertices, cube.Indices);
 
+  computeBounds(cube);
   return cube;
 }
+// Unit UV sphere, for light volumes. The faces lie inside the unit sphere,
+// scale by 1 / (cos(pi / segments) * cos(pi / (2 * rings))) to enclose it.
+Mesh createSphere(int rings = 8, int segments = 12)
+{
+  Mesh sphere;
+  const float pi = glm::pi<float>();
+  for (int ring = 0; ring <= rings; ++ring)
+  {
+    float latitude = pi * ring / rings;
+    for (int segment = 0; segment <= segments; ++segment)
+    {
+      float longitude = 2.0f * pi * segment / segments;
+      glm::vec3 position(std::sin(latitude) * std::cos(longitude),
+                         std::cos(latitude),
+                         std::sin(latitude) * std::sin(longitude));
+      sphere.Vertices.push_back(
+          Vertex(position,
+                 glm::vec2((float)segment / segments, (float)ring / rings),
+                 position));
+    }
+  }
+  for (int ring = 0; ring < rings; ++ring)
+  {
+    for (int segment = 0; segment < segments; ++segment)
+    {
+      unsigned int first = ring * (segments + 1) + segment;
+      unsigned int below = first + segments + 1;
+      // counter clockwise seen from outside
+      sphere.Indices.insert(sphere.Indices.end(),
+                            {first, first + 1, below, below, first + 1,
+                             below + 1});
+    }
+  }
+  computeBounds(sphere);
+  return sphere;
+}
+// Unit cone with its apex at the origin, opening down -z to a base of
+// radius 1 at z = -1. Scale the radius by 1 / cos(pi / segments) to
+// enclose the round cone.
+Mesh createCone(int segments = 12)
+{
+  Mesh cone;
+  const float pi = glm::pi<float>();
+  cone.Vertices.push_back(Vertex(glm::vec3(0.0f), glm::vec2(0.5f),
+                                 glm::vec3(0.0f, 0.0f, 1.0f)));
+  cone.Vertices.push_back(Vertex(glm::vec3(0.0f, 0.0f, -1.0f),
+                                 glm::vec2(0.5f),
+                                 glm::vec3(0.0f, 0.0f, -1.0f)));
+  for (int segment = 0; segment < segments; ++segment)
+  {
+    float angle = 2.0f * pi * segment / segments;
+    glm::vec3 position(std::cos(angle), std::sin(angle), -1.0f);
+    cone.Vertices.push_back(
+        Vertex(position, glm::vec2((float)segment / segments, 1.0f),
+               glm::normalize(glm::vec3(position.x, position.y, 1.0f))));
+  }
+  for (int segment = 0; segment < segments; ++segment)
+  {
+    unsigned int current = 2 + segment;
+    unsigned int next = 2 + (segment + 1) % segments;
+    // side, then base, counter clockwise seen from outside
+    cone.Indices.insert(cone.Indices.end(),
+                        {0u, current, next, 1u, next, current});
+  }
+  computeBounds(cone);
+  return cone;
+}
 
 struct Sprite
 {
@@ -617,37 +1537,56 @@ class SpriteRenderer
 private:
   std::unordered_map<int, unsigned int> vaos;
   std::unordered_map<int, std::pair<unsigned, unsigned>> vbos;
+  GpuResidency *residency = nullptr;
 
 public:
-  void render(Camera &camera, const std::vector<Sprite> &sprites, int matID,
-              const std::vector<Material> &materials,
+  SpriteRenderer() {}
+  SpriteRenderer(GpuResidency &residency) : residency(&residency) {}
+  void render(Camera &camera, const std::vector<Sprite> &sprites,
+              MaterialHandle matID, const Pool<Material> &materials,
               const std::vector<glm::mat4> &transforms)
   {
+    if (!materials.contains(matID))
+    {
+      std::cout << "No material with id " << matID.index << "\n";
+      return;
+    }
     Mesh mesh;
-    std::vector<glm::mat4> verticeTransforms(transforms.size() * 6);
-    mesh.Vertices = std::vector<Vertex>(sprites.size() * 6);
+    // sprite meshes are welded and indexed, expand them for glDrawArrays
+    size_t vertexCount = 0;
+    for (const auto &sprite : sprites)
+    {
+      vertexCount += sprite.mesh.Indices.empty() ? sprite.mesh.Vertices.size()
+                                                 : sprite.mesh.Indices.size();
+    }
+    std::vector<glm::mat4> verticeTransforms(vertexCount);
+    mesh.Vertices = std::vector<Vertex>(vertexCount);
     int nbSprite = 0;
     int nbVertice = 0;
-    for (auto sprite : sprites)
+    for (const auto &sprite : sprites)
     {
-      for (auto vertice : sprite.mesh.Vertices)
+      const auto &vertices = sprite.mesh.Vertices;
+      const auto &indices = sprite.mesh.Indices;
+      size_t count = indices.empty() ? vertices.size() : indices.size();
+      for (size_t i = 0; i < count; ++i)
       {
         verticeTransforms[nbVertice] = transforms[nbSprite];
-        mesh.Vertices[nbVertice] = vertice;
+        mesh.Vertices[nbVertice] = vertices[indices.empty() ? i : indices[i]];
         ++nbVertice;
       }
       ++nbSprite;
     }
-    if (vaos.find(matID) == vaos.end())
+    int key = (int)matID.index;
+    if (vaos.find(key) == vaos.end())
     {
-      glGenVertexArrays(1, &vaos[matID]);
-      glBindVertexArray(vaos[matID]);
+      glGenVertexArrays(1, &vaos[key]);
+      glBindVertexArray(vaos[key]);
 
-      vbos[matID] = std::make_pair<int, int>(0, 0);
+      vbos[key] = std::make_pair<int, int>(0, 0);
 
-      glGenBuffers(1, &vbos[matID].first);
+      glGenBuffers(1, &vbos[key].first);
 
-      glBindBuffer(GL_ARRAY_BUFFER, vbos[matID].first);
+      glBindBuffer(GL_ARRAY_BUFFER, vbos[key].first);
 
       glBufferData(GL_ARRAY_BUFFER, mesh.Vertices.size() * sizeof(Vertex),
                    mesh.Vertices.data(), GL_DYNAMIC_DRAW);
@@ -664,9 +1603,9 @@ public:
                             (void *)offsetof(Vertex, TexCoords));
       glEnableVertexAttribArray(1);
 
-      glGenBuffers(1, &vbos[matID].second);
+      glGenBuffers(1, &vbos[key].second);
 
-      glBindBuffer(GL_ARRAY_BUFFER, vbos[matID].second);
+      glBindBuffer(GL_ARRAY_BUFFER, vbos[key].second);
       glBufferData(GL_ARRAY_BUFFER,
                    sizeof(glm::mat4) * verticeTransforms.size(),
                    verticeTransforms.data(), GL_STREAM_DRAW);
@@ -680,21 +1619,21 @@ public:
     }
     else
     {
-      glBindBuffer(GL_ARRAY_BUFFER, vbos[matID].first);
+      glBindBuffer(GL_ARRAY_BUFFER, vbos[key].first);
       glBufferData(GL_ARRAY_BUFFER, mesh.Vertices.size() * sizeof(Vertex),
                    mesh.Vertices.data(), GL_DYNAMIC_DRAW);
 
-      glBindBuffer(GL_ARRAY_BUFFER, vbos[matID].second);
+      glBindBuffer(GL_ARRAY_BUFFER, vbos[key].second);
       glBufferData(GL_ARRAY_BUFFER,
                    sizeof(glm::mat4) * verticeTransforms.size(),
                    verticeTransforms.data(), GL_STREAM_DRAW);
     }
-    Material mat = materials[matID];
+    const Material &mat = materials[matID];
     mat.shader->use();
     unsigned int diffuseNr = 1;
     unsigned int specularNr = 1;
     unsigned int i = 0;
-    for (auto text : mat.textures)
+    for (const auto &text : mat.textures)
     {
       glActiveTexture(GL_TEXTURE0 + i);
       int uniformLocation;
@@ -714,6 +1653,10 @@ public:
         break;
       }
       glUniform1i(uniformLocation, i);
+      if (residency)
+      {
+        residency->touch(text.id);
+      }
       glBindTexture(GL_TEXTURE_2D, text.id);
       ++i;
     }
@@ -733,37 +1676,51 @@ public:
     glUniformMatrix4fv(projectionLoc, 1, GL_FALSE,
                        glm::value_ptr(camera.Projection));
 
-    glBindVertexArray(vaos[matID]);
+    glBindVertexArray(vaos[key]);
     glDrawArrays(GL_TRIANGLES, 0, (int)mesh.Vertices.size());
     glBindVertexArray(0);
   }
 };
 
+struct TextureStats
+{
+  // textures decoded and sent to the GPU
+  unsigned int uploads = 0;
+  // requests answered by an already known path
+  unsigned int pathHits = 0;
+  // new paths (or unnamed embedded textures) matching an uploaded content hash
+  unsigned int contentHits = 0;
+  // GPU bytes (mips included) not allocated thanks to the content hash
+  size_t bytesSaved = 0;
+  size_t bytesUploaded = 0;
+};
 class ResourceManager
 {
 public:
   ResourceManager(Renderer &rendeder) : rendeder(rendeder)
   {
-    textures = std::make_unique<std::unordered_map<std::string, Texture>>();
-    materials = std::make_unique<std::vector<Material>>();
+    textures =
+        std::make_unique<std::unordered_map<std::string, TextureHandle>>();
+    materials = std::make_unique<Pool<Material>>();
+    jobs = std::make_unique<JobSystem>();
   }
-  int addMaterial(Material material)
+  MaterialHandle addMaterial(Material material)
   {
-    materials->push_back(material);
-    size_t pos = materials->size() - 1;
-    return (int)pos;
+    return materials->add(std::move(material));
   }
-  Material getMaterial(int id)
+  const Material &getMaterial(MaterialHandle handle) const
   {
-    if (materials->size() < id)
+    if (!materials->contains(handle))
     {
-      std::cout << "No material with id " << id << "\n";
-      return Material();
+      static const Material missing;
+      std::cout << "No material with id " << handle.index << "\n";
+      return missing;
     }
-    return materials->at(id);
+    return materials->get(handle);
   }
+  void removeMaterial(MaterialHandle handle) { materials->remove(handle); }
 
-  const std::vector<Material> getMaterials() { return *materials; }
+  const Pool<Material> &getMaterials() const { return *materials; }
 
   const Texture loadTextureCube(std::vector<Image> &images)
   {
@@ -780,264 +1737,3038 @@ public:
   }
   const Texture loadTexture2D(Image &image)
   {
-    if (textures->find(image.path) == textures->end())
+    if (!image.path.empty() && textures->find(image.path) != textures->end())
+    {
+      ++textureStats.pathHits;
+      freeImage(image);
+      return getTexture(image.path);
+    }
+    // hash the compressed file when we have it, the decoded pixels otherwise
+    uint64_t hash;
+    std::vector<unsigned char> bytes;
+    if (image.data == nullptr && readBytes(image.path, bytes))
+    {
+      hash = hashBytes(bytes.data(), bytes.size(), image.flipVertically);
+    }
+    else
     {
       loadImage(image);
-      Texture texture;
-      texture.id = rendeder.createTexture2D(image);
-      texture.type = TextureType::Diffuse;
-      textures->insert({image.path, texture});
-      std::cout << "Texture " << texture.id << " loaded \n";
-      stbi_image_free(image.data);
-      return texture;
+      if (!image.data)
+      {
+        return Texture();
+      }
+      hash = hashBytes(image.data,
+                       (size_t)image.width * image.height * image.nrChannels,
+                       image.flipVertically);
     }
-    return getTexture(image.path);
-  }
-  const Texture loadTexture2D(const aiTexture *aiTexture)
-  {
-    if (textures->find(aiTexture->mFilename.C_Str()) == textures->end())
+    if (auto texture = findByContent(hash, image.path))
     {
-      Texture texture;
-      texture.id = rendeder.createTexture2D(aiTexture);
-      textures->insert({aiTexture->mFilename.C_Str(), texture});
-      std::cout << "Texture " << texture.id << " loaded \n";
-      return texture;
+      freeImage(image);
+      return *texture;
     }
-    return getTexture(aiTexture->mFilename.C_Str());
-  }
-  const Texture getTexture(const std::string &path)
-  {
-    if (textures->find(path) == textures->end())
+    if (image.data == nullptr &&
+        !decodeImage(bytes.data(), bytes.size(), image.flipVertically, image))
     {
-      std::cout << "No texture for " << path << "\n";
+      std::cout << "Texture failed to load at path: " << image.path << "\n";
       return Texture();
     }
-    return textures->at(path);
-  }
-
-private:
-  void loadImage(Image &image)
-  {
-    if (image.data == nullptr)
+    Texture texture;
+    texture.id = rendeder.createTexture2D(image);
+    texture.type = TextureType::Diffuse;
+    if (!bytes.empty())
     {
-      stbi_set_flip_vertically_on_load(image.flipVertically);
-      image.data = stbi_load(image.path.c_str(), &image.width, &image.height,
-                             &image.nrChannels, 0);
-      if (!image.data)
-      {
-        std::cout << "Cubemap texture failed to load at path: " << image.path.c_str() << std::endl;
-        stbi_image_free(image.data);
-      }
-      /*       stbi_image_free(image.data); */
+      setReloadSource(texture.id, image.path, image.flipVertically, nullptr);
     }
+    addByContent(hash, image.path, texture,
+                 textureBytes(image.width, image.height, image.nrChannels, true));
+    std::cout << "Texture " << texture.id << " loaded \n";
+    freeImage(image);
+    return texture;
   }
-  std::unique_ptr<std::unordered_map<std::string, Texture>> textures;
-  std::unique_ptr<std::vector<Material>> materials;
-  Renderer &rendeder;
-};
-class ModelLoader
-{
-public:
-  ModelLoader(ResourceManager &rManager) : resourceManager(rManager) {}
-  Model loadModel(std::string path)
+  const Texture loadTexture2D(const aiTexture *aiTexture)
   {
-    Model model;
-    Assimp::Importer import;
-
-    const aiScene *scene =
-        import.ReadFile(path, aiProcess_Triangulate | aiProcess_GenNormals);
-    if (!scene || scene->mFlags && AI_SCENE_FLAGS_INCOMPLETE ||
-        !scene->mRootNode)
-    {
-      std::cout << "ERROR::ASSIMP::" << import.GetErrorString() << std::endl;
-      return model;
-    }
-
-    std::cout << "Loaded " << scene->mRootNode->mName.C_Str() << "\n";
-
-    directory = path.substr(0, path.find_last_of("/"));
-
-    processNode(model, scene->mRootNode, scene);
-
-    return model;
+    return loadEmbeddedTexture(aiTexture->mFilename.C_Str(),
+                               (const unsigned char *)aiTexture->pcData,
+                               aiTexture->mWidth, aiTexture->mHeight);
   }
-
-private:
-  void processNode(Model &model, aiNode *node, const aiScene *scene)
+  // height == 0 means data holds width bytes of a compressed file, otherwise
+  // it is width * height ARGB8888 texels (Assimp's aiTexture layout)
+  const Texture loadEmbeddedTexture(const std::string &name,
+                                    const unsigned char *data,
+                                    unsigned int width, unsigned int height)
   {
-    // process all the node's meshes
-    for (unsigned int i = 0; i < node->mNumMeshes; i++)
+    if (!name.empty() && textures->find(name) != textures->end())
     {
-      aiMesh *mesh = scene->mMeshes[node->mMeshes[i]];
-      std::cout << "Processing mesh: " << mesh->mName.C_Str() << "\n";
-      model.meshes.push_back(processMesh(mesh, scene));
+      ++textureStats.pathHits;
+      return getTexture(name);
     }
-    // process each of its children
-    for (unsigned int i = 0; i < node->mNumChildren; i++)
+    bool compressed = height == 0;
+    size_t size = compressed ? width : (size_t)width * height * 4;
+    uint64_t hash = hashBytes(data, size);
+    if (auto texture = findByContent(hash, name))
     {
-      processNode(model, node->mChildren[i], scene);
+      return *texture;
     }
-  }
-  Mesh processMesh(aiMesh *mesh, const aiScene *scene)
-  {
-    std::vector<Vertex> vertices;
-    std::vector<unsigned int> indices;
-    std::vector<Texture> textures;
-    Material mat;
-    int matId = -1;
-    for (unsigned int i = 0; i < mesh->mNumVertices; i++)
+    Image image;
+    image.path = name;
+    if (compressed)
     {
-      Vertex vertex;
-      glm::vec3 vector;
-      vector.x = mesh->mVertices[i].x;
-      vector.y = mesh->mVertices[i].y;
-      vector.z = mesh->mVertices[i].z;
-      vertex.Position = vector;
-
-      vector.x = mesh->mNormals[i].x;
-      vector.y = mesh->mNormals[i].y;
-      vector.z = mesh->mNormals[i].z;
-      vertex.Normal = vector;
-      if (mesh->mTextureCoords[0])
+      if (!decodeImage(data, size, false, image))
       {
-        glm::vec2 vec;
-        vec.x = mesh->mTextureCoords[0][i].x;
-        vec.y = mesh->mTextureCoords[0][i].y;
-        /*  std::cout << "u: " << vec.x << " v: " << vec.y << "\n"; */
-        vertex.TexCoords = vec;
+        std::cout << "Embedded texture " << name << " failed to decode\n";
+        return Texture();
       }
-      else
+    }
+    else
+    {
+      // BGRA texels to the RGBA layout createTexture2D expects
+      image.width = (int)width;
+      image.height = (int)height;
+      image.nrChannels = 4;
+      image.data = (unsigned char *)malloc(size);
+      for (size_t i = 0; i < size; i += 4)
       {
-        /* std::cout << "no texture coords \n"; */
-        vertex.TexCoords = glm::vec2(0.0f, 0.0f);
+        image.data[i] = data[i + 2];
+        image.data[i + 1] = data[i + 1];
+        image.data[i + 2] = data[i];
+        image.data[i + 3] = data[i + 3];
       }
-      /*     std::cout << "x: " << vertex.Position.x << " y: " << vertex.Position.y
-                << " z: " << vertex.Position.z << "\n"; */
-      vertices.push_back(vertex);
     }
-    std::cout << mesh->mNumFaces << " face \n";
-    for (unsigned int i = 0; i < mesh->mNumFaces; i++)
+    Texture texture;
+    texture.id = rendeder.createTexture2D(image);
+    if (compressed)
     {
-      aiFace face = mesh->mFaces[i];
-      /*    std::cout << face.mNumIndices << " indices \n"; */
-      for (unsigned int j = 0; j < face.mNumIndices; j++)
-        indices.push_back(face.mIndices[j]);
+      setReloadSource(texture.id, name, false,
+                      std::make_shared<const std::vector<unsigned char>>(
+                          data, data + size));
     }
-    if (mesh->mMaterialIndex >= 0)
+    addByContent(hash, name, texture,
+                 textureBytes(image.width, image.height, image.nrChannels, true));
+    std::cout << "Texture " << texture.id << " loaded \n";
+    freeImage(image);
+    return texture;
+  }
+  // Returns a texture bound to a checker placeholder right away. The file is
+  // read and decoded on the job system and uploaded in place by update(), so
+  // materials built with the returned texture pick up the image by themselves.
+  const Texture loadTexture2DAsync(
+      const Image &image,
+      std::function<void(const Texture &)> onLoaded = nullptr)
+  {
+    return loadAsync(image.path, image.flipVertically, nullptr, onLoaded);
+  }
+  // async variant of loadEmbeddedTexture for compressed embedded files
+  const Texture loadEmbeddedTextureAsync(
+      const std::string &name,
+      std::shared_ptr<const std::vector<unsigned char>> compressed,
+      std::function<void(const Texture &)> onLoaded = nullptr)
+  {
+    return loadAsync(name, false, compressed, onLoaded);
+  }
+  // Compressed texture to load; bytes holds an embedded file, nullptr means
+  // name is a path to read
+  struct TextureRequest
+  {
+    std::string name;
+    bool flip = false;
+    std::shared_ptr<const std::vector<unsigned char>> bytes;
+  };
+  // Reads, hashes and decodes every request on the job system, then uploads
+  // them in request order on the calling thread. Returns one texture per
+  // request, an empty Texture for the ones that failed.
+  std::vector<Texture> loadTextures2D(const std::vector<TextureRequest> &requests)
+  {
+    std::vector<Texture> loaded(requests.size());
+    std::vector<DecodedTexture> decoded(requests.size());
+    std::vector<size_t> toDecode;
+    std::unordered_map<std::string, size_t> firstRequest;
+    for (size_t i = 0; i < requests.size(); ++i)
     {
-
-      aiMaterial *material = scene->mMaterials[mesh->mMaterialIndex];
-      // load diffuse texture
-      std::vector<Texture> diffuseMaps = loadMaterialTextures(
-          scene, material, aiTextureType_DIFFUSE, TextureType::Diffuse);
-      textures.insert(textures.end(), diffuseMaps.begin(), diffuseMaps.end());
-      // load spec
-      std::vector<Texture> specularMaps = loadMaterialTextures(
-          scene, material, aiTextureType_SPECULAR, TextureType::Specular);
-      textures.insert(textures.end(), specularMaps.begin(), specularMaps.end());
-      mat.textures = textures;
-      matId = resourceManager.addMaterial(mat);
+      const std::string &name = requests[i].name;
+      if (!name.empty() && (textures->find(name) != textures->end() ||
+                            !firstRequest.insert({name, i}).second))
+      {
+        continue;
+      }
+      toDecode.push_back(i);
     }
-    Mesh mMesh = Mesh(vertices, indices);
-    if (matId != -1)
+    // texturesByContent is only read while the batch runs
+    jobs->parallelFor(toDecode.size(), [&](size_t job) {
+      size_t i = toDecode[job];
+      decoded[i] = decodeTexture(
+          requests[i].name, requests[i].flip, requests[i].bytes,
+          [this](uint64_t hash) { return !texturesByContent.count(hash); });
+    });
+    for (size_t i : toDecode)
     {
-      mMesh.MaterialID = matId;
+      loaded[i] = finishDecoded(requests[i], decoded[i]);
     }
-    return mMesh;
+    for (size_t i = 0; i < requests.size(); ++i)
+    {
+      if (loaded[i].handle.valid() || requests[i].name.empty() ||
+          textures->find(requests[i].name) == textures->end())
+      {
+        continue;
+      }
+      ++textureStats.pathHits;
+      loaded[i] = getTexture(requests[i].name);
+    }
+    return loaded;
   }
-  std::vector<Texture> loadMaterialTextures(const aiScene *scene,
-                                            aiMaterial *mat, aiTextureType type,
-                                            TextureType textureType)
+  // Failed for handles of removed textures
+  LoadState getLoadState(TextureHandle handle) const
   {
-    std::vector<Texture> textures;
-    for (unsigned int i = 0; i < mat->GetTextureCount(type); i++)
+    if (!texturePool.contains(handle) ||
+        handle.index >= textureStates.size() ||
+        textureStates[handle.index].texture != handle)
     {
-      aiString str;
-      mat->GetTexture(type, i, &str);
-      if (auto embeddedTexture = scene->GetEmbeddedTexture(str.C_Str()))
+      return LoadState::Failed;
+    }
+    return textureStates[handle.index].state;
+  }
+  // the texture keeps its placeholder and its callbacks are dropped
+  void cancelLoad(TextureHandle handle)
+  {
+    for (auto &pending : pendingTextures)
+    {
+      if (pending.texture.handle == handle)
       {
-        // returned pointer is not null, read texture from memory
-        /*    std::cout << "embedded texture " << embeddedTexture->mFilename.C_Str()
-                  << " width : " << embeddedTexture->mWidth << "\n"
-                  << " height : " << embeddedTexture->mHeight << "\n"
-                  << " hint : " << embeddedTexture->achFormatHint << "\n"; */
-        unsigned char *img;
-        int width, height, type;
-        unsigned char *res_data = (unsigned char *)embeddedTexture->pcData;
-        img = stbi_load_from_memory(res_data, (int)embeddedTexture->mWidth,
-                                    &width, &height, &type, 0);
-        Image image;
-        image.data = img;
-        image.height = height;
-        image.width = width;
-        image.path = embeddedTexture->mFilename.C_Str();
-        image.nrChannels = type;
-        Texture texture = resourceManager.loadTexture2D(image);
-        texture.type = textureType;
-        textures.push_back(texture);
+        *pending.cancelled = true;
       }
-      else
+    }
+  }
+  // Uploads the textures decoded since the last call. Must be called on the
+  // thread owning the GL context, typically once per frame.
+  void update()
+  {
+    for (auto it = pendingTextures.begin(); it != pendingTextures.end();)
+    {
+      if (it->result.wait_for(std::chrono::seconds(0)) !=
+          std::future_status::ready)
       {
-        // regular file, check if it exists and read it
-        std::cout << "reading file " << str.C_Str() << "\n";
-        Image image(directory + "/" + str.C_Str(), true);
-        Texture texture = resourceManager.loadTexture2D(image);
-        texture.type = textureType;
-        textures.push_back(texture);
+        ++it;
+        continue;
       }
+      DecodedTexture decoded = it->result.get();
+      finishAsync(*it, decoded);
+      it = pendingTextures.erase(it);
     }
-    return textures;
   }
-  std::string directory;
-  ResourceManager &resourceManager;
-};
-class MeshRenderer
-{
-public:
-  MeshRenderer() {}
-  void addSpotLights(Shader &shader, const std::vector<Light> &lights,
-                     Camera &camera)
+  const Texture getTexture(const std::string &path)
   {
-    shader.use();
-    int nbSpotLight = 0;
-    std::string uniformName("spotLights");
-    for (auto light : lights)
+    if (textures->find(path) == textures->end())
     {
-      addLight(shader, light, camera, uniformName, nbSpotLight);
-      shader.setFloat(getUniformName(uniformName, "quadratic", nbSpotLight),
-                      light.Quadratic);
-      shader.setFloat(getUniformName(uniformName, "cutOff", nbSpotLight),
-                      glm::cos(glm::radians(light.CutOff)));
-      shader.setFloat(getUniformName(uniformName, "outerCutOff", nbSpotLight),
-                      glm::cos(glm::radians(light.OuterCutOff)));
-      ++nbSpotLight;
+      std::cout << "No texture for " << path << "\n";
+      return Texture();
     }
-
-    shader.setInt("nbSpotLight", nbSpotLight);
+    return texturePool.get(textures->at(path));
   }
-  void addPointLights(Shader &shader, const std::vector<Light> &lights,
-                      Camera &camera)
+  TextureHandle getTextureHandle(const std::string &path) const
   {
-    shader.use();
-    int nbPointLight = 0;
-    std::string uniformName("pointLights");
-    for (auto light : lights)
+    auto found = textures->find(path);
+    return found == textures->end() ? TextureHandle() : found->second;
+  }
+  const Texture &getTexture(TextureHandle handle) const
+  {
+    return texturePool.get(handle);
+  }
+  // shared checker texture, used for placeholders that are never replaced
+  const Texture &getPlaceholderTexture()
+  {
+    if (placeholderTexture.id == 0)
     {
-      addLight(shader, light, camera, uniformName, nbPointLight);
-      shader.setFloat(getUniformName(uniformName, "constant", nbPointLight),
-                      light.Constant);
-      shader.setFloat(getUniformName(uniformName, "linear", nbPointLight),
-                      light.Linear);
-      shader.setFloat(getUniformName(uniformName, "quadratic", nbPointLight),
-                      light.Quadratic);
-      ++nbPointLight;
+      placeholderTexture.id = rendeder.createPlaceholderTexture();
     }
-
-    shader.setInt("nbPointLight", nbPointLight);
+    return placeholderTexture;
   }
-  void useLight(Shader &shader, const Light &light, Camera &camera)
+  // unit cube drawn in place of models that are still loading
+  const Mesh &getPlaceholderMesh()
   {
-    shader.use();
+    if (placeholderMesh.Id == 0)
+    {
+      placeholderMesh = createCube();
+      rendeder.createBuffer(placeholderMesh);
+    }
+    return placeholderMesh;
+  }
+  void removeTexture(TextureHandle handle)
+  {
+    if (!texturePool.contains(handle))
+    {
+      return;
+    }
+    cancelLoad(handle);
+    rendeder.destroyTexture(texturePool.get(handle).id);
+    for (auto it = textures->begin(); it != textures->end();)
+    {
+      it = it->second == handle ? textures->erase(it) : std::next(it);
+    }
+    for (auto it = texturesByContent.begin(); it != texturesByContent.end();)
+    {
+      it = it->second.texture == handle ? texturesByContent.erase(it)
+                                        : std::next(it);
+    }
+    texturePool.remove(handle);
+  }
+  const TextureStats &getTextureStats() const { return textureStats; }
+  void printTextureReport(std::ostream &out = std::cout) const
+  {
+    out << "Textures: " << textureStats.uploads << " uploaded ("
+        << textureStats.bytesUploaded / 1024 << " KiB), "
+        << textures->size() << " paths, " << textureStats.pathHits
+        << " path hits, " << textureStats.contentHits << " content hits, "
+        << textureStats.bytesSaved / 1024 << " KiB saved\n";
+  }
+  Renderer &getRenderer() { return rendeder; }
+  JobSystem &getJobs() { return *jobs; }
+
+  // Decodes an image without touching stb's global flip flag so it can run
+  // on any thread.
+  static bool decodeImage(const unsigned char *bytes, size_t size, bool flip,
+                          Image &image)
+  {
+    image.data = stbi_load_from_memory(bytes, (int)size, &image.width,
+                                       &image.height, &image.nrChannels, 0);
+    if (!image.data)
+    {
+      return false;
+    }
+    if (flip)
+    {
+      size_t row = (size_t)image.width * image.nrChannels;
+      std::vector<unsigned char> swap(row);
+      for (int y = 0; y < image.height / 2; ++y)
+      {
+        unsigned char *top = image.data + y * row;
+        unsigned char *bottom = image.data + (image.height - 1 - y) * row;
+        std::memcpy(swap.data(), top, row);
+        std::memcpy(top, bottom, row);
+        std::memcpy(bottom, swap.data(), row);
+      }
+    }
+    return true;
+  }
+  static bool readBytes(const std::string &path,
+                        std::vector<unsigned char> &bytes)
+  {
+    std::ifstream file(path, std::ios::binary | std::ios::ate);
+    if (!file)
+    {
+      return false;
+    }
+    bytes.resize((size_t)file.tellg());
+    file.seekg(0);
+    return (bool)file.read((char *)bytes.data(), bytes.size());
+  }
+  static void freeImage(Image &image)
+  {
+    if (image.data)
+    {
+      stbi_image_free(image.data);
+      image.data = nullptr;
+    }
+  }
+
+private:
+  struct ContentEntry
+  {
+    TextureHandle texture;
+    size_t bytes;
+  };
+  // a slot is reused once its texture is removed, so the state keeps the
+  // handle, generation included, it was set for
+  struct TextureState
+  {
+    TextureHandle texture;
+    LoadState state = LoadState::Failed;
+  };
+  struct DecodedTexture
+  {
+    Image image;
+    uint64_t hash = 0;
+    // the source bytes were found, image.data may still be null when the
+    // decode was skipped or failed
+    bool read = false;
+  };
+  struct PendingTexture
+  {
+    Texture texture;
+    std::string name;
+    bool flip;
+    std::shared_ptr<const std::vector<unsigned char>> bytes;
+    std::shared_ptr<std::atomic<bool>> cancelled;
+    std::future<DecodedTexture> result;
+    std::vector<std::function<void(const Texture &)>> callbacks;
+  };
+  static size_t textureBytes(int width, int height, int channels,
+                             bool mipmapped)
+  {
+    size_t bytes = (size_t)width * height * (channels == 3 ? 4 : channels);
+    // a full mip chain adds a third of the base level
+    return mipmapped ? bytes + bytes / 3 : bytes;
+  }
+  const Texture *findByContent(uint64_t hash, const std::string &alias)
+  {
+    auto found = texturesByContent.find(hash);
+    if (found == texturesByContent.end())
+    {
+      return nullptr;
+    }
+    if (!alias.empty())
+    {
+      textures->insert({alias, found->second.texture});
+    }
+    ++textureStats.contentHits;
+    textureStats.bytesSaved += found->second.bytes;
+    return &texturePool.get(found->second.texture);
+  }
+  void addTexture(const std::string &alias, Texture &texture, LoadState state)
+  {
+    texture.handle = texturePool.add(texture);
+    texturePool.get(texture.handle).handle = texture.handle;
+    if (textureStates.size() <= texture.handle.index)
+    {
+      textureStates.resize(texture.handle.index + 1);
+    }
+    textureStates[texture.handle.index] = TextureState{texture.handle, state};
+    if (!alias.empty())
+    {
+      textures->insert({alias, texture.handle});
+    }
+  }
+  void addByContent(uint64_t hash, const std::string &alias, Texture &texture,
+                    size_t bytes)
+  {
+    addTexture(alias, texture, LoadState::Ready);
+    texturesByContent.insert({hash, {texture.handle, bytes}});
+    ++textureStats.uploads;
+    textureStats.bytesUploaded += bytes;
+  }
+  // evicted textures are decoded again from their file or embedded bytes
+  void setReloadSource(unsigned int id, const std::string &path, bool flip,
+                       std::shared_ptr<const std::vector<unsigned char>> bytes)
+  {
+    rendeder.getResidency().setTextureSource(
+        id, [path, flip, bytes](Image &reloaded) {
+          std::vector<unsigned char> file;
+          if (!bytes && !readBytes(path, file))
+          {
+            return false;
+          }
+          const std::vector<unsigned char> &source = bytes ? *bytes : file;
+          return decodeImage(source.data(), source.size(), flip, reloaded);
+        });
+  }
+  const Texture loadAsync(
+      const std::string &name, bool flip,
+      std::shared_ptr<const std::vector<unsigned char>> bytes,
+      std::function<void(const Texture &)> onLoaded)
+  {
+    if (!name.empty() && textures->find(name) != textures->end())
+    {
+      ++textureStats.pathHits;
+      const Texture &known = texturePool.get(textures->at(name));
+      if (onLoaded)
+      {
+        auto pending = std::find_if(
+            pendingTextures.begin(), pendingTextures.end(),
+            [&known](const PendingTexture &p) {
+              return p.texture.handle == known.handle;
+            });
+        if (pending != pendingTextures.end())
+        {
+          pending->callbacks.push_back(onLoaded);
+        }
+        else if (getLoadState(known.handle) == LoadState::Ready)
+        {
+          onLoaded(known);
+        }
+      }
+      return known;
+    }
+    Texture texture;
+    texture.id = rendeder.createPlaceholderTexture();
+    texture.type = TextureType::Diffuse;
+    addTexture(name, texture, LoadState::Pending);
+
+    PendingTexture pending;
+    pending.texture = texture;
+    pending.name = name;
+    pending.flip = flip;
+    pending.bytes = bytes;
+    pending.cancelled = std::make_shared<std::atomic<bool>>(false);
+    if (onLoaded)
+    {
+      pending.callbacks.push_back(onLoaded);
+    }
+    auto cancelled = pending.cancelled;
+    pending.result = jobs->submit([name, flip, bytes, cancelled]() {
+      if (*cancelled)
+      {
+        return DecodedTexture();
+      }
+      return decodeTexture(name, flip, bytes,
+                           [&cancelled](uint64_t) { return !*cancelled; });
+    });
+    pendingTextures.push_back(std::move(pending));
+    return texture;
+  }
+  // Runs on any thread: reads the file unless bytes are given, hashes it and
+  // decodes it when shouldDecode(hash) agrees
+  static DecodedTexture
+  decodeTexture(const std::string &name, bool flip,
+                const std::shared_ptr<const std::vector<unsigned char>> &bytes,
+                const std::function<bool(uint64_t)> &shouldDecode)
+  {
+    DecodedTexture decoded;
+    std::vector<unsigned char> file;
+    if (!bytes && !readBytes(name, file))
+    {
+      return decoded;
+    }
+    const std::vector<unsigned char> &source = bytes ? *bytes : file;
+    decoded.read = true;
+    decoded.hash = hashBytes(source.data(), source.size(), flip);
+    if (shouldDecode(decoded.hash))
+    {
+      decodeImage(source.data(), source.size(), flip, decoded.image);
+    }
+    return decoded;
+  }
+  // GL thread half of loadTextures2D
+  Texture finishDecoded(const TextureRequest &request, DecodedTexture &decoded)
+  {
+    if (!decoded.read)
+    {
+      std::cout << "Texture failed to load at path: " << request.name << "\n";
+      return Texture();
+    }
+    if (auto texture = findByContent(decoded.hash, request.name))
+    {
+      freeImage(decoded.image);
+      return *texture;
+    }
+    Image &image = decoded.image;
+    if (!image.data)
+    {
+      std::cout << "Texture " << request.name << " failed to decode\n";
+      return Texture();
+    }
+    Texture texture;
+    texture.id = rendeder.createTexture2D(image);
+    texture.type = TextureType::Diffuse;
+    setReloadSource(texture.id, request.name, request.flip, request.bytes);
+    addByContent(decoded.hash, request.name, texture,
+                 textureBytes(image.width, image.height, image.nrChannels, true));
+    std::cout << "Texture " << texture.id << " loaded \n";
+    freeImage(image);
+    return texture;
+  }
+  void finishAsync(PendingTexture &pending, DecodedTexture &decoded)
+  {
+    TextureHandle handle = pending.texture.handle;
+    // a removed texture's slot may already hold another texture
+    if (!texturePool.contains(handle))
+    {
+      freeImage(decoded.image);
+      return;
+    }
+    if (*pending.cancelled)
+    {
+      freeImage(decoded.image);
+      textureStates[handle.index].state = LoadState::Cancelled;
+      return;
+    }
+    if (!decoded.image.data)
+    {
+      std::cout << "Texture failed to load at path: " << pending.name << "\n";
+      textureStates[handle.index].state = LoadState::Failed;
+      return;
+    }
+    Image &image = decoded.image;
+    rendeder.uploadTexture2D(pending.texture.id, image);
+    setReloadSource(pending.texture.id, pending.name, pending.flip,
+                    pending.bytes);
+    size_t bytes =
+        textureBytes(image.width, image.height, image.nrChannels, true);
+    // the placeholder name is already handed out, so a duplicate found now
+    // is uploaded anyway; later requests for this content reuse it
+    texturesByContent.insert({decoded.hash, {handle, bytes}});
+    ++textureStats.uploads;
+    textureStats.bytesUploaded += bytes;
+    textureStates[handle.index].state = LoadState::Ready;
+    freeImage(image);
+    std::cout << "Texture " << pending.texture.id << " streamed in \n";
+    for (auto &callback : pending.callbacks)
+    {
+      callback(texturePool.get(handle));
+    }
+  }
+  static void loadImage(Image &image)
+  {
+    if (image.data == nullptr)
+    {
+      std::vector<unsigned char> bytes;
+      if (!readBytes(image.path, bytes) ||
+          !decodeImage(bytes.data(), bytes.size(), image.flipVertically,
+                       image))
+      {
+        std::cout << "Cubemap texture failed to load at path: " << image.path.c_str() << std::endl;
+      }
+    }
+  }
+  std::unique_ptr<std::unordered_map<std::string, TextureHandle>> textures;
+  Pool<Texture> texturePool;
+  std::vector<TextureState> textureStates;
+  std::unordered_map<uint64_t, ContentEntry> texturesByContent;
+  std::vector<PendingTexture> pendingTextures;
+  Texture placeholderTexture = Texture();
+  Mesh placeholderMesh;
+  TextureStats textureStats;
+  std::unique_ptr<Pool<Material>> materials;
+  Renderer &rendeder;
+  // declared last so workers are joined before the state they report to
+  std::unique_ptr<JobSystem> jobs;
+};
+// Texture reference read from an aiMaterial, kept on the CPU until the
+// material is created on the GL thread
+struct TextureSource
+{
+  TextureType type;
+  // file path, or name of the embedded texture
+  std::string path;
+  // embedded textures: compressed file (height == 0) or ARGB8888 texels
+  std::shared_ptr<const std::vector<unsigned char>> embedded;
+  unsigned int width = 0;
+  unsigned int height = 0;
+};
+// Result of the Assimp import; building it makes no GL call so it can run on
+// a worker thread
+struct ImportedModel
+{
+  bool ok = false;
+  Model model;
+  // textures of each aiMaterial
+  std::vector<std::vector<TextureSource>> materials;
+  // aiMaterial index of each mesh of the model
+  std::vector<unsigned int> meshMaterials;
+};
+// Optional CPU stages run on the meshes after the Assimp import
+struct ImportOptions
+{
+  // read and write <model>.meshcache next to the source file
+  bool useCache = true;
+  // reorder triangles for the post-transform vertex cache and overdraw, then
+  // vertices for fetch locality
+  bool optimizeMeshes = false;
+  // build a chain of simplified index ranges per mesh, see Mesh::Lods;
+  // needs weldVertices, unwelded corners are locked in place
+  bool generateLods = false;
+  // levels including the full mesh
+  int lodLevels = 4;
+  // triangle count of each level relative to the previous one
+  float lodReduction = 0.5f;
+  // largest error allowed, relative to the mesh bounds diagonal
+  float lodMaxError = 0.05f;
+  // split each mesh into meshlets with bounds and normal cones, see
+  // Mesh::Meshlets
+  bool buildMeshlets = false;
+  // merge duplicate vertices; exact when weldEpsilon is 0, otherwise
+  // attributes closer than about weldEpsilon are merged as well
+  bool weldVertices = true;
+  float weldEpsilon = 0.0f;
+  // options changing the imported data, stored in the cache key
+  uint64_t cacheKey() const
+  {
+    uint64_t key = optimizeMeshes ? 1u : 0u;
+    if (buildMeshlets)
+    {
+      key |= 1u << 30;
+    }
+    if (weldVertices)
+    {
+      uint32_t epsilon;
+      std::memcpy(&epsilon, &weldEpsilon, sizeof(float));
+      key |= 1u << 31 | (uint64_t)epsilon << 32;
+    }
+    if (generateLods)
+    {
+      // the exact float bits, so nearby settings do not share a cache
+      uint64_t lods = hashBytes(&lodLevels, sizeof(lodLevels));
+      lods = hashBytes(&lodReduction, sizeof(lodReduction), lods);
+      lods = hashBytes(&lodMaxError, sizeof(lodMaxError), lods);
+      key = hashCombine(key | 2u, lods);
+    }
+    return key;
+  }
+};
+// Binary image of an ImportedModel so warm loads skip Assimp entirely. The
+// file is a header, fixed size mesh/material/texture tables and 16 byte
+// aligned blobs (vertices, indices, strings, embedded textures) that are
+// copied out of the mapping as they are. A cache is used only when its
+// version, vertex layout, import flags and options and source file hash
+// all match;
+// side files such as .mtl are not part of the hash.
+class ModelCache
+{
+public:
+  // An open cache whose meshes are read one at a time, see openStream
+  struct Stream;
+  static std::string pathFor(const std::string &source)
+  {
+    return source + ".meshcache";
+  }
+  static bool read(const std::string &path, uint64_t sourceHash,
+                   unsigned int importFlags, uint64_t options,
+                   ImportedModel &imported)
+  {
+    ImportedModel result;
+    auto stream =
+        openStream(path, sourceHash, importFlags, options, result);
+    if (!stream)
+    {
+      return false;
+    }
+    for (size_t i = 0; i < result.model.meshes.size(); ++i)
+    {
+      if (!readMesh(*stream, i, result.model.meshes[i]))
+      {
+        return false;
+      }
+    }
+    imported = std::move(result);
+    return true;
+  }
+  // Reads everything but the mesh data: materials, nodes and the bounds and
+  // detail levels of each mesh. Vertices, indices and meshlets are loaded
+  // later with readMesh or readCoarseMesh. Null when the cache is missing
+  // or stale.
+  static std::shared_ptr<Stream> openStream(const std::string &path,
+                                            uint64_t sourceHash,
+                                            unsigned int importFlags,
+                                            uint64_t options,
+                                            ImportedModel &imported)
+  {
+    auto stream = std::make_shared<Stream>();
+    const MappedFile &file = stream->file;
+    if (!stream->file.open(path) || file.size() < sizeof(Header))
+    {
+      return nullptr;
+    }
+    const unsigned char *base = file.data();
+    Header header;
+    std::memcpy(&header, base, sizeof(Header));
+    if (std::memcmp(header.magic, "OGMC", 4) != 0 ||
+        header.version != VERSION || header.vertexSize != sizeof(Vertex) ||
+        header.sourceHash != sourceHash || header.importFlags != importFlags ||
+        header.options != options)
+    {
+      return nullptr;
+    }
+    size_t tables = sizeof(Header) + header.meshCount * sizeof(MeshRecord) +
+                    header.materialCount * sizeof(MaterialRecord) +
+                    header.textureCount * sizeof(TextureRecord) +
+                    header.nodeCount * sizeof(NodeRecord);
+    if (tables > file.size())
+    {
+      return nullptr;
+    }
+    auto inFile = [&file](uint64_t offset, uint64_t size) {
+      return offset <= file.size() && size <= file.size() - offset;
+    };
+    const MeshRecord *meshes =
+        reinterpret_cast<const MeshRecord *>(base + sizeof(Header));
+    const MaterialRecord *materials =
+        reinterpret_cast<const MaterialRecord *>(meshes + header.meshCount);
+    const TextureRecord *textures = reinterpret_cast<const TextureRecord *>(
+        materials + header.materialCount);
+    const NodeRecord *nodes =
+        reinterpret_cast<const NodeRecord *>(textures + header.textureCount);
+
+    ImportedModel result;
+    stream->meshes.assign(meshes, meshes + header.meshCount);
+    for (uint32_t i = 0; i < header.nodeCount; ++i)
+    {
+      const NodeRecord &record = nodes[i];
+      if ((record.parent != SceneGraph::NO_PARENT && record.parent >= i) ||
+          !inFile(record.nameOffset, record.nameLength))
+      {
+        return nullptr;
+      }
+      result.model.nodes.addNode(
+          record.parent,
+          glm::vec3(record.translation[0], record.translation[1],
+                    record.translation[2]),
+          glm::quat(record.rotation[3], record.rotation[0], record.rotation[1],
+                    record.rotation[2]),
+          glm::vec3(record.scale[0], record.scale[1], record.scale[2]),
+          std::string((const char *)base + record.nameOffset,
+                      record.nameLength));
+    }
+    result.model.meshNodes.resize(header.meshCount);
+    result.model.meshes.resize(header.meshCount);
+    result.meshMaterials.resize(header.meshCount);
+    for (uint32_t i = 0; i < header.meshCount; ++i)
+    {
+      const MeshRecord &record = meshes[i];
+      size_t vertexBytes = (size_t)record.vertexCount * sizeof(Vertex);
+      size_t indexBytes = (size_t)record.indexCount * sizeof(unsigned int);
+      if (!inFile(record.vertexOffset, vertexBytes) ||
+          !inFile(record.indexOffset, indexBytes) ||
+          !inFile(record.lodOffset, record.lodCount * sizeof(MeshLod)) ||
+          !inFile(record.meshletOffset,
+                  record.meshletCount * sizeof(Meshlet)))
+      {
+        return nullptr;
+      }
+      if (record.node >= header.nodeCount)
+      {
+        return nullptr;
+      }
+      result.model.meshNodes[i] = record.node;
+      Mesh &mesh = result.model.meshes[i];
+      readLods(base, record, mesh);
+      for (auto &lod : mesh.Lods)
+      {
+        if ((uint64_t)lod.indexOffset + lod.indexCount > record.indexCount)
+        {
+          return nullptr;
+        }
+      }
+      mesh.Bounds = record.bounds;
+      mesh.Sphere = record.sphere;
+      result.meshMaterials[i] = record.material;
+    }
+    result.model.updateBounds();
+    result.materials.resize(header.materialCount);
+    for (uint32_t i = 0; i < header.materialCount; ++i)
+    {
+      const MaterialRecord &record = materials[i];
+      if (record.firstTexture + (uint64_t)record.textureCount >
+          header.textureCount)
+      {
+        return nullptr;
+      }
+      for (uint32_t t = 0; t < record.textureCount; ++t)
+      {
+        const TextureRecord &texture = textures[record.firstTexture + t];
+        if (!inFile(texture.pathOffset, texture.pathLength) ||
+            !inFile(texture.embeddedOffset, texture.embeddedSize))
+        {
+          return nullptr;
+        }
+        TextureSource source;
+        source.type = (TextureType)texture.type;
+        source.path.assign((const char *)base + texture.pathOffset,
+                           texture.pathLength);
+        source.width = texture.width;
+        source.height = texture.height;
+        if (texture.embeddedSize > 0)
+        {
+          const unsigned char *embedded = base + texture.embeddedOffset;
+          source.embedded = std::make_shared<const std::vector<unsigned char>>(
+              embedded, embedded + texture.embeddedSize);
+        }
+        result.materials[i].push_back(source);
+      }
+    }
+    result.ok = true;
+    imported = std::move(result);
+    return stream;
+  }
+  // Vertices, indices, detail levels and meshlets of one mesh
+  static bool readMesh(const Stream &stream, size_t index, Mesh &mesh)
+  {
+    const MeshRecord &record = stream.meshes[index];
+    const unsigned char *base = stream.file.data();
+    mesh.Vertices.resize(record.vertexCount);
+    std::memcpy(mesh.Vertices.data(), base + record.vertexOffset,
+                (size_t)record.vertexCount * sizeof(Vertex));
+    mesh.Indices.resize(record.indexCount);
+    std::memcpy(mesh.Indices.data(), base + record.indexOffset,
+                (size_t)record.indexCount * sizeof(unsigned int));
+    readLods(base, record, mesh);
+    mesh.Meshlets.resize(record.meshletCount);
+    if (record.meshletCount > 0)
+    {
+      std::memcpy(mesh.Meshlets.data(), base + record.meshletOffset,
+                  record.meshletCount * sizeof(Meshlet));
+    }
+    for (auto &meshlet : mesh.Meshlets)
+    {
+      if ((uint64_t)meshlet.indexOffset + meshlet.triangleCount * 3ull >
+          record.indexCount)
+      {
+        return false;
+      }
+    }
+    mesh.Bounds = record.bounds;
+    mesh.Sphere = record.sphere;
+    return true;
+  }
+  // Only the coarsest detail level, with just the vertices it uses. False
+  // when the mesh has a single level.
+  static bool readCoarseMesh(const Stream &stream, size_t index, Mesh &mesh)
+  {
+    const MeshRecord &record = stream.meshes[index];
+    const unsigned char *base = stream.file.data();
+    if (record.lodCount < 2)
+    {
+      return false;
+    }
+    MeshLod coarsest;
+    std::memcpy(&coarsest,
+                base + record.lodOffset +
+                    (record.lodCount - 1) * sizeof(MeshLod),
+                sizeof(MeshLod));
+    const unsigned int *indices =
+        reinterpret_cast<const unsigned int *>(base + record.indexOffset) +
+        coarsest.indexOffset;
+    const Vertex *vertices =
+        reinterpret_cast<const Vertex *>(base + record.vertexOffset);
+    const unsigned int unused = 0xFFFFFFFF;
+    std::vector<unsigned int> remap(record.vertexCount, unused);
+    mesh.Vertices.clear();
+    mesh.Indices.resize(coarsest.indexCount);
+    for (uint32_t i = 0; i < coarsest.indexCount; ++i)
+    {
+      unsigned int vertex = indices[i];
+      if (vertex >= record.vertexCount)
+      {
+        return false;
+      }
+      if (remap[vertex] == unused)
+      {
+        remap[vertex] = (unsigned int)mesh.Vertices.size();
+        mesh.Vertices.push_back(vertices[vertex]);
+      }
+      mesh.Indices[i] = remap[vertex];
+    }
+    mesh.Lods.assign(1, MeshLod{0, coarsest.indexCount, coarsest.error});
+    mesh.Meshlets.clear();
+    mesh.Bounds = record.bounds;
+    mesh.Sphere = record.sphere;
+    return true;
+  }
+  static bool write(const std::string &path, uint64_t sourceHash,
+                    unsigned int importFlags, uint64_t options,
+                    const ImportedModel &imported)
+  {
+    const auto &meshes = imported.model.meshes;
+    Header header;
+    std::memcpy(header.magic, "OGMC", 4);
+    header.version = VERSION;
+    header.vertexSize = sizeof(Vertex);
+    header.importFlags = importFlags;
+    header.options = options;
+    header.sourceHash = sourceHash;
+    header.meshCount = (uint32_t)meshes.size();
+    header.materialCount = (uint32_t)imported.materials.size();
+    header.textureCount = 0;
+    for (auto &textures : imported.materials)
+    {
+      header.textureCount += (uint32_t)textures.size();
+    }
+    header.nodeCount = (uint32_t)imported.model.nodes.size();
+    std::vector<MeshRecord> meshRecords(header.meshCount);
+    std::vector<MaterialRecord> materialRecords(header.materialCount);
+    std::vector<TextureRecord> textureRecords(header.textureCount);
+    std::vector<NodeRecord> nodeRecords(header.nodeCount);
+
+    // lay the blobs out after the tables
+    uint64_t offset = sizeof(Header) + sizeof(MeshRecord) * header.meshCount +
+                      sizeof(MaterialRecord) * header.materialCount +
+                      sizeof(TextureRecord) * header.textureCount +
+                      sizeof(NodeRecord) * header.nodeCount;
+    auto reserve = [&offset](uint64_t size) {
+      offset = (offset + 15) & ~(uint64_t)15;
+      uint64_t start = offset;
+      offset += size;
+      return start;
+    };
+    for (size_t i = 0; i < meshes.size(); ++i)
+    {
+      MeshRecord &record = meshRecords[i];
+      record.vertexCount = (uint32_t)meshes[i].Vertices.size();
+      record.indexCount = (uint32_t)meshes[i].Indices.size();
+      record.material = imported.meshMaterials[i];
+      record.bounds = meshes[i].Bounds;
+      record.sphere = meshes[i].Sphere;
+      record.vertexOffset = reserve(record.vertexCount * sizeof(Vertex));
+      record.indexOffset = reserve(record.indexCount * sizeof(unsigned int));
+      record.lodCount = (uint32_t)meshes[i].Lods.size();
+      record.lodOffset = reserve(record.lodCount * sizeof(MeshLod));
+      record.meshletCount = (uint32_t)meshes[i].Meshlets.size();
+      record.meshletOffset = reserve(record.meshletCount * sizeof(Meshlet));
+      record.node = i < imported.model.meshNodes.size()
+                        ? imported.model.meshNodes[i]
+                        : SceneGraph::NO_PARENT;
+    }
+    const SceneGraph &graph = imported.model.nodes;
+    for (uint32_t i = 0; i < header.nodeCount; ++i)
+    {
+      NodeRecord &record = nodeRecords[i];
+      record.parent = graph.parent(i);
+      const glm::vec3 &t = graph.translation(i);
+      const glm::quat &q = graph.rotation(i);
+      const glm::vec3 &scale = graph.scale(i);
+      for (int k = 0; k < 3; ++k)
+      {
+        record.translation[k] = t[k];
+        record.scale[k] = scale[k];
+      }
+      record.rotation[0] = q.x;
+      record.rotation[1] = q.y;
+      record.rotation[2] = q.z;
+      record.rotation[3] = q.w;
+      record.nameLength = (uint32_t)graph.name(i).size();
+      record.nameOffset = reserve(record.nameLength);
+    }
+    uint32_t texture = 0;
+    for (size_t i = 0; i < imported.materials.size(); ++i)
+    {
+      materialRecords[i].firstTexture = texture;
+      materialRecords[i].textureCount = (uint32_t)imported.materials[i].size();
+      for (auto &source : imported.materials[i])
+      {
+        TextureRecord &record = textureRecords[texture++];
+        record.type = source.type;
+        record.width = source.width;
+        record.height = source.height;
+        record.pathLength = (uint32_t)source.path.size();
+        record.pathOffset = reserve(record.pathLength);
+        record.embeddedSize = source.embedded ? source.embedded->size() : 0;
+        record.embeddedOffset = reserve(record.embeddedSize);
+      }
+    }
+
+    std::vector<unsigned char> out(offset);
+    auto put = [&out](uint64_t at, const void *data, size_t size) {
+      if (size > 0)
+      {
+        std::memcpy(out.data() + at, data, size);
+      }
+    };
+    put(0, &header, sizeof(Header));
+    uint64_t at = sizeof(Header);
+    put(at, meshRecords.data(), meshRecords.size() * sizeof(MeshRecord));
+    at += meshRecords.size() * sizeof(MeshRecord);
+    put(at, materialRecords.data(),
+        materialRecords.size() * sizeof(MaterialRecord));
+    at += materialRecords.size() * sizeof(MaterialRecord);
+    put(at, textureRecords.data(),
+        textureRecords.size() * sizeof(TextureRecord));
+    at += textureRecords.size() * sizeof(TextureRecord);
+    put(at, nodeRecords.data(), nodeRecords.size() * sizeof(NodeRecord));
+    for (uint32_t i = 0; i < header.nodeCount; ++i)
+    {
+      put(nodeRecords[i].nameOffset, graph.name(i).data(),
+          nodeRecords[i].nameLength);
+    }
+    for (size_t i = 0; i < meshes.size(); ++i)
+    {
+      put(meshRecords[i].vertexOffset, meshes[i].Vertices.data(),
+          meshes[i].Vertices.size() * sizeof(Vertex));
+      put(meshRecords[i].indexOffset, meshes[i].Indices.data(),
+          meshes[i].Indices.size() * sizeof(unsigned int));
+      put(meshRecords[i].lodOffset, meshes[i].Lods.data(),
+          meshes[i].Lods.size() * sizeof(MeshLod));
+      put(meshRecords[i].meshletOffset, meshes[i].Meshlets.data(),
+          meshes[i].Meshlets.size() * sizeof(Meshlet));
+    }
+    texture = 0;
+    for (auto &textures : imported.materials)
+    {
+      for (auto &source : textures)
+      {
+        TextureRecord &record = textureRecords[texture++];
+        put(record.pathOffset, source.path.data(), source.path.size());
+        if (source.embedded)
+        {
+          put(record.embeddedOffset, source.embedded->data(),
+              source.embedded->size());
+        }
+      }
+    }
+
+    // write next to the cache and swap it in so readers never see half a file
+    std::string temporary = path + ".tmp";
+    {
+      std::ofstream file(temporary, std::ios::binary | std::ios::trunc);
+      if (!file || !file.write((const char *)out.data(), out.size()))
+      {
+        std::cout << "Could not write mesh cache " << path << "\n";
+        return false;
+      }
+    }
+    std::remove(path.c_str());
+    return std::rename(temporary.c_str(), path.c_str()) == 0;
+  }
+
+private:
+  static constexpr uint32_t VERSION = 6;
+  struct Header
+  {
+    char magic[4];
+    uint32_t version;
+    uint32_t vertexSize;
+    uint32_t importFlags;
+    uint64_t sourceHash;
+    uint32_t meshCount;
+    uint32_t materialCount;
+    uint32_t textureCount;
+    uint32_t nodeCount;
+    uint64_t options;
+  };
+  struct MeshRecord
+  {
+    uint32_t vertexCount;
+    uint32_t indexCount;
+    uint32_t material;
+    BoundingBox bounds;
+    BoundingSphere sphere;
+    uint64_t vertexOffset;
+    uint64_t indexOffset;
+    uint64_t lodOffset;
+    uint64_t meshletOffset;
+    uint32_t lodCount;
+    uint32_t meshletCount;
+    uint32_t node;
+    uint32_t reserved;
+  };
+  struct MaterialRecord
+  {
+    uint32_t firstTexture;
+    uint32_t textureCount;
+  };
+  struct TextureRecord
+  {
+    uint32_t type;
+    uint32_t width;
+    uint32_t height;
+    uint32_t pathLength;
+    uint64_t pathOffset;
+    uint64_t embeddedOffset;
+    uint64_t embeddedSize;
+  };
+  struct NodeRecord
+  {
+    uint32_t parent;
+    float translation[3];
+    float rotation[4]; // x, y, z, w
+    float scale[3];
+    uint32_t nameLength;
+    uint64_t nameOffset;
+  };
+  static_assert(std::is_trivially_copyable<Vertex>::value,
+                "vertices are stored as raw bytes");
+  static void readLods(const unsigned char *base, const MeshRecord &record,
+                       Mesh &mesh)
+  {
+    mesh.Lods.resize(record.lodCount);
+    if (record.lodCount > 0)
+    {
+      std::memcpy(mesh.Lods.data(), base + record.lodOffset,
+                  record.lodCount * sizeof(MeshLod));
+    }
+  }
+
+public:
+  struct Stream
+  {
+    MappedFile file;
+    std::vector<MeshRecord> meshes;
+  };
+};
+class ModelLoader
+{
+public:
+  ModelLoader(ResourceManager &rManager) : resourceManager(rManager) {}
+  Model loadModel(std::string path)
+  {
+    ImportedModel imported;
+    importModel(path, imported, options, resourceManager.getJobs());
+    createMaterials(imported, false);
+    return std::move(imported.model);
+  }
+  // Returns immediately; the import runs on the job system and update()
+  // uploads the meshes (at most uploadBudget bytes per call) once it is
+  // done. Textures keep streaming in after the model is ready.
+  std::shared_ptr<AsyncModel>
+  loadModelAsync(std::string path,
+                 std::function<void(AsyncModel &)> onLoaded = nullptr)
+  {
+    auto asyncModel = std::make_shared<AsyncModel>();
+    auto cancelled = asyncModel->cancelled;
+    ImportOptions options = this->options;
+    JobSystem *jobs = &resourceManager.getJobs();
+    PendingModel pending;
+    pending.model = asyncModel;
+    pending.onLoaded = onLoaded;
+    pending.source =
+        jobs->submit([path, cancelled, options, jobs]() {
+          auto source = std::make_shared<ModelSource>();
+          if (!*cancelled)
+          {
+            importModel(path, source->imported, options, *jobs);
+          }
+          return source;
+        });
+    pendingModels.push_back(std::move(pending));
+    return asyncModel;
+  }
+  // Like loadModelAsync, but meshes are read from the mesh cache one at a
+  // time. The model turns Streaming once the cache tables are read; then
+  // update() uploads the coarsest level of every mesh followed by the full
+  // meshes, largest on screen first, within the upload budget. Without a
+  // valid cache the file is imported (writing the cache) and uploaded whole.
+  std::shared_ptr<AsyncModel>
+  loadModelStreaming(std::string path,
+                     std::function<void(AsyncModel &)> onLoaded = nullptr)
+  {
+    auto asyncModel = std::make_shared<AsyncModel>();
+    auto cancelled = asyncModel->cancelled;
+    ImportOptions options = this->options;
+    JobSystem *jobs = &resourceManager.getJobs();
+    PendingModel pending;
+    pending.model = asyncModel;
+    pending.onLoaded = onLoaded;
+    pending.source =
+        jobs->submit([path, cancelled, options, jobs]() {
+          auto source = std::make_shared<ModelSource>();
+          if (*cancelled)
+          {
+            return source;
+          }
+          uint64_t sourceHash = options.useCache ? hashSource(path) : 0;
+          if (sourceHash)
+          {
+            source->stream = ModelCache::openStream(
+                ModelCache::pathFor(path), sourceHash, IMPORT_FLAGS,
+                options.cacheKey(), source->imported);
+          }
+          if (!source->stream)
+          {
+            importModel(path, source->imported, options, *jobs);
+          }
+          return source;
+        });
+    pendingModels.push_back(std::move(pending));
+    return asyncModel;
+  }
+  // bytes of vertex and index data uploaded per update() for async models
+  void setUploadBudget(size_t bytes) { uploadBudget = bytes; }
+  // CPU copies async models keep after their meshes are uploaded
+  void setCpuMeshData(CpuMeshData keep) { cpuMeshData = keep; }
+  // read and write <model>.meshcache next to the source file
+  void setCacheEnabled(bool enabled) { options.useCache = enabled; }
+  void setImportOptions(const ImportOptions &options)
+  {
+    this->options = options;
+  }
+  const ImportOptions &getImportOptions() const { return options; }
+  // CPU and GPU bytes held by the meshes of a model
+  static void printMemoryReport(const Model &model,
+                                std::ostream &out = std::cout)
+  {
+    Model::MemoryUsage usage = model.memoryUsage();
+    out << usage.meshes << " meshes, CPU " << usage.cpuBytes() / 1024
+        << " KiB (vertices " << usage.vertexBytes / 1024 << ", indices "
+        << usage.indexBytes / 1024 << ", positions "
+        << usage.positionBytes / 1024 << ", lods and meshlets "
+        << usage.metadataBytes / 1024 << "), GPU " << usage.gpuBytes / 1024
+        << " KiB\n";
+  }
+  // triangles and error of every detail level, per mesh
+  static void printLodTable(const Model &model, std::ostream &out = std::cout)
+  {
+    for (size_t i = 0; i < model.meshes.size(); ++i)
+    {
+      const Mesh &mesh = model.meshes[i];
+      out << "Mesh " << i << " LODs:";
+      for (auto &lod : mesh.Lods)
+      {
+        out << " " << lod.indexCount / 3 << " tris (" << lod.error << ")";
+      }
+      out << "\n";
+    }
+  }
+  // Advances async loads; call once per frame on the GL thread
+  void update()
+  {
+    resourceManager.update();
+    Renderer &renderer = resourceManager.getRenderer();
+    for (auto it = pendingModels.begin(); it != pendingModels.end();)
+    {
+      PendingModel &pending = *it;
+      AsyncModel &asyncModel = *pending.model;
+      if (*asyncModel.cancelled)
+      {
+        // meshes that are not uploaded have no buffer to destroy
+        for (auto &mesh : asyncModel.model.meshes)
+        {
+          renderer.destroyBuffer(mesh);
+        }
+        asyncModel.state = LoadState::Cancelled;
+        it = pendingModels.erase(it);
+        continue;
+      }
+      if (!pending.uploading)
+      {
+        if (pending.source.wait_for(std::chrono::seconds(0)) !=
+            std::future_status::ready)
+        {
+          ++it;
+          continue;
+        }
+        std::shared_ptr<ModelSource> source = pending.source.get();
+        ImportedModel &imported = source->imported;
+        if (!imported.ok)
+        {
+          asyncModel.state = LoadState::Failed;
+          it = pendingModels.erase(it);
+          continue;
+        }
+        createMaterials(imported, true);
+        asyncModel.model = std::move(imported.model);
+        asyncModel.bounds = asyncModel.model.bounds;
+        pending.uploading = true;
+        if (source->stream)
+        {
+          pending.stream = source->stream;
+          pending.requested.assign(asyncModel.model.meshes.size(), 0);
+          pending.resident.assign(asyncModel.model.meshes.size(), 0);
+          asyncModel.screenSize.assign(asyncModel.model.meshes.size(), 0.0f);
+          asyncModel.state = LoadState::Streaming;
+        }
+      }
+      if (pending.stream)
+      {
+        if (!streamMeshes(pending))
+        {
+          ++it;
+          continue;
+        }
+      }
+      size_t uploaded = 0;
+      auto &meshes = asyncModel.model.meshes;
+      while (pending.nextMesh < meshes.size() && uploaded < uploadBudget)
+      {
+        Mesh &mesh = meshes[pending.nextMesh++];
+        renderer.createBuffer(mesh, cpuMeshData);
+        uploaded += (size_t)mesh.VertexCount * sizeof(Vertex) +
+                    (size_t)mesh.IndexCount * sizeof(unsigned int);
+      }
+      if (pending.nextMesh < meshes.size())
+      {
+        ++it;
+        continue;
+      }
+      asyncModel.state = LoadState::Ready;
+      if (pending.onLoaded)
+      {
+        pending.onLoaded(asyncModel);
+      }
+      it = pendingModels.erase(it);
+    }
+  }
+
+private:
+  static constexpr unsigned int IMPORT_FLAGS =
+      aiProcess_Triangulate | aiProcess_GenNormals;
+  // what an import job hands to update(): the whole model, or for
+  // streaming loads its tables and the cache to read the meshes from
+  struct ModelSource
+  {
+    ImportedModel imported;
+    std::shared_ptr<ModelCache::Stream> stream;
+  };
+  // stages of a streamed mesh
+  static constexpr uint8_t STREAM_COARSE = 1;
+  static constexpr uint8_t STREAM_FULL = 2;
+  struct StreamedMesh
+  {
+    size_t index;
+    uint8_t stage;
+    bool ok;
+    Mesh mesh;
+  };
+  struct PendingModel
+  {
+    std::shared_ptr<AsyncModel> model;
+    std::future<std::shared_ptr<ModelSource>> source;
+    std::function<void(AsyncModel &)> onLoaded;
+    bool uploading = false;
+    size_t nextMesh = 0;
+    // streaming: stage read or being read and stage uploaded, per mesh
+    std::shared_ptr<ModelCache::Stream> stream;
+    std::vector<uint8_t> requested;
+    std::vector<uint8_t> resident;
+    std::deque<std::future<StreamedMesh>> reading;
+    size_t streamedBytes = 0;
+  };
+  // One streaming step: uploads meshes read since the last call, within the
+  // upload budget, and queues more reads in priority order. True once every
+  // mesh is uploaded in full.
+  bool streamMeshes(PendingModel &pending)
+  {
+    AsyncModel &asyncModel = *pending.model;
+    auto &meshes = asyncModel.model.meshes;
+    Renderer &renderer = resourceManager.getRenderer();
+    size_t uploaded = 0;
+    // reads finish roughly in the order they were queued
+    while (!pending.reading.empty() && uploaded < uploadBudget &&
+           pending.reading.front().wait_for(std::chrono::seconds(0)) ==
+               std::future_status::ready)
+    {
+      StreamedMesh streamed = pending.reading.front().get();
+      pending.reading.pop_front();
+      if (!streamed.ok)
+      {
+        std::cout << "Corrupt mesh " << streamed.index
+                  << " in the mesh cache\n";
+        pending.resident[streamed.index] = STREAM_FULL;
+        continue;
+      }
+      Mesh &mesh = meshes[streamed.index];
+      auto material = mesh.MaterialID;
+      renderer.destroyBuffer(mesh);
+      mesh = std::move(streamed.mesh);
+      mesh.MaterialID = material;
+      renderer.createBuffer(mesh, cpuMeshData);
+      pending.resident[streamed.index] = streamed.stage;
+      size_t bytes = (size_t)mesh.VertexCount * sizeof(Vertex) +
+                     (size_t)mesh.IndexCount * sizeof(unsigned int);
+      uploaded += bytes;
+      pending.streamedBytes += bytes;
+    }
+
+    // every mesh gets its coarsest level before any gets its full one;
+    // within a pass the largest on screen go first
+    const size_t maxReading = resourceManager.getJobs().threadCount() * 2 + 1;
+    size_t slots = maxReading > pending.reading.size()
+                       ? maxReading - pending.reading.size()
+                       : 0;
+    std::vector<uint32_t> candidates;
+    for (size_t i = 0; i < meshes.size() && slots > 0; ++i)
+    {
+      if (pending.requested[i] != STREAM_FULL)
+      {
+        candidates.push_back((uint32_t)i);
+      }
+    }
+    auto nextStage = [&](uint32_t i) {
+      return pending.requested[i] == 0 && meshes[i].Lods.size() > 1
+                 ? STREAM_COARSE
+                 : STREAM_FULL;
+    };
+    slots = std::min(slots, candidates.size());
+    std::partial_sort(candidates.begin(), candidates.begin() + slots,
+                      candidates.end(), [&](uint32_t a, uint32_t b) {
+                        uint8_t stageA = nextStage(a), stageB = nextStage(b);
+                        if (stageA != stageB)
+                        {
+                          return stageA < stageB;
+                        }
+                        return asyncModel.screenSize[a] >
+                               asyncModel.screenSize[b];
+                      });
+    JobSystem &jobs = resourceManager.getJobs();
+    for (size_t k = 0; k < slots; ++k)
+    {
+      uint32_t i = candidates[k];
+      uint8_t stage = nextStage(i);
+      pending.requested[i] = stage;
+      auto cache = pending.stream;
+      pending.reading.push_back(jobs.submit([cache, i, stage]() {
+        StreamedMesh streamed;
+        streamed.index = i;
+        streamed.stage = stage;
+        streamed.ok = stage == STREAM_COARSE
+                          ? ModelCache::readCoarseMesh(*cache, i,
+                                                       streamed.mesh)
+                          : ModelCache::readMesh(*cache, i, streamed.mesh);
+        return streamed;
+      }));
+    }
+
+    bool done = pending.reading.empty() &&
+                std::all_of(pending.resident.begin(), pending.resident.end(),
+                            [](uint8_t stage) { return stage == STREAM_FULL; });
+    if (done)
+    {
+      std::cout << "Streamed " << meshes.size() << " meshes, "
+                << pending.streamedBytes / 1024 << " KiB\n";
+      // update() finishes the model without uploading anything else
+      pending.nextMesh = meshes.size();
+      pending.stream.reset();
+    }
+    return done;
+  }
+  static void importModel(const std::string &path, ImportedModel &imported,
+                          const ImportOptions &options, JobSystem &jobs)
+  {
+    auto start = std::chrono::steady_clock::now();
+    uint64_t sourceHash = 0;
+    std::string cachePath = ModelCache::pathFor(path);
+    if (options.useCache)
+    {
+      sourceHash = hashSource(path);
+      if (sourceHash &&
+          ModelCache::read(cachePath, sourceHash, IMPORT_FLAGS,
+                           options.cacheKey(), imported))
+      {
+        std::cout << "Loaded " << path << " from cache in "
+                  << elapsedMs(start) << " ms\n";
+        return;
+      }
+    }
+    Assimp::Importer import;
+
+    const aiScene *scene = import.ReadFile(path, IMPORT_FLAGS);
+    if (!scene || scene->mFlags && AI_SCENE_FLAGS_INCOMPLETE ||
+        !scene->mRootNode)
+    {
+      std::cout << "ERROR::ASSIMP::" << import.GetErrorString() << std::endl;
+      return;
+    }
+
+    std::cout << "Loaded " << scene->mRootNode->mName.C_Str() << "\n";
+
+    std::string directory = path.substr(0, path.find_last_of("/"));
+
+    // flatten the node tree first so meshes keep their traversal order
+    std::vector<const aiMesh *> meshes;
+    collectMeshes(scene->mRootNode, SceneGraph::NO_PARENT, scene, meshes,
+                  imported.model);
+    imported.model.meshes.resize(meshes.size());
+    imported.meshMaterials.resize(meshes.size());
+    std::vector<OptimizeStats> optimized(
+        options.optimizeMeshes ? meshes.size() : 0);
+    std::vector<WeldStats> welded(options.weldVertices ? meshes.size() : 0);
+    jobs.parallelFor(meshes.size(), [&](size_t i) {
+      imported.model.meshes[i] = processMesh(meshes[i]);
+      imported.meshMaterials[i] = meshes[i]->mMaterialIndex;
+      if (options.weldVertices)
+      {
+        Mesh &mesh = imported.model.meshes[i];
+        welded[i] =
+            ::weldVertices(mesh.Vertices, mesh.Indices, options.weldEpsilon);
+      }
+      if (options.optimizeMeshes)
+      {
+        optimized[i] = optimizeMesh(imported.model.meshes[i]);
+      }
+      if (options.generateLods)
+      {
+        generateLods(imported.model.meshes[i], options);
+      }
+      if (options.buildMeshlets)
+      {
+        Mesh &mesh = imported.model.meshes[i];
+        size_t finest =
+            mesh.Lods.empty() ? mesh.Indices.size() : mesh.Lods[0].indexCount;
+        if (finest > 0)
+        {
+          mesh.Meshlets = ::buildMeshlets(
+              mesh.Indices.data(), finest,
+              glm::value_ptr(mesh.Vertices[0].Position), sizeof(Vertex),
+              mesh.Vertices.size());
+        }
+      }
+    });
+    if (!welded.empty())
+    {
+      WeldStats total;
+      for (auto &stats : welded)
+      {
+        total.verticesBefore += stats.verticesBefore;
+        total.verticesAfter += stats.verticesAfter;
+        total.bytesSaved += stats.bytesSaved;
+      }
+      std::cout << "Welded " << total.verticesBefore << " -> "
+                << total.verticesAfter << " vertices, saved "
+                << total.bytesSaved / 1024 << " KiB\n";
+    }
+    for (size_t i = 0; i < optimized.size(); ++i)
+    {
+      std::cout << "Mesh " << i << " ACMR " << optimized[i].before.acmr
+                << " -> " << optimized[i].after.acmr << ", ATVR "
+                << optimized[i].before.atvr << " -> "
+                << optimized[i].after.atvr << "\n";
+    }
+    if (options.generateLods)
+    {
+      printLodTable(imported.model);
+    }
+    imported.model.updateBounds();
+    size_t vertexCount = 0;
+    for (auto &mesh : imported.model.meshes)
+    {
+      vertexCount += mesh.Vertices.size();
+    }
+    imported.materials.resize(scene->mNumMaterials);
+    jobs.parallelFor(scene->mNumMaterials, [&](size_t i) {
+      aiMaterial *material = scene->mMaterials[i];
+      // load diffuse texture
+      loadMaterialTextures(imported.materials[i], scene, directory, material,
+                           aiTextureType_DIFFUSE, TextureType::Diffuse);
+      // load spec
+      loadMaterialTextures(imported.materials[i], scene, directory, material,
+                           aiTextureType_SPECULAR, TextureType::Specular);
+    });
+    imported.ok = true;
+    std::cout << meshes.size() << " meshes, " << vertexCount << " vertices, "
+              << scene->mNumMaterials << " materials\n";
+    std::cout << "Imported " << path << " in " << elapsedMs(start) << " ms\n";
+    if (sourceHash)
+    {
+      ModelCache::write(cachePath, sourceHash, IMPORT_FLAGS, options.cacheKey(),
+                        imported);
+    }
+  }
+  // 0 when the file cannot be read
+  static uint64_t hashSource(const std::string &path)
+  {
+    MappedFile source(path);
+    return source.data() ? hashBytes(source.data(), source.size()) : 0;
+  }
+  static long long elapsedMs(std::chrono::steady_clock::time_point start)
+  {
+    return std::chrono::duration_cast<std::chrono::milliseconds>(
+               std::chrono::steady_clock::now() - start)
+        .count();
+  }
+  struct OptimizeStats
+  {
+    VertexCacheStats before;
+    VertexCacheStats after;
+  };
+  // vertex cache, then overdraw, then vertex fetch order
+  static OptimizeStats optimizeMesh(Mesh &mesh)
+  {
+    OptimizeStats stats;
+    std::vector<unsigned int> &indices = mesh.Indices;
+    if (indices.empty())
+    {
+      return stats;
+    }
+    size_t vertexCount = mesh.Vertices.size();
+    stats.before =
+        analyzeVertexCache(indices.data(), indices.size(), vertexCount);
+    optimizeVertexCache(indices.data(), indices.size(), vertexCount);
+    optimizeOverdraw(indices.data(), indices.size(),
+                     glm::value_ptr(mesh.Vertices[0].Position), sizeof(Vertex),
+                     vertexCount);
+    optimizeVertexFetch(mesh.Vertices, indices);
+    stats.after = analyzeVertexCache(indices.data(), indices.size(),
+                                     mesh.Vertices.size());
+    return stats;
+  }
+  // Appends simplified copies of the index buffer after the full mesh, each
+  // lodReduction times the previous level. The chain stops early when the
+  // simplifier hits the error limit or stops making progress.
+  static void generateLods(Mesh &mesh, const ImportOptions &options)
+  {
+    std::vector<unsigned int> &indices = mesh.Indices;
+    size_t baseCount = indices.size();
+    mesh.Lods.assign(1, MeshLod{0, (uint32_t)baseCount, 0.0f});
+    if (baseCount == 0)
+    {
+      return;
+    }
+    size_t vertexCount = mesh.Vertices.size();
+    float maxError = glm::length(mesh.Bounds.size()) * options.lodMaxError;
+    std::vector<unsigned int> lod(baseCount);
+    size_t target = baseCount;
+    for (int level = 1; level < options.lodLevels; ++level)
+    {
+      target = (size_t)(target * options.lodReduction) / 3 * 3;
+      float error = 0.0f;
+      // always simplify the full mesh so errors do not stack up
+      size_t count = simplifyMesh(
+          lod.data(), indices.data(), baseCount,
+          glm::value_ptr(mesh.Vertices[0].Position),
+          glm::value_ptr(mesh.Vertices[0].Normal), sizeof(Vertex), vertexCount,
+          target, maxError, &error);
+      if (count == 0 || count > mesh.Lods.back().indexCount * 9 / 10)
+      {
+        break;
+      }
+      if (options.optimizeMeshes)
+      {
+        optimizeVertexCache(lod.data(), count, vertexCount);
+      }
+      mesh.Lods.push_back(
+          MeshLod{(uint32_t)indices.size(), (uint32_t)count, error});
+      indices.insert(indices.end(), lod.begin(), lod.begin() + count);
+    }
+  }
+  // depth first, so every node is added after its parent
+  static void collectMeshes(const aiNode *node, uint32_t parent,
+                            const aiScene *scene,
+                            std::vector<const aiMesh *> &meshes, Model &model)
+  {
+    // aiMatrix4x4 is row major
+    const aiMatrix4x4 &m = node->mTransformation;
+    glm::mat4 local(m.a1, m.b1, m.c1, m.d1, m.a2, m.b2, m.c2, m.d2, m.a3, m.b3,
+                    m.c3, m.d3, m.a4, m.b4, m.c4, m.d4);
+    uint32_t index = model.nodes.addNode(parent, local, node->mName.C_Str());
+    // process all the node's meshes
+    for (unsigned int i = 0; i < node->mNumMeshes; i++)
+    {
+      meshes.push_back(scene->mMeshes[node->mMeshes[i]]);
+      model.meshNodes.push_back(index);
+    }
+    // process each of its children
+    for (unsigned int i = 0; i < node->mNumChildren; i++)
+    {
+      collectMeshes(node->mChildren[i], index, scene, meshes, model);
+    }
+  }
+  // aiMesh to Vertex/index arrays; touches nothing shared so meshes can be
+  // converted in parallel
+  static Mesh processMesh(const aiMesh *mesh)
+  {
+    Mesh mMesh;
+    static_assert(sizeof(aiVector3D) == 3 * sizeof(float),
+                  "Assimp built with single precision vectors");
+    static_assert(sizeof(Vertex) == INTERLEAVED_VERTEX_FLOATS * sizeof(float) &&
+                      offsetof(Vertex, Normal) == 3 * sizeof(float) &&
+                      offsetof(Vertex, TexCoords) == 6 * sizeof(float),
+                  "Vertex matches the interleaved layout");
+    std::vector<Vertex> &vertices = mMesh.Vertices;
+    std::vector<unsigned int> &indices = mMesh.Indices;
+    vertices.resize(mesh->mNumVertices);
+    if (mesh->mNumVertices > 0)
+    {
+      interleaveVertices(
+          &mesh->mVertices[0].x, mesh->mNormals ? &mesh->mNormals[0].x : nullptr,
+          mesh->mTextureCoords[0] ? &mesh->mTextureCoords[0][0].x : nullptr,
+          mesh->mNumVertices, glm::value_ptr(vertices[0].Position));
+    }
+    // faces are triangulated on import; point and line faces are dropped
+    indices.resize((size_t)mesh->mNumFaces * 3);
+    indices.resize(flattenTriangles(mesh->mFaces, mesh->mNumFaces,
+                                    indices.data()));
+    computeBounds(mMesh);
+    return mMesh;
+  }
+  static void loadMaterialTextures(std::vector<TextureSource> &textures,
+                                   const aiScene *scene,
+                                   const std::string &directory,
+                                   aiMaterial *mat, aiTextureType type,
+                                   TextureType textureType)
+  {
+    for (unsigned int i = 0; i < mat->GetTextureCount(type); i++)
+    {
+      aiString str;
+      mat->GetTexture(type, i, &str);
+      TextureSource texture;
+      texture.type = textureType;
+      if (auto embeddedTexture = scene->GetEmbeddedTexture(str.C_Str()))
+      {
+        // returned pointer is not null, keep a copy of the texture memory.
+        // Embedded textures often have no file name so they are keyed by
+        // content
+        const unsigned char *data =
+            (const unsigned char *)embeddedTexture->pcData;
+        size_t size = embeddedTexture->mHeight == 0
+                          ? embeddedTexture->mWidth
+                          : (size_t)embeddedTexture->mWidth *
+                                embeddedTexture->mHeight * sizeof(aiTexel);
+        texture.path = embeddedTexture->mFilename.C_Str();
+        texture.embedded = std::make_shared<const std::vector<unsigned char>>(
+            data, data + size);
+        texture.width = embeddedTexture->mWidth;
+        texture.height = embeddedTexture->mHeight;
+      }
+      else
+      {
+        // regular file, read when the material is created
+        texture.path = directory + "/" + str.C_Str();
+      }
+      textures.push_back(texture);
+    }
+  }
+  // one Material per aiMaterial used by the model
+  void createMaterials(ImportedModel &imported, bool async)
+  {
+    // sync loads decode every compressed texture the model uses in one batch
+    std::unordered_map<const TextureSource *, Texture> decoded;
+    if (!async)
+    {
+      decoded = loadTextureBatch(imported);
+    }
+    std::vector<MaterialHandle> handles(imported.materials.size());
+    for (size_t i = 0; i < imported.model.meshes.size(); ++i)
+    {
+      unsigned int source = imported.meshMaterials[i];
+      if (source >= handles.size())
+      {
+        continue;
+      }
+      if (!handles[source].valid())
+      {
+        Material mat;
+        for (auto &textureSource : imported.materials[source])
+        {
+          auto found = decoded.find(&textureSource);
+          Texture texture = found != decoded.end()
+                                ? found->second
+                                : loadTexture(textureSource, async);
+          texture.type = textureSource.type;
+          mat.textures.push_back(texture);
+        }
+        handles[source] = resourceManager.addMaterial(mat);
+      }
+      imported.model.meshes[i].MaterialID = handles[source];
+    }
+  }
+  std::unordered_map<const TextureSource *, Texture>
+  loadTextureBatch(const ImportedModel &imported)
+  {
+    std::vector<bool> used(imported.materials.size(), false);
+    for (unsigned int material : imported.meshMaterials)
+    {
+      if (material < used.size())
+      {
+        used[material] = true;
+      }
+    }
+    std::vector<const TextureSource *> sources;
+    std::vector<ResourceManager::TextureRequest> requests;
+    for (size_t i = 0; i < imported.materials.size(); ++i)
+    {
+      for (auto &source : imported.materials[i])
+      {
+        // raw embedded texels need no decoding
+        if (!used[i] || (source.embedded && source.height != 0))
+        {
+          continue;
+        }
+        ResourceManager::TextureRequest request;
+        request.name = source.path;
+        request.flip = !source.embedded;
+        request.bytes = source.embedded;
+        sources.push_back(&source);
+        requests.push_back(request);
+      }
+    }
+    std::vector<Texture> textures = resourceManager.loadTextures2D(requests);
+    std::unordered_map<const TextureSource *, Texture> loaded;
+    for (size_t i = 0; i < sources.size(); ++i)
+    {
+      loaded[sources[i]] = textures[i];
+    }
+    return loaded;
+  }
+  Texture loadTexture(const TextureSource &source, bool async)
+  {
+    if (!source.embedded)
+    {
+      Image image(source.path, true);
+      return async ? resourceManager.loadTexture2DAsync(image)
+                   : resourceManager.loadTexture2D(image);
+    }
+    if (async && source.height == 0)
+    {
+      return resourceManager.loadEmbeddedTextureAsync(source.path,
+                                                      source.embedded);
+    }
+    return resourceManager.loadEmbeddedTexture(
+        source.path, source.embedded->data(), source.width, source.height);
+  }
+  std::vector<PendingModel> pendingModels;
+  size_t uploadBudget = 8 * 1024 * 1024;
+  CpuMeshData cpuMeshData = CpuMeshData::Keep;
+  ImportOptions options;
+  ResourceManager &resourceManager;
+};
+// Draws collected during a frame. MeshRenderer::flush submits them in sort
+// key order (see render_queue.h) and empties the queue.
+class RenderQueue
+{
+public:
+  struct Packet
+  {
+    const Mesh *mesh;
+    const Material *material;
+    Shader *shader;
+    glm::mat4 transform;
+    // view space depth, along the camera's front
+    float depth;
+    uint8_t pass;
+    bool translucent;
+  };
+  RenderQueue(JobSystem *jobs = nullptr) : jobs(jobs) {}
+  // translucent packets are sorted on these threads, null sorts inline
+  void setJobSystem(JobSystem *jobs) { this->jobs = jobs; }
+  void add(const Packet &packet) { packets.push_back(packet); }
+  void clear() { packets.clear(); }
+  size_t size() const { return packets.size(); }
+  const std::vector<Packet> &getPackets() const { return packets; }
+  // Packet indices in draw order. Shaders and materials are numbered in the
+  // order they were first added, which is what the keys hold. Translucent
+  // packets follow the opaque ones of their pass, back to front on depth
+  // alone, sorted with ParallelRadixSort; equal depths keep submission
+  // order.
+  const std::vector<SortItem> &sort()
+  {
+    shaderIds.clear();
+    materialIds.clear();
+    keys.resize(packets.size());
+    opaque.clear();
+    translucent.clear();
+    uint32_t translucentPasses = 0;
+    const Shader *lastShader = nullptr;
+    const Material *lastMaterial = nullptr;
+    uint32_t shader = 0, material = 0;
+    for (size_t i = 0; i < packets.size(); ++i)
+    {
+      const Packet &packet = packets[i];
+      // runs of one shader and material skip the lookups
+      if (packet.shader != lastShader)
+      {
+        shader =
+            shaderIds.emplace(packet.shader->ID, (uint32_t)shaderIds.size())
+                .first->second;
+        lastShader = packet.shader;
+      }
+      if (packet.material != lastMaterial)
+      {
+        material =
+            materialIds.emplace(packet.material, (uint32_t)materialIds.size())
+                .first->second;
+        lastMaterial = packet.material;
+      }
+      uint64_t key = makeSortKey(packet.pass, packet.translucent, shader,
+                                 material, packet.depth);
+      keys[i] = key;
+      if (packet.translucent)
+      {
+        translucent.push_back(
+            DepthSortItem{backToFrontKey(packet.depth), (uint32_t)i});
+        translucentPasses |= 1u << (key >> 60);
+      }
+      else
+      {
+        opaque.push_back(SortItem{key, (uint32_t)i});
+      }
+    }
+    radixSort(opaque, scratch);
+    depthSort.sort(translucent, jobs);
+    items.clear();
+    items.reserve(packets.size());
+    size_t next = 0;
+    for (uint32_t pass = 0; pass < (1u << SORT_KEY_PASS_BITS); ++pass)
+    {
+      while (next < opaque.size() && opaque[next].key >> 60 == pass)
+      {
+        items.push_back(opaque[next++]);
+      }
+      if ((translucentPasses & 1u << pass) == 0)
+      {
+        continue;
+      }
+      for (const DepthSortItem &item : translucent)
+      {
+        if (keys[item.index] >> 60 == pass)
+        {
+          items.push_back(SortItem{keys[item.index], item.index});
+        }
+      }
+    }
+    return items;
+  }
+
+private:
+  JobSystem *jobs;
+  std::vector<Packet> packets;
+  std::vector<uint64_t> keys;
+  std::vector<SortItem> opaque;
+  std::vector<DepthSortItem> translucent;
+  ParallelRadixSort depthSort;
+  std::vector<SortItem> items;
+  std::vector<SortItem> scratch;
+  std::unordered_map<unsigned int, uint32_t> shaderIds;
+  std::unordered_map<const Material *, uint32_t> materialIds;
+};
+// Distance at which the attenuation takes the brightest channel of a light
+// below 1/256, where clustered and deferred shading cut it off
+inline float lightRange(const Light &light)
+{
+  float brightest = std::max(
+      {light.Ambiant.x, light.Ambiant.y, light.Ambiant.z, light.Diffuse.x,
+       light.Diffuse.y, light.Diffuse.z, light.Specular.x, light.Specular.y,
+       light.Specular.z});
+  float c = light.Constant - 256.0f * brightest;
+  if (c >= 0.0f)
+  {
+    return 0.0f;
+  }
+  if (light.Quadratic > 0.0f)
+  {
+    return (-light.Linear + std::sqrt(light.Linear * light.Linear -
+                                      4.0f * light.Quadratic * c)) /
+           (2.0f * light.Quadratic);
+  }
+  return light.Linear > 0.0f ? -c / light.Linear : 1e30f;
+}
+// Clustered forward lighting: every frame the point and spot lights are
+// assigned on the job system to the clusters of the camera's frustum, and
+// the lights, the cluster grid and the light index list are uploaded as
+// texture buffers that fClusteredModel.glsl reads.
+class ClusteredLights
+{
+public:
+  // the three buffers use texture units 13 to 15, above the material's
+  static const int TEXTURE_UNIT = 13;
+  ClusteredLights(JobSystem &jobs, int tilesX = 16, int tilesY = 9,
+                  int slices = 24)
+      : jobs(jobs), clusters(tilesX, tilesY, slices)
+  {
+  }
+  void update(Camera &camera, const std::vector<Light> &pointLights,
+              const std::vector<Light> &spotLights, int viewportWidth,
+              int viewportHeight)
+  {
+    auto start = std::chrono::steady_clock::now();
+    if (textures[0] == 0)
+    {
+      createBuffers();
+    }
+    clusters.setProjection(camera.Projection);
+    viewport = glm::vec2((float)viewportWidth, (float)viewportHeight);
+    glm::mat4 view = camera.calculateViewMatrix();
+    viewLights.clear();
+    lightTexels.clear();
+    for (const Light &light : pointLights)
+    {
+      addLight(view, light, false);
+    }
+    for (const Light &light : spotLights)
+    {
+      addLight(view, light, true);
+    }
+    clusters.beginAssign(viewLights);
+    jobs.parallelFor(clusters.countZ(), [this](size_t slice) {
+      clusters.assignSlice((int)slice);
+    });
+    clusters.finishAssign((size_t)maxTexels);
+    if (clusters.wasTruncated() && !warned)
+    {
+      std::cout << "Too many clustered light indices for a texture buffer, "
+                   "some lights are dropped"
+                << std::endl;
+      warned = true;
+    }
+    upload(0, lightTexels.size() * sizeof(glm::vec4), lightTexels.data());
+    upload(1, clusters.getGrid().size() * sizeof(uint32_t),
+           clusters.getGrid().data());
+    upload(2, clusters.getIndices().size() * sizeof(uint32_t),
+           clusters.getIndices().data());
+    stats.lights = viewLights.size();
+    stats.indices = clusters.getIndices().size();
+    stats.largestCluster = clusters.getLargestCluster();
+    stats.assignMs = std::chrono::duration<double, std::milli>(
+                         std::chrono::steady_clock::now() - start)
+                         .count();
+  }
+  // binds the buffers and sets the cluster uniforms of a program
+  void bind(Shader &shader)
+  {
+    shader.use();
+    const char *names[3] = {"clusterLights", "clusterGrid", "clusterIndices"};
+    for (int i = 0; i < 3; ++i)
+    {
+      glActiveTexture(GL_TEXTURE0 + TEXTURE_UNIT + i);
+      glBindTexture(GL_TEXTURE_BUFFER, textures[i]);
+      shader.setInt(names[i], TEXTURE_UNIT + i);
+    }
+    glActiveTexture(GL_TEXTURE0);
+    glUniform3i(glGetUniformLocation(shader.ID, "clusterCount"),
+                clusters.countX(), clusters.countY(), clusters.countZ());
+    glUniform2f(glGetUniformLocation(shader.ID, "clusterTileSize"),
+                viewport.x / clusters.countX(), viewport.y / clusters.countY());
+    shader.setFloat("clusterSliceScale", clusters.sliceScale());
+    shader.setFloat("clusterSliceBias", clusters.sliceBias());
+  }
+  struct Stats
+  {
+    size_t lights = 0;
+    // light indices over all clusters
+    size_t indices = 0;
+    uint32_t largestCluster = 0;
+    // CPU time of the last update, upload included
+    double assignMs = 0.0;
+  };
+  const Stats &getStats() const { return stats; }
+  const LightClusters &getClusters() const { return clusters; }
+
+private:
+  void createBuffers()
+  {
+    const GLenum formats[3] = {GL_RGBA32F, GL_RG32UI, GL_R32UI};
+    glGenBuffers(3, buffers);
+    glGenTextures(3, textures);
+    for (int i = 0; i < 3; ++i)
+    {
+      glBindBuffer(GL_TEXTURE_BUFFER, buffers[i]);
+      glBufferData(GL_TEXTURE_BUFFER, sizeof(glm::vec4), nullptr,
+                   GL_STREAM_DRAW);
+      glBindTexture(GL_TEXTURE_BUFFER, textures[i]);
+      glTexBuffer(GL_TEXTURE_BUFFER, formats[i], buffers[i]);
+    }
+    glBindTexture(GL_TEXTURE_BUFFER, 0);
+    glGetIntegerv(GL_MAX_TEXTURE_BUFFER_SIZE, &maxTexels);
+  }
+  void upload(int buffer, size_t bytes, const void *data)
+  {
+    glBindBuffer(GL_TEXTURE_BUFFER, buffers[buffer]);
+    // a buffer is never left empty, texelFetch needs a store behind it
+    glBufferData(GL_TEXTURE_BUFFER, std::max(bytes, sizeof(glm::vec4)), nullptr,
+                 GL_STREAM_DRAW);
+    glBufferSubData(GL_TEXTURE_BUFFER, 0, bytes, data);
+  }
+  void addLight(const glm::mat4 &view, const Light &light, bool spot)
+  {
+    if (lightTexels.size() + 5 > (size_t)maxTexels)
+    {
+      return;
+    }
+    ClusterLight clustered;
+    clustered.position = glm::vec3(view * glm::vec4(light.Position, 1.0f));
+    clustered.radius = lightRange(light);
+    clustered.direction = spot
+                              ? glm::normalize(glm::mat3(view) * light.Direction)
+                              : glm::vec3(0.0f, 0.0f, -1.0f);
+    float outer = glm::radians(std::max(light.CutOff, light.OuterCutOff));
+    clustered.cosAngle = std::cos(outer);
+    clustered.sinAngle = std::sin(outer);
+    clustered.spot = spot;
+    if (clustered.radius <= 0.0f)
+    {
+      return;
+    }
+    viewLights.push_back(clustered);
+    lightTexels.push_back(glm::vec4(clustered.position, light.Constant));
+    lightTexels.push_back(glm::vec4(clustered.direction, light.Linear));
+    lightTexels.push_back(glm::vec4(light.Ambiant, light.Quadratic));
+    lightTexels.push_back(glm::vec4(
+        light.Diffuse, spot ? glm::cos(glm::radians(light.CutOff)) : -2.0f));
+    lightTexels.push_back(
+        glm::vec4(light.Specular, spot ? clustered.cosAngle : -2.0f));
+  }
+  JobSystem &jobs;
+  LightClusters clusters;
+  std::vector<ClusterLight> viewLights;
+  std::vector<glm::vec4> lightTexels;
+  unsigned int buffers[3] = {0, 0, 0};
+  unsigned int textures[3] = {0, 0, 0};
+  int maxTexels = 65536;
+  glm::vec2 viewport = glm::vec2(1.0f);
+  bool warned = false;
+  Stats stats;
+};
+// Deferred shading: meshes are drawn once into a G-buffer (albedo and
+// specular, view space normal and shininess, linear depth), then every
+// point and spot light draws a sphere or cone around its range that only
+// shades the pixels whose geometry lies inside it. A stencil pass per
+// light marks those pixels, so a light costs the pixels it reaches rather
+// than the geometry of the scene.
+//
+//   deferred.beginGeometry(width, height);
+//   render.flush(camera, queue); // materials using fGBuffer.glsl
+//   deferred.shadeLights(camera, sun, pointLights, spotLights);
+//   deferred.present(width, height);
+class DeferredRenderer
+{
+public:
+  DeferredRenderer(Renderer &renderer)
+      : stencilShader("./shader/vDeferredLight.glsl",
+                      "./shader/fDeferredStencil.glsl"),
+        lightShader("./shader/vDeferredLight.glsl",
+                    "./shader/fDeferredLight.glsl"),
+        directionalShader("./shader/vframe_buffer.glsl",
+                          "./shader/fDeferredDirectional.glsl"),
+        sphere(createSphere(SPHERE_RINGS, SPHERE_SEGMENTS)),
+        cone(createCone(CONE_SEGMENTS)), quad(createPlane())
+  {
+    renderer.createBuffer(sphere, CpuMeshData::Release);
+    renderer.createBuffer(cone, CpuMeshData::Release);
+    renderer.createBuffer(quad, CpuMeshData::Release);
+  }
+  ~DeferredRenderer() { destroyTargets(); }
+  DeferredRenderer(const DeferredRenderer &) = delete;
+  DeferredRenderer &operator=(const DeferredRenderer &) = delete;
+
+  // Binds the G-buffer, sized to the viewport, and clears it; the light
+  // accumulation target gets the background color
+  void beginGeometry(int viewportWidth, int viewportHeight,
+                     const glm::vec4 &background = glm::vec4(0.0f))
+  {
+    if (viewportWidth != width || viewportHeight != height)
+    {
+      destroyTargets();
+      createTargets(viewportWidth, viewportHeight);
+    }
+    glBindFramebuffer(GL_FRAMEBUFFER, fbo);
+    const GLenum drawBuffers[4] = {GL_COLOR_ATTACHMENT0, GL_COLOR_ATTACHMENT1,
+                                   GL_COLOR_ATTACHMENT2, GL_COLOR_ATTACHMENT3};
+    glDrawBuffers(4, drawBuffers);
+    const float zero[4] = {0.0f, 0.0f, 0.0f, 0.0f};
+    for (int i = 0; i < 3; ++i)
+    {
+      glClearBufferfv(GL_COLOR, i, zero);
+    }
+    glClearBufferfv(GL_COLOR, 3, glm::value_ptr(background));
+    glClearBufferfi(GL_DEPTH_STENCIL, 0, 1.0f, 0);
+    // meshes write the three G-buffer targets only
+    glDrawBuffers(3, drawBuffers);
+    glEnable(GL_DEPTH_TEST);
+    glDepthMask(GL_TRUE);
+    glDisable(GL_BLEND);
+  }
+  // Accumulates the lights into the light target; the directional light
+  // covers the screen, the others their volume only
+  void shadeLights(Camera &camera, const Light &directional,
+                   const std::vector<Light> &pointLights,
+                   const std::vector<Light> &spotLights)
+  {
+    glm::mat4 view = camera.calculateViewMatrix();
+    glm::vec2 viewRay(1.0f / camera.Projection[0][0],
+                      1.0f / camera.Projection[1][1]);
+    for (int i = 0; i < 3; ++i)
+    {
+      glActiveTexture(GL_TEXTURE0 + i);
+      glBindTexture(GL_TEXTURE_2D, targets[i]);
+    }
+    glDrawBuffer(GL_COLOR_ATTACHMENT3);
+    glDepthMask(GL_FALSE);
+
+    // directional light and background
+    glDisable(GL_DEPTH_TEST);
+    directionalShader.use();
+    setGBufferUniforms(directionalShader, viewRay);
+    directionalShader.setMat4("model", glm::scale(glm::mat4(1.0f),
+                                                  glm::vec3(2.0f)));
+    directionalShader.setVec3("light.direction",
+                              glm::mat3(view) * directional.Direction);
+    directionalShader.setVec3("light.ambient", directional.Ambiant);
+    directionalShader.setVec3("light.diffuse", directional.Diffuse);
+    directionalShader.setVec3("light.specular", directional.Specular);
+    glBindVertexArray(quad.Id);
+    glDrawElementsBaseVertex(GL_TRIANGLES, (int)quad.IndexCount,
+                             GL_UNSIGNED_INT, elementOffset(quad),
+                             (GLint)quad.BaseVertex);
+
+    // Volumes: the stencil pass counts, per pixel, back faces behind the
+    // geometry minus front faces behind it, which leaves a non zero value
+    // exactly where the geometry is inside the volume. The light pass shades
+    // those pixels and sets them back to 0 for the next light, so the
+    // stencil is never cleared. Depth clamping keeps volumes that cross the
+    // near or far plane closed.
+    glEnable(GL_STENCIL_TEST);
+    glEnable(GL_DEPTH_CLAMP);
+    glBlendFunc(GL_ONE, GL_ONE);
+    for (Shader *shader : {&stencilShader, &lightShader})
+    {
+      shader->use();
+      shader->setMat4("view", view);
+      shader->setMat4("projection", camera.Projection);
+    }
+    setGBufferUniforms(lightShader, viewRay);
+    Frustum frustum = camera.frustum();
+    stats = Stats();
+    for (const Light &light : pointLights)
+    {
+      drawVolume(frustum, view, light, false);
+    }
+    for (const Light &light : spotLights)
+    {
+      drawVolume(frustum, view, light, true);
+    }
+
+    glDisable(GL_STENCIL_TEST);
+    glDisable(GL_DEPTH_CLAMP);
+    glDisable(GL_BLEND);
+    glDisable(GL_CULL_FACE);
+    glCullFace(GL_BACK);
+    glEnable(GL_DEPTH_TEST);
+    glDepthMask(GL_TRUE);
+    glBindVertexArray(0);
+    glActiveTexture(GL_TEXTURE0);
+  }
+  // Copies the lit image and the depth to the default framebuffer, so
+  // forward passes (sky box, translucent meshes) can draw on top
+  void present(int viewportWidth, int viewportHeight)
+  {
+    glBindFramebuffer(GL_READ_FRAMEBUFFER, fbo);
+    glReadBuffer(GL_COLOR_ATTACHMENT3);
+    glBindFramebuffer(GL_DRAW_FRAMEBUFFER, 0);
+    glBlitFramebuffer(0, 0, width, height, 0, 0, viewportWidth,
+                      viewportHeight, GL_COLOR_BUFFER_BIT, GL_NEAREST);
+    if (viewportWidth == width && viewportHeight == height)
+    {
+      glBlitFramebuffer(0, 0, width, height, 0, 0, width, height,
+                        GL_DEPTH_BUFFER_BIT, GL_NEAREST);
+    }
+    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+  }
+  struct Stats
+  {
+    size_t pointLights = 0;
+    size_t spotLights = 0;
+    // outside the frustum or out of range everywhere
+    size_t lightsCulled = 0;
+  };
+  const Stats &getStats() const { return stats; }
+  // bytes of the G-buffer and light target, depth and stencil included
+  size_t getMemory() const
+  {
+    return (size_t)width * height * (4 + 8 + 4 + 8 + 4);
+  }
+
+private:
+  static const int SPHERE_RINGS = 8;
+  static const int SPHERE_SEGMENTS = 12;
+  static const int CONE_SEGMENTS = 12;
+  // spot lights wider than this use a sphere, a cone this wide is no tighter
+  static constexpr float MAX_CONE_ANGLE = 60.0f;
+
+  void createTargets(int targetWidth, int targetHeight)
+  {
+    width = targetWidth;
+    height = targetHeight;
+    glGenFramebuffers(1, &fbo);
+    glBindFramebuffer(GL_FRAMEBUFFER, fbo);
+    // albedo and specular intensity, normal and shininess, linear depth,
+    // lit color
+    const GLenum internalFormats[4] = {GL_RGBA8, GL_RGBA16F, GL_R32F,
+                                       GL_RGBA16F};
+    const GLenum formats[4] = {GL_RGBA, GL_RGBA, GL_RED, GL_RGBA};
+    const GLenum types[4] = {GL_UNSIGNED_BYTE, GL_FLOAT, GL_FLOAT, GL_FLOAT};
+    glGenTextures(4, targets);
+    for (int i = 0; i < 4; ++i)
+    {
+      glBindTexture(GL_TEXTURE_2D, targets[i]);
+      glTexImage2D(GL_TEXTURE_2D, 0, internalFormats[i], width, height, 0,
+                   formats[i], types[i], NULL);
+      glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+      glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+      glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+      glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+      glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0 + i,
+                             GL_TEXTURE_2D, targets[i], 0);
+    }
+    // depth for the geometry, stencil for the light volumes; the shaders
+    // read the linear depth target instead, so this is never sampled
+    glGenRenderbuffers(1, &depthStencil);
+    glBindRenderbuffer(GL_RENDERBUFFER, depthStencil);
+    glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH24_STENCIL8, width, height);
+    glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_STENCIL_ATTACHMENT,
+                              GL_RENDERBUFFER, depthStencil);
+    if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE)
+      std::cout << "ERROR::FRAMEBUFFER:: G-buffer is not complete!"
+                << std::endl;
+    glBindTexture(GL_TEXTURE_2D, 0);
+    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+  }
+  void destroyTargets()
+  {
+    if (fbo == 0)
+    {
+      return;
+    }
+    glDeleteFramebuffers(1, &fbo);
+    glDeleteTextures(4, targets);
+    glDeleteRenderbuffers(1, &depthStencil);
+    fbo = 0;
+    width = height = 0;
+  }
+  void setGBufferUniforms(Shader &shader, const glm::vec2 &viewRay)
+  {
+    shader.setInt("gAlbedoSpec", 0);
+    shader.setInt("gNormal", 1);
+    shader.setInt("gDepth", 2);
+    glUniform2f(glGetUniformLocation(shader.ID, "screenSize"), (float)width,
+                (float)height);
+    glUniform2fv(glGetUniformLocation(shader.ID, "viewRay"), 1,
+                 glm::value_ptr(viewRay));
+  }
+  void drawVolume(const Frustum &frustum, const glm::mat4 &view,
+                  const Light &light, bool spot)
+  {
+    float range = lightRange(light);
+    if (range <= 0.0f || !frustum.intersectsSphere(light.Position, range))
+    {
+      ++stats.lightsCulled;
+      return;
+    }
+    float outer = std::max(light.CutOff, light.OuterCutOff);
+    bool useCone = spot && outer <= MAX_CONE_ANGLE;
+    const Mesh &volume = useCone ? cone : sphere;
+    const float pi = glm::pi<float>();
+    glm::mat4 model = glm::translate(glm::mat4(1.0f), light.Position);
+    if (useCone)
+    {
+      // -z of the cone along the light direction
+      glm::vec3 back = -glm::normalize(light.Direction);
+      glm::vec3 up = std::fabs(back.y) < 0.99f ? glm::vec3(0.0f, 1.0f, 0.0f)
+                                               : glm::vec3(1.0f, 0.0f, 0.0f);
+      glm::vec3 right = glm::normalize(glm::cross(up, back));
+      model = model * glm::mat4(glm::vec4(right, 0.0f),
+                                glm::vec4(glm::cross(back, right), 0.0f),
+                                glm::vec4(back, 0.0f),
+                                glm::vec4(0.0f, 0.0f, 0.0f, 1.0f));
+      float radius = range * std::tan(glm::radians(outer)) /
+                     std::cos(pi / CONE_SEGMENTS);
+      model = glm::scale(model, glm::vec3(radius, radius, range));
+    }
+    else
+    {
+      float radius = range / (std::cos(pi / SPHERE_SEGMENTS) *
+                              std::cos(pi / (2 * SPHERE_RINGS)));
+      model = glm::scale(model, glm::vec3(radius));
+    }
+    ++(spot ? stats.spotLights : stats.pointLights);
+    glBindVertexArray(volume.Id);
+
+    stencilShader.use();
+    stencilShader.setMat4("model", model);
+    glDrawBuffer(GL_NONE);
+    glEnable(GL_DEPTH_TEST);
+    glDisable(GL_CULL_FACE);
+    glDisable(GL_BLEND);
+    glStencilFunc(GL_ALWAYS, 0, 0xFF);
+    glStencilOpSeparate(GL_BACK, GL_KEEP, GL_INCR_WRAP, GL_KEEP);
+    glStencilOpSeparate(GL_FRONT, GL_KEEP, GL_DECR_WRAP, GL_KEEP);
+    glDrawElementsBaseVertex(GL_TRIANGLES, (int)volume.IndexCount,
+                             GL_UNSIGNED_INT, elementOffset(volume),
+                             (GLint)volume.BaseVertex);
+
+    lightShader.use();
+    lightShader.setMat4("model", model);
+    setLightUniforms(view, light, spot);
+    glDrawBuffer(GL_COLOR_ATTACHMENT3);
+    glDisable(GL_DEPTH_TEST);
+    // back faces, so the volume still shades with the camera inside it
+    glEnable(GL_CULL_FACE);
+    glCullFace(GL_FRONT);
+    glEnable(GL_BLEND);
+    glStencilFunc(GL_NOTEQUAL, 0, 0xFF);
+    glStencilOp(GL_KEEP, GL_KEEP, GL_ZERO);
+    glDrawElementsBaseVertex(GL_TRIANGLES, (int)volume.IndexCount,
+                             GL_UNSIGNED_INT, elementOffset(volume),
+                             (GLint)volume.BaseVertex);
+  }
+  void setLightUniforms(const glm::mat4 &view, const Light &light, bool spot)
+  {
+    lightShader.setVec3("light.position",
+                        glm::vec3(view * glm::vec4(light.Position, 1.0f)));
+    lightShader.setVec3("light.direction",
+                        spot ? glm::mat3(view) * light.Direction
+                             : glm::vec3(0.0f, 0.0f, -1.0f));
+    lightShader.setVec3("light.ambient", light.Ambiant);
+    lightShader.setVec3("light.diffuse", light.Diffuse);
+    lightShader.setVec3("light.specular", light.Specular);
+    lightShader.setFloat("light.constant", light.Constant);
+    lightShader.setFloat("light.linear", light.Linear);
+    lightShader.setFloat("light.quadratic", light.Quadratic);
+    lightShader.setFloat("light.cutOff",
+                         spot ? glm::cos(glm::radians(light.CutOff)) : -2.0f);
+    lightShader.setFloat("light.outerCutOff",
+                         spot ? glm::cos(glm::radians(light.OuterCutOff))
+                              : -2.0f);
+  }
+  Shader stencilShader;
+  Shader lightShader;
+  Shader directionalShader;
+  Mesh sphere;
+  Mesh cone;
+  Mesh quad;
+  unsigned int fbo = 0;
+  unsigned int targets[4] = {0, 0, 0, 0};
+  unsigned int depthStencil = 0;
+  int width = 0;
+  int height = 0;
+  Stats stats;
+};
+// Per draw buffer blend functions are core in GL 4.0 and come with
+// ARB_draw_buffers_blend on most GL 3.3 drivers; glad only loads GL 3.3
+#ifndef GL_VERSION_4_0
+typedef void(APIENTRYP PFNGLBLENDFUNCIPROC)(GLuint buf, GLenum src,
+                                            GLenum dst);
+#endif
+// Null when the current context has neither
+inline PFNGLBLENDFUNCIPROC loadBlendFunci()
+{
+  if (GLVersion.major >= 4)
+  {
+    return (PFNGLBLENDFUNCIPROC)glfwGetProcAddress("glBlendFunci");
+  }
+  GLint extensionCount = 0;
+  glGetIntegerv(GL_NUM_EXTENSIONS, &extensionCount);
+  for (GLint i = 0; i < extensionCount; ++i)
+  {
+    const char *name = (const char *)glGetStringi(GL_EXTENSIONS, i);
+    if (name && std::string(name) == "GL_ARB_draw_buffers_blend")
+    {
+      return (PFNGLBLENDFUNCIPROC)glfwGetProcAddress("glBlendFunciARB");
+    }
+  }
+  return nullptr;
+}
+// Weighted blended order independent transparency (McGuire and Bavoil).
+// Translucent surfaces are drawn in any order into an accumulation target,
+// the sum of their premultiplied colors and alphas scaled by a depth
+// weight, and a revealage target, the product of their (1 - alpha). The
+// composite then lays the weighted average color over the opaque image
+// with the revealage as coverage. No sorting is needed, so a whole field
+// of sprites of one mesh and material is a single instanced draw; the
+// price is an approximate order where layers are close in depth.
+//
+// Draw the opaque scene first, then begin(), draw the translucent meshes
+// with a shader writing both targets (see fOitAccumulate.glsl), and
+// composite(). With MeshRenderer, submit them as opaque packets: their
+// order does not matter and they are then instanced together.
+class WeightedBlendedTransparency
+{
+public:
+  WeightedBlendedTransparency(Renderer &renderer)
+      : compositeShader("./shader/vframe_buffer.glsl",
+                        "./shader/fOitComposite.glsl"),
+        quad(createPlane()), blendFunci(loadBlendFunci())
+  {
+    renderer.createBuffer(quad, CpuMeshData::Release);
+    if (!blendFunci)
+    {
+      std::cout << "Weighted blended transparency needs OpenGL 4.0 or "
+                   "ARB_draw_buffers_blend"
+                << std::endl;
+    }
+  }
+  ~WeightedBlendedTransparency() { destroyTargets(); }
+  WeightedBlendedTransparency(const WeightedBlendedTransparency &) = delete;
+  WeightedBlendedTransparency &
+  operator=(const WeightedBlendedTransparency &) = delete;
+
+  // false when the context cannot blend the two targets differently; sort
+  // the translucent draws instead
+  bool available() const { return blendFunci != nullptr; }
+  // Binds the transparency targets, sized to the viewport, and clears
+  // them. The depth of opaqueFramebuffer is copied in so translucent
+  // fragments behind opaque ones are rejected; both must use
+  // GL_DEPTH24_STENCIL8, like GLFW's default framebuffer. Depth writes are
+  // turned off and the blend functions set for the accumulation. Does
+  // nothing unless available().
+  void begin(int viewportWidth, int viewportHeight,
+             unsigned int opaqueFramebuffer = 0)
+  {
+    if (!blendFunci)
+    {
+      return;
+    }
+    if (viewportWidth != width || viewportHeight != height)
+    {
+      destroyTargets();
+      createTargets(viewportWidth, viewportHeight);
+    }
+    glBindFramebuffer(GL_READ_FRAMEBUFFER, opaqueFramebuffer);
+    glBindFramebuffer(GL_DRAW_FRAMEBUFFER, fbo);
+    glBlitFramebuffer(0, 0, width, height, 0, 0, width, height,
+                      GL_DEPTH_BUFFER_BIT, GL_NEAREST);
+    glBindFramebuffer(GL_FRAMEBUFFER, fbo);
+    const GLenum drawBuffers[2] = {GL_COLOR_ATTACHMENT0,
+                                   GL_COLOR_ATTACHMENT1};
+    glDrawBuffers(2, drawBuffers);
+    // no coverage yet: nothing accumulated, everything revealed
+    const float zero[4] = {0.0f, 0.0f, 0.0f, 0.0f};
+    const float one[4] = {1.0f, 1.0f, 1.0f, 1.0f};
+    glClearBufferfv(GL_COLOR, 0, zero);
+    glClearBufferfv(GL_COLOR, 1, one);
+    glEnable(GL_DEPTH_TEST);
+    glDepthMask(GL_FALSE);
+    glEnable(GL_BLEND);
+    glBlendEquation(GL_FUNC_ADD);
+    blendFunci(0, GL_ONE, GL_ONE);
+    blendFunci(1, GL_ZERO, GL_ONE_MINUS_SRC_COLOR);
+  }
+  // Blends the average translucent color over targetFramebuffer, which
+  // should hold the opaque image, then turns depth writes back on and
+  // blending off
+  void composite(unsigned int targetFramebuffer = 0)
+  {
+    glBindFramebuffer(GL_FRAMEBUFFER, targetFramebuffer);
+    for (int i = 0; i < 2; ++i)
+    {
+      glActiveTexture(GL_TEXTURE0 + i);
+      glBindTexture(GL_TEXTURE_2D, targets[i]);
+    }
+    glDisable(GL_DEPTH_TEST);
+    glBlendFunc(GL_ONE_MINUS_SRC_ALPHA, GL_SRC_ALPHA);
+    compositeShader.use();
+    compositeShader.setInt("accumulation", 0);
+    compositeShader.setInt("revealage", 1);
+    compositeShader.setMat4("model",
+                            glm::scale(glm::mat4(1.0f), glm::vec3(2.0f)));
+    glBindVertexArray(quad.Id);
+    glDrawElementsBaseVertex(GL_TRIANGLES, (int)quad.IndexCount,
+                             GL_UNSIGNED_INT, elementOffset(quad),
+                             (GLint)quad.BaseVertex);
+    glBindVertexArray(0);
+    glActiveTexture(GL_TEXTURE0);
+    glDisable(GL_BLEND);
+    glEnable(GL_DEPTH_TEST);
+    glDepthMask(GL_TRUE);
+  }
+  // bytes of the two targets and the depth copy
+  size_t getMemory() const { return (size_t)width * height * (8 + 1 + 4); }
+
+private:
+  void createTargets(int targetWidth, int targetHeight)
+  {
+    width = targetWidth;
+    height = targetHeight;
+    glGenFramebuffers(1, &fbo);
+    glBindFramebuffer(GL_FRAMEBUFFER, fbo);
+    // weighted premultiplied color and alpha sums, revealage
+    const GLenum internalFormats[2] = {GL_RGBA16F, GL_R8};
+    const GLenum formats[2] = {GL_RGBA, GL_RED};
+    const GLenum types[2] = {GL_FLOAT, GL_UNSIGNED_BYTE};
+    glGenTextures(2, targets);
+    for (int i = 0; i < 2; ++i)
+    {
+      glBindTexture(GL_TEXTURE_2D, targets[i]);
+      glTexImage2D(GL_TEXTURE_2D, 0, internalFormats[i], width, height, 0,
+                   formats[i], types[i], NULL);
+      glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+      glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+      glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+      glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+      glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0 + i,
+                             GL_TEXTURE_2D, targets[i], 0);
+    }
+    // copy of the opaque depth to test against, never written
+    glGenRenderbuffers(1, &depthStencil);
+    glBindRenderbuffer(GL_RENDERBUFFER, depthStencil);
+    glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH24_STENCIL8, width, height);
+    glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_STENCIL_ATTACHMENT,
+                              GL_RENDERBUFFER, depthStencil);
+    if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE)
+      std::cout << "ERROR::FRAMEBUFFER:: Transparency targets are not "
+                   "complete!"
+                << std::endl;
+    glBindTexture(GL_TEXTURE_2D, 0);
+    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+  }
+  void destroyTargets()
+  {
+    if (fbo == 0)
+    {
+      return;
+    }
+    glDeleteFramebuffers(1, &fbo);
+    glDeleteTextures(2, targets);
+    glDeleteRenderbuffers(1, &depthStencil);
+    fbo = 0;
+    width = height = 0;
+  }
+  Shader compositeShader;
+  Mesh quad;
+  PFNGLBLENDFUNCIPROC blendFunci;
+  unsigned int fbo = 0;
+  unsigned int targets[2] = {0, 0};
+  unsigned int depthStencil = 0;
+  int width = 0;
+  int height = 0;
+};
+// Per object light lists for shaders with uniform light arrays, such as
+// fMultiLightTexture.glsl, on GL 3.3 targets where ClusteredLights is not
+// an option. Every frame the lights go into a LightGrid; every draw then
+// gets the point and spot lights that reach its world bounds, brightest
+// first, instead of the whole list addPointLights and addSpotLights set.
+// Spot lights are cut off at their attenuation range like point lights.
+class LightSelector
+{
+public:
+  // size of pointLights and spotLights in fMultiLightTexture.glsl
+  static const size_t MAX_UNIFORM_LIGHTS = 20;
+  LightSelector(size_t maxPointLights = 8, size_t maxSpotLights = 4)
+      : maxPointLights(std::min(maxPointLights, MAX_UNIFORM_LIGHTS)),
+        maxSpotLights(std::min(maxSpotLights, MAX_UNIFORM_LIGHTS))
+  {
+  }
+  void update(Camera &camera, const std::vector<Light> &pointLights,
+              const std::vector<Light> &spotLights)
+  {
+    view = camera.calculateViewMatrix();
+    this->pointLights = pointLights;
+    this->spotLights = spotLights;
+    pointGrid.build(toGridLights(pointLights, false));
+    spotGrid.build(toGridLights(spotLights, true));
+    // uniforms set in earlier frames are stale
+    ++frame;
+  }
+  // Sets the lights reaching bounds on the program in use, unless the
+  // program already has the same ones this frame
+  void apply(Shader &shader, const BoundingBox &bounds)
+  {
+    ++stats.queries;
+    glm::vec3 boxMin = bounds.valid() ? bounds.Min : glm::vec3(-1e30f);
+    glm::vec3 boxMax = bounds.valid() ? bounds.Max : glm::vec3(1e30f);
+    pointGrid.select(boxMin, boxMax, maxPointLights, selectedPoints);
+    spotGrid.select(boxMin, boxMax, maxSpotLights, selectedSpots);
+    stats.pointLights += selectedPoints.size();
+    stats.spotLights += selectedSpots.size();
+    ProgramState &state = programs[shader.ID];
+    if (!state.located)
+    {
+      locate(shader, state);
+    }
+    if (state.frame == frame && state.points == selectedPoints &&
+        state.spots == selectedSpots)
+    {
+      ++stats.uploadsSkipped;
+      return;
+    }
+    state.frame = frame;
+    state.points = selectedPoints;
+    state.spots = selectedSpots;
+    for (size_t i = 0; i < selectedPoints.size(); ++i)
+    {
+      upload(state.pointLocations[i], pointLights[selectedPoints[i]], false);
+    }
+    for (size_t i = 0; i < selectedSpots.size(); ++i)
+    {
+      upload(state.spotLocations[i], spotLights[selectedSpots[i]], true);
+    }
+    glUniform1i(state.pointCount, (int)selectedPoints.size());
+    glUniform1i(state.spotCount, (int)selectedSpots.size());
+    ++stats.uploads;
+  }
+  struct Stats
+  {
+    size_t queries = 0;
+    // lights selected over all queries
+    size_t pointLights = 0;
+    size_t spotLights = 0;
+    size_t uploads = 0;
+    // queries whose program already had the selected lights
+    size_t uploadsSkipped = 0;
+  };
+  // counters accumulate until reset, typically once per frame
+  const Stats &getStats() const { return stats; }
+  void resetStats() { stats = Stats(); }
+  const LightGrid &getPointGrid() const { return pointGrid; }
+  const LightGrid &getSpotGrid() const { return spotGrid; }
+
+private:
+  struct LightLocations
+  {
+    int position, ambient, diffuse, specular, direction;
+    int constant, linear, quadratic, cutOff, outerCutOff;
+  };
+  struct ProgramState
+  {
+    bool located = false;
+    // frame the uniforms were set in, none yet
+    unsigned int frame = ~0u;
+    std::vector<uint32_t> points;
+    std::vector<uint32_t> spots;
+    LightLocations pointLocations[MAX_UNIFORM_LIGHTS];
+    LightLocations spotLocations[MAX_UNIFORM_LIGHTS];
+    int pointCount = -1;
+    int spotCount = -1;
+  };
+  static std::vector<GridLight> toGridLights(const std::vector<Light> &lights,
+                                             bool spot)
+  {
+    std::vector<GridLight> gridLights(lights.size());
+    for (size_t i = 0; i < lights.size(); ++i)
+    {
+      const Light &light = lights[i];
+      GridLight &gridLight = gridLights[i];
+      gridLight.position = light.Position;
+      gridLight.radius = lightRange(light);
+      gridLight.intensity = std::max(
+          {light.Ambiant.x, light.Ambiant.y, light.Ambiant.z, light.Diffuse.x,
+           light.Diffuse.y, light.Diffuse.z, light.Specular.x,
+           light.Specular.y, light.Specular.z});
+      gridLight.constant = light.Constant;
+      gridLight.linear = light.Linear;
+      gridLight.quadratic = light.Quadratic;
+      gridLight.spot = spot;
+      gridLight.direction = spot ? glm::normalize(light.Direction)
+                                 : glm::vec3(0.0f, 0.0f, -1.0f);
+      float outer = glm::radians(std::max(light.CutOff, light.OuterCutOff));
+      gridLight.cosAngle = std::cos(outer);
+      gridLight.sinAngle = std::sin(outer);
+    }
+    return gridLights;
+  }
+  // uniform locations are looked up once per program, not per draw
+  static void locate(const Shader &shader, ProgramState &state)
+  {
+    auto find = [&](const std::string &name, size_t index,
+                    const char *attribute) {
+      std::string uniform =
+          name + "[" + std::to_string(index) + "]." + attribute;
+      return glGetUniformLocation(shader.ID, uniform.c_str());
+    };
+    for (size_t i = 0; i < MAX_UNIFORM_LIGHTS; ++i)
+    {
+      for (int spot = 0; spot < 2; ++spot)
+      {
+        const std::string name = spot ? "spotLights" : "pointLights";
+        LightLocations &locations =
+            spot ? state.spotLocations[i] : state.pointLocations[i];
+        locations.position = find(name, i, "position");
+        locations.ambient = find(name, i, "ambient");
+        locations.diffuse = find(name, i, "diffuse");
+        locations.specular = find(name, i, "specular");
+        locations.direction = find(name, i, "direction");
+        locations.constant = find(name, i, "constant");
+        locations.linear = find(name, i, "linear");
+        locations.quadratic = find(name, i, "quadratic");
+        locations.cutOff = find(name, i, "cutOff");
+        locations.outerCutOff = find(name, i, "outerCutOff");
+      }
+    }
+    state.pointCount = glGetUniformLocation(shader.ID, "nbPointLight");
+    state.spotCount = glGetUniformLocation(shader.ID, "nbSpotLight");
+    state.located = true;
+  }
+  // same values as MeshRenderer::addPointLights and addSpotLights
+  void upload(const LightLocations &locations, const Light &light, bool spot)
+  {
+    glm::vec3 position = view * glm::vec4(light.Position, 1.0f);
+    glUniform3fv(locations.position, 1, glm::value_ptr(position));
+    glUniform3fv(locations.ambient, 1, glm::value_ptr(light.Ambiant));
+    glUniform3fv(locations.diffuse, 1, glm::value_ptr(light.Diffuse));
+    glUniform3fv(locations.specular, 1, glm::value_ptr(light.Specular));
+    glUniform3fv(locations.direction, 1, glm::value_ptr(light.Direction));
+    glUniform1f(locations.constant, light.Constant);
+    glUniform1f(locations.linear, light.Linear);
+    glUniform1f(locations.quadratic, light.Quadratic);
+    if (spot)
+    {
+      glUniform1f(locations.cutOff, glm::cos(glm::radians(light.CutOff)));
+      glUniform1f(locations.outerCutOff,
+                  glm::cos(glm::radians(light.OuterCutOff)));
+    }
+  }
+  size_t maxPointLights;
+  size_t maxSpotLights;
+  glm::mat4 view = glm::mat4(1.0f);
+  std::vector<Light> pointLights;
+  std::vector<Light> spotLights;
+  LightGrid pointGrid;
+  LightGrid spotGrid;
+  std::vector<uint32_t> selectedPoints;
+  std::vector<uint32_t> selectedSpots;
+  std::unordered_map<unsigned int, ProgramState> programs;
+  unsigned int frame = 0;
+  Stats stats;
+};
+// Rasterizes designated occluder meshes into an OcclusionBuffer on the job
+// system while the caller carries on, so MeshRenderer can drop meshes
+// hidden behind them. Occluders need their CPU geometry, so upload them
+// with CpuMeshData::Keep or CpuMeshData::Collision.
+class OcclusionCuller
+{
+public:
+  OcclusionCuller(JobSystem &jobs, int width = 256, int height = 128)
+      : jobs(jobs), buffer(width, height)
+  {
+  }
+  ~OcclusionCuller() { wait(); }
+  // the occluder list is kept until clearOccluders
+  void addOccluder(const Mesh &mesh, const glm::mat4 &transform)
+  {
+    wait();
+    if (mesh.Positions.empty() && mesh.Vertices.empty())
+    {
+      std::cout << "Occluder without CPU geometry ignored" << std::endl;
+      return;
+    }
+    occluders.push_back(Occluder{&mesh, transform});
+  }
+  void clearOccluders()
+  {
+    wait();
+    occluders.clear();
+  }
+  // Starts drawing the occluders as seen by camera and returns at once.
+  // Call it once the camera has moved for the frame; the tests use the
+  // matrices given here.
+  void render(Camera &camera)
+  {
+    wait();
+    viewProjection = camera.Projection * camera.calculateViewMatrix();
+    pending = jobs.submit([this]() { rasterize(); });
+  }
+  // waits for render() to finish
+  void wait()
+  {
+    if (pending.valid())
+    {
+      pending.get();
+    }
+  }
+  // Clears visible[i] for boxes given in the space transform maps to world
+  // that are hidden. Returns how many were hidden.
+  size_t cull(const glm::mat4 &transform, const BoxList &boxes,
+              uint8_t *visible)
+  {
+    wait();
+    glm::mat4 mvp = viewProjection * transform;
+    size_t tested = std::count(visible, visible + boxes.size(), 1);
+    return tested - buffer.testBoxes(glm::value_ptr(mvp), boxes, visible);
+  }
+  bool visible(const glm::mat4 &transform, const BoundingBox &bounds)
+  {
+    if (!bounds.valid())
+    {
+      return true;
+    }
+    wait();
+    glm::mat4 mvp = viewProjection * transform;
+    glm::vec3 center = bounds.center();
+    glm::vec3 extent = bounds.size() * 0.5f;
+    return buffer.boxVisible(glm::value_ptr(mvp), glm::value_ptr(center),
+                             glm::value_ptr(extent));
+  }
+  const OcclusionBuffer &getBuffer()
+  {
+    wait();
+    return buffer;
+  }
+
+private:
+  struct Occluder
+  {
+    const Mesh *mesh;
+    glm::mat4 transform;
+  };
+  void rasterize()
+  {
+    buffer.clear();
+    for (const Occluder &occluder : occluders)
+    {
+      const Mesh &mesh = *occluder.mesh;
+      glm::mat4 mvp = viewProjection * occluder.transform;
+      const float *positions;
+      size_t stride, vertexCount;
+      if (!mesh.Positions.empty())
+      {
+        positions = glm::value_ptr(mesh.Positions[0]);
+        stride = sizeof(glm::vec3);
+        vertexCount = mesh.Positions.size();
+      }
+      else
+      {
+        positions = glm::value_ptr(mesh.Vertices[0].Position);
+        stride = sizeof(Vertex);
+        vertexCount = mesh.Vertices.size();
+      }
+      // the finest level only; simplified ones may bulge past the surface
+      size_t indexCount =
+          mesh.Lods.empty() ? mesh.Indices.size() : mesh.Lods[0].indexCount;
+      indexCount = std::min(indexCount, mesh.Indices.size());
+      buffer.addOccluder(glm::value_ptr(mvp), positions, stride, vertexCount,
+                         mesh.Indices.data(), indexCount);
+    }
+    // bands of rows are independent, one job each
+    const size_t bands = jobs.threadCount() + 1;
+    const int height = buffer.height();
+    jobs.parallelFor(bands, [this, bands, height](size_t band) {
+      buffer.rasterize((int)(band * height / bands),
+                       (int)((band + 1) * height / bands));
+    });
+    buffer.buildPyramid();
+  }
+  JobSystem &jobs;
+  OcclusionBuffer buffer;
+  std::vector<Occluder> occluders;
+  glm::mat4 viewProjection = glm::mat4(1.0f);
+  std::future<void> pending;
+};
+// glad only loads GL 3.3; multi draw indirect is fetched at run time
+#ifndef GL_VERSION_4_3
+#define GL_DRAW_INDIRECT_BUFFER 0x8F3F
+typedef void(APIENTRYP PFNGLMULTIDRAWELEMENTSINDIRECTPROC)(
+    GLenum mode, GLenum type, const void *indirect, GLsizei drawcount,
+    GLsizei stride);
+#endif
+// Record layout glMultiDrawElementsIndirect reads
+struct DrawElementsIndirectCommand
+{
+  GLuint count;
+  GLuint instanceCount;
+  GLuint firstIndex;
+  GLint baseVertex;
+  GLuint baseInstance;
+};
+// Null unless the current context is GL 4.3 or later
+inline PFNGLMULTIDRAWELEMENTSINDIRECTPROC loadMultiDrawElementsIndirect()
+{
+  if (GLVersion.major < 4 || (GLVersion.major == 4 && GLVersion.minor < 3))
+  {
+    return nullptr;
+  }
+  return (PFNGLMULTIDRAWELEMENTSINDIRECTPROC)glfwGetProcAddress(
+      "glMultiDrawElementsIndirect");
+}
+class MeshRenderer
+{
+public:
+  MeshRenderer() {}
+  MeshRenderer(GpuResidency &residency) : residency(&residency) {}
+  void addSpotLights(Shader &shader, const std::vector<Light> &lights,
+                     Camera &camera)
+  {
+    shader.use();
+    int nbSpotLight = 0;
+    std::string uniformName("spotLights");
+    for (auto light : lights)
+    {
+      addLight(shader, light, camera, uniformName, nbSpotLight);
+      shader.setFloat(getUniformName(uniformName, "quadratic", nbSpotLight),
+                      light.Quadratic);
+      shader.setFloat(getUniformName(uniformName, "cutOff", nbSpotLight),
+                      glm::cos(glm::radians(light.CutOff)));
+      shader.setFloat(getUniformName(uniformName, "outerCutOff", nbSpotLight),
+                      glm::cos(glm::radians(light.OuterCutOff)));
+      ++nbSpotLight;
+    }
+
+    shader.setInt("nbSpotLight", nbSpotLight);
+  }
+  void addPointLights(Shader &shader, const std::vector<Light> &lights,
+                      Camera &camera)
+  {
+    shader.use();
+    int nbPointLight = 0;
+    std::string uniformName("pointLights");
+    for (auto light : lights)
+    {
+      addLight(shader, light, camera, uniformName, nbPointLight);
+      shader.setFloat(getUniformName(uniformName, "constant", nbPointLight),
+                      light.Constant);
+      shader.setFloat(getUniformName(uniformName, "linear", nbPointLight),
+                      light.Linear);
+      shader.setFloat(getUniformName(uniformName, "quadratic", nbPointLight),
+                      light.Quadratic);
+      ++nbPointLight;
+    }
+
+    shader.setInt("nbPointLight", nbPointLight);
+  }
+  void useLight(Shader &shader, const Light &light, Camera &camera)
+  {
+    shader.use();
     glm::vec3 position =
         camera.calculateViewMatrix() * glm::vec4(light.Position, 1.0f);
 
@@ -1077,27 +4808,336 @@ public:
     glBindTexture(GL_TEXTURE_CUBE_MAP, texture.id);
 
     glBindVertexArray(mesh.Id);
-    glDrawArrays(GL_TRIANGLES, 0, mesh.Vertices.size());
+    glDrawArrays(GL_TRIANGLES, (GLint)mesh.BaseVertex, mesh.VertexCount);
     glBindVertexArray(0);
     glDepthFunc(GL_LESS);
   }
-  void render(Camera &camera, Model &model, Shader &shader,
-              ResourceManager &resourceManager, glm::mat4 transform)
+  // meshes outside the view frustum are skipped before any GL call
+  void render(Camera &camera, Model &model, Shader &shader,
+              ResourceManager &resourceManager, glm::mat4 transform)
+  {
+    cullMeshes(camera, model, transform);
+    for (size_t i = 0; i < model.meshes.size(); ++i)
+    {
+      // not uploaded yet when the model is streaming
+      if (!meshVisible[i] || model.meshes[i].Id == 0)
+      {
+        continue;
+      }
+      const Mesh &mesh = model.meshes[i];
+      const Material &mat = resourceManager.getMaterial(mesh.MaterialID);
+      render(camera, mesh, shader, mat, transform * model.meshTransform(i));
+    }
+  }
+  // Fills meshVisible with the meshes touching the view frustum
+  void cullMeshes(Camera &camera, Model &model, const glm::mat4 &transform)
+  {
+    // boxes stay in model space, the planes are moved there instead
+    Frustum frustum(camera.Projection * camera.calculateViewMatrix() *
+                    transform);
+    model.nodes.update();
+    meshBoxes.clear();
+    for (size_t i = 0; i < model.meshes.size(); ++i)
+    {
+      BoundingBox bounds =
+          model.meshes[i].Bounds.transformed(model.meshTransform(i));
+      if (bounds.valid())
+      {
+        meshBoxes.add(glm::value_ptr(bounds.Min), glm::value_ptr(bounds.Max));
+      }
+      else
+      {
+        // no bounds, never culled
+        const float lo[3] = {-1e30f, -1e30f, -1e30f};
+        const float hi[3] = {1e30f, 1e30f, 1e30f};
+        meshBoxes.add(lo, hi);
+      }
+    }
+    meshVisible.resize(model.meshes.size());
+    size_t visible = cullBoxes(frustum.planes, meshBoxes, meshVisible.data());
+    cullingStats.meshes += model.meshes.size();
+    cullingStats.meshesCulled += model.meshes.size() - visible;
+    if (occlusion)
+    {
+      cullingStats.meshesOccluded +=
+          occlusion->cull(transform, meshBoxes, meshVisible.data());
+    }
+  }
+  // draws a checker box covering the model bounds until it is ready
+  void render(Camera &camera, AsyncModel &model, Shader &shader,
+              ResourceManager &resourceManager, glm::mat4 transform)
+  {
+    if (model.ready())
+    {
+      render(camera, model.model, shader, resourceManager, transform);
+      return;
+    }
+    if (model.state == LoadState::Streaming)
+    {
+      updateScreenSize(camera, model, transform);
+      render(camera, model.model, shader, resourceManager, transform);
+      return;
+    }
+    if (model.state != LoadState::Pending)
+    {
+      return;
+    }
+    render(camera, resourceManager.getPlaceholderMesh(), shader,
+           getPlaceholder(resourceManager), placeholderBox(model, transform));
+  }
+  void render(Camera &camera, const Mesh &mesh, Shader &shader,
+              const Material &mat, glm::mat4 transform)
+  {
+    shader.use();
+    bindMaterial(shader, mat);
+    setCameraUniforms(camera, shader);
+    if (lightSelector)
+    {
+      lightSelector->apply(shader, mesh.Bounds.transformed(transform));
+    }
+    glBindVertexArray(mesh.Id);
+    drawMesh(camera, mesh, shader, transform);
+  }
+  // Queues a draw for flush(); nothing is sent to GL yet
+  void submit(RenderQueue &queue, Camera &camera, const Mesh &mesh,
+              Shader &shader, const Material &mat, glm::mat4 transform,
+              uint8_t pass = 0, bool translucent = false)
+  {
+    if (occlusion && !occlusion->visible(transform, mesh.Bounds))
+    {
+      ++cullingStats.meshesOccluded;
+      return;
+    }
+    addPacket(queue, camera, mesh, shader, mat, transform, pass, translucent);
+  }
+  // Queues the meshes of a model that pass frustum culling
+  void submit(RenderQueue &queue, Camera &camera, Model &model, Shader &shader,
+              ResourceManager &resourceManager, glm::mat4 transform,
+              uint8_t pass = 0, bool translucent = false)
+  {
+    cullMeshes(camera, model, transform);
+    for (size_t i = 0; i < model.meshes.size(); ++i)
+    {
+      if (!meshVisible[i] || model.meshes[i].Id == 0)
+      {
+        continue;
+      }
+      const Mesh &mesh = model.meshes[i];
+      addPacket(queue, camera, mesh, shader,
+                resourceManager.getMaterial(mesh.MaterialID),
+                transform * model.meshTransform(i), pass, translucent);
+    }
+  }
+  // Same as render(AsyncModel) but queued
+  void submit(RenderQueue &queue, Camera &camera, AsyncModel &model,
+              Shader &shader, ResourceManager &resourceManager,
+              glm::mat4 transform, uint8_t pass = 0, bool translucent = false)
+  {
+    if (model.state == LoadState::Streaming)
+    {
+      updateScreenSize(camera, model, transform);
+    }
+    if (model.ready() || model.state == LoadState::Streaming)
+    {
+      submit(queue, camera, model.model, shader, resourceManager, transform,
+             pass, translucent);
+    }
+    else if (model.state == LoadState::Pending)
+    {
+      submit(queue, camera, resourceManager.getPlaceholderMesh(), shader,
+             getPlaceholder(resourceManager), placeholderBox(model, transform),
+             pass, translucent);
+    }
+  }
+  // Draws the queue sorted by state and depth, changing the program,
+  // material and vertex array only when the next draw needs another one.
+  // Opaque draws of one mesh, detail level and material whose shader has
+  // an instanced variant are merged into one instanced draw; translucent
+  // ones only when they are next to each other back to front. Translucent
+  // draws blend with GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA and leave depth
+  // alone; the depth and blend enables are restored, the blend function
+  // is not.
+  void flush(Camera &camera, RenderQueue &queue)
+  {
+    const auto &packets = queue.getPackets();
+    const auto &order = queue.sort();
+    queueStats.unsorted += countStateChanges(packets, nullptr);
+    buildBatches(camera, packets, order);
+    if (!instanceTransforms.empty())
+    {
+      if (instanceBuffer == 0)
+      {
+        glGenBuffers(1, &instanceBuffer);
+      }
+      glBindBuffer(GL_ARRAY_BUFFER, instanceBuffer);
+      glBufferData(GL_ARRAY_BUFFER,
+                   instanceTransforms.size() * sizeof(glm::mat4),
+                   instanceTransforms.data(), GL_STREAM_DRAW);
+    }
+    if (multiDrawElementsIndirect)
+    {
+      buildIndirectCommands(camera, packets);
+    }
+    glGetIntegerv(GL_DEPTH_FUNC, &litDepthFunc);
+    glGetBooleanv(GL_DEPTH_WRITEMASK, &litDepthMask);
+    litBlend = glIsEnabled(GL_BLEND);
+    if (depthShader)
+    {
+      // the lit pass culls the same meshlets again, count them once
+      CullingStats counted = cullingStats;
+      glColorMask(GL_FALSE, GL_FALSE, GL_FALSE, GL_FALSE);
+      glDepthMask(GL_TRUE);
+      drawBatches(camera, packets, true);
+      glColorMask(GL_TRUE, GL_TRUE, GL_TRUE, GL_TRUE);
+      cullingStats = counted;
+    }
+    if (overdrawCounting)
+    {
+      glEnable(GL_STENCIL_TEST);
+      glStencilMask(0xFF);
+      glStencilFunc(GL_ALWAYS, 0, 0xFF);
+      glStencilOp(GL_KEEP, GL_KEEP, GL_INCR);
+    }
+    drawBatches(camera, packets, false);
+    if (overdrawCounting)
+    {
+      glDisable(GL_STENCIL_TEST);
+    }
+    glDepthFunc(litDepthFunc);
+    glDepthMask(litDepthMask);
+    if (!litBlend)
+    {
+      glDisable(GL_BLEND);
+    }
+    queue.clear();
+  }
+  // Shader flush() draws instanced batches of shader with. It reads the
+  // model matrix from attributes 3 to 6 (one column each) instead of the
+  // model uniform, see vLightInstanced.glsl.
+  void setInstancedShader(const Shader &shader, Shader &instanced)
+  {
+    instancedShaders[shader.ID] = &instanced;
+  }
+  // Shader the indirect calls of shader use in place of its instanced
+  // variant while multi draw indirect is on. Besides the model matrix it
+  // reads at attribute 7 the slot of the draw's material in the materials
+  // uniform array of MAX_DRAW_MATERIALS entries, see vLightMultiDraw.glsl,
+  // so draws of different materials share a call.
+  void setMultiDrawShader(const Shader &shader, Shader &multiDraw)
+  {
+    multiDrawShaders[shader.ID] = &multiDraw;
+  }
+  // size of the materials array of setMultiDrawShader programs
+  static constexpr uint32_t MAX_DRAW_MATERIALS = 8;
+  // Before the lit pass, flush() draws the opaque batches with depthShader
+  // (instanced ones with depthShaderInstanced) writing depth and no color,
+  // from the packed positions of meshes uploaded with
+  // Renderer::setPositionStreams. The lit pass then tests with depthFunc
+  // and leaves depth alone, so every pixel runs the lighting shader once.
+  // GL_EQUAL is only safe when both programs compute gl_Position the same
+  // way, see vDepthPrepass.glsl. Instanced batches without a depth variant
+  // and translucent ones skip the pre-pass. Null turns it off.
+  void setDepthPrepass(Shader *depthShader,
+                       Shader *depthShaderInstanced = nullptr,
+                       GLenum depthFunc = GL_LEQUAL)
+  {
+    this->depthShader = depthShader;
+    this->depthShaderInstanced = depthShaderInstanced;
+    prepassDepthFunc = depthFunc;
+  }
+  // Counts in the stencil buffer of the bound framebuffer the fragments
+  // every pixel shades in flush()'s lit pass, saturating at 255. Clear the
+  // stencil to 0 before the frame and read it back with readOverdraw().
+  // Overrides the stencil state, so not for scenes that use the stencil.
+  void setOverdrawCounting(bool enabled) { overdrawCounting = enabled; }
+  struct OverdrawStats
+  {
+    size_t pixels = 0;
+    // pixels shaded at least once
+    size_t coveredPixels = 0;
+    size_t fragments = 0;
+    size_t maxFragments = 0;
+    // shaded fragments per covered pixel, 1 without overdraw
+    double overdraw() const
+    {
+      return coveredPixels ? (double)fragments / coveredPixels : 0.0;
+    }
+  };
+  OverdrawStats readOverdraw(int width, int height)
+  {
+    stencilCounts.resize((size_t)width * height);
+    glPixelStorei(GL_PACK_ALIGNMENT, 1);
+    glReadPixels(0, 0, width, height, GL_STENCIL_INDEX, GL_UNSIGNED_BYTE,
+                 stencilCounts.data());
+    glPixelStorei(GL_PACK_ALIGNMENT, 4);
+    OverdrawStats stats;
+    stats.pixels = stencilCounts.size();
+    for (uint8_t count : stencilCounts)
+    {
+      stats.coveredPixels += count > 0;
+      stats.fragments += count;
+      stats.maxFragments = std::max<size_t>(stats.maxFragments, count);
+    }
+    return stats;
+  }
+  // On GL 4.3 contexts flush() writes every indexed draw of a program with
+  // an instanced variant as an indirect command, single draws included, and
+  // submits each run sharing program, pass, blending, pre-pass, vertex
+  // array and material with one glMultiDrawElementsIndirect. Programs with
+  // a setMultiDrawShader variant also join up to MAX_DRAW_MATERIALS
+  // materials, and meshes uploaded with Renderer::setSharedBuffers share a
+  // vertex array, so a pass then goes out in one call per program. Cluster
+  // culled meshes add a command per visible range. Returns false, keeping
+  // the per batch draws, on GL 3.3.
+  bool setMultiDrawIndirect(bool enabled)
   {
-    for (auto &mesh : model.meshes)
+    multiDrawElementsIndirect =
+        enabled ? loadMultiDrawElementsIndirect() : nullptr;
+    if (enabled && !multiDrawElementsIndirect)
     {
-      Material mat = resourceManager.getMaterial(mesh.MaterialID);
-      render(camera, mesh, shader, mat, transform);
+      std::cout << "Multi draw indirect needs OpenGL 4.3, drawing batches "
+                   "one at a time"
+                << std::endl;
     }
+    return multiDrawElementsIndirect != nullptr;
   }
-  void render(Camera &camera, const Mesh &mesh, Shader &shader, Material &mat,
-              glm::mat4 transform)
+  struct StateChanges
+  {
+    size_t draws = 0;
+    size_t programs = 0;
+    size_t textures = 0;
+    size_t vertexArrays = 0;
+    StateChanges &operator+=(const StateChanges &other)
+    {
+      draws += other.draws;
+      programs += other.programs;
+      textures += other.textures;
+      vertexArrays += other.vertexArrays;
+      return *this;
+    }
+  };
+  // Draw calls and program, texture and vertex array switches flush()
+  // would have made one packet at a time in submission order, and made
+  // sorted and instanced; summed since the last reset
+  struct QueueStats
+  {
+    StateChanges unsorted;
+    StateChanges sorted;
+    // packets drawn by instanced draw calls
+    size_t instances = 0;
+    // commands submitted with multi draw indirect
+    size_t indirectCommands = 0;
+    // draws and switches of the depth pre-pass, not included in sorted
+    StateChanges depthPrepass;
+  };
+  const QueueStats &getQueueStats() const { return queueStats; }
+  void resetQueueStats() { queueStats = QueueStats(); }
+  void bindMaterial(Shader &shader, const Material &mat)
   {
-    shader.use();
     unsigned int diffuseNr = 1;
     unsigned int specularNr = 1;
     unsigned int i = 0;
-    for (auto text : mat.textures)
+    for (const auto &text : mat.textures)
     {
       glActiveTexture(GL_TEXTURE0 + i);
       int uniformLocation;
@@ -1117,13 +5157,18 @@ public:
         break;
       }
       glUniform1i(uniformLocation, i);
+      if (residency)
+      {
+        residency->touch(text.id);
+      }
       glBindTexture(GL_TEXTURE_2D, text.id);
       ++i;
     }
     int shininess = glGetUniformLocation(shader.ID, "material.shininess");
     glUniform1f(shininess, mat.shininess);
-
-    // coordinate system
+  }
+  void setCameraUniforms(Camera &camera, Shader &shader)
+  {
     int viewPos = glGetUniformLocation(shader.ID, "viewPos");
     glUniform3fv(viewPos, 1, glm::value_ptr(camera.Position));
 
@@ -1134,28 +5179,902 @@ public:
     int projectionLoc = glGetUniformLocation(shader.ID, "projection");
     glUniformMatrix4fv(projectionLoc, 1, GL_FALSE,
                        glm::value_ptr(camera.Projection));
-
+  }
+  // expects the program in use and the mesh's vertex array bound
+  void drawMesh(Camera &camera, const Mesh &mesh, Shader &shader,
+                const glm::mat4 &transform)
+  {
     int modelLoc = glGetUniformLocation(shader.ID, "model");
     glUniformMatrix4fv(modelLoc, 1, GL_FALSE, glm::value_ptr(transform));
 
-    glBindVertexArray(mesh.Id);
-    if (mesh.Indices.size() > 0)
+    size_t lodIndex = mesh.Lods.empty() ? 0 : selectLod(camera, mesh, transform);
+    if (clusterCulling && lodIndex == 0 && !mesh.Meshlets.empty())
+    {
+      drawMeshlets(camera, mesh, transform);
+    }
+    else if (!mesh.Lods.empty())
+    {
+      const MeshLod &lod = mesh.Lods[lodIndex];
+      glDrawElementsBaseVertex(GL_TRIANGLES, (int)lod.indexCount,
+                               GL_UNSIGNED_INT,
+                               elementOffset(mesh, lod.indexOffset),
+                               (GLint)mesh.BaseVertex);
+    }
+    else if (mesh.IndexCount > 0)
     {
-      glDrawElements(GL_TRIANGLES, (int)mesh.Indices.size(), GL_UNSIGNED_INT,
-                     0);
+      glDrawElementsBaseVertex(GL_TRIANGLES, (int)mesh.IndexCount,
+                               GL_UNSIGNED_INT, elementOffset(mesh),
+                               (GLint)mesh.BaseVertex);
     }
     else
     {
-      glDrawArrays(GL_TRIANGLES, 0, (int)mesh.Vertices.size());
+      glDrawArrays(GL_TRIANGLES, (GLint)mesh.BaseVertex, (int)mesh.VertexCount);
     }
   }
-  void render(Camera &camera, const Mesh &mesh, Material &mat,
+  void render(Camera &camera, const Mesh &mesh, const Material &mat,
               glm::mat4 transform)
   {
     render(camera, mesh, *mat.shader, mat, transform);
   }
+  // Draws only the meshlets facing the camera and inside the frustum.
+  // Back facing clusters are dropped, so only enable it for closed meshes
+  // drawn with back face culling semantics.
+  void setClusterCulling(bool enabled) { clusterCulling = enabled; }
+  // Meshes and models submitted to a queue are also tested against the
+  // occluders; null turns it off. Render the culler before submitting.
+  void setOcclusionCuller(OcclusionCuller *culler) { occlusion = culler; }
+  // Every draw sets on its program the lights the selector finds for its
+  // world bounds; null turns it off. An instanced draw gets the lights of
+  // all its instances' bounds together, so where lights are dense leave
+  // out the instanced variant. Update the selector before drawing.
+  void setLightSelector(LightSelector *selector) { lightSelector = selector; }
+  struct CullingStats
+  {
+    size_t meshes = 0;
+    size_t meshesCulled = 0;
+    // meshes inside the frustum but behind the occluders
+    size_t meshesOccluded = 0;
+    size_t meshlets = 0;
+    size_t meshletsCulled = 0;
+    size_t triangles = 0;
+    size_t backfaceTrianglesCulled = 0;
+    size_t frustumTrianglesCulled = 0;
+    size_t drawRanges = 0;
+  };
+  // counters accumulate until reset, typically once per frame
+  const CullingStats &getCullingStats() const { return cullingStats; }
+  void resetCullingStats() { cullingStats = CullingStats(); }
+  // LODs are switched once their error covers more than pixelError pixels on
+  // a viewport viewportHeight pixels high
+  void setLodSelection(float pixelError, float viewportHeight)
+  {
+    lodPixelError = pixelError;
+    lodViewportHeight = viewportHeight;
+  }
+  // radius over distance of every mesh in view, 0 for the others
+  void updateScreenSize(Camera &camera, AsyncModel &model,
+                        const glm::mat4 &transform)
+  {
+    Frustum frustum = camera.frustum();
+    model.model.nodes.update();
+    for (size_t i = 0; i < model.model.meshes.size(); ++i)
+    {
+      const BoundingSphere &sphere = model.model.meshes[i].Sphere;
+      glm::mat4 world = transform * model.model.meshTransform(i);
+      float scale = std::max(glm::length(glm::vec3(world[0])),
+                             std::max(glm::length(glm::vec3(world[1])),
+                                      glm::length(glm::vec3(world[2]))));
+      glm::vec3 center = world * glm::vec4(sphere.center, 1.0f);
+      float radius = sphere.radius * scale;
+      if (!sphere.valid() || !frustum.intersectsSphere(center, radius))
+      {
+        model.screenSize[i] = 0.0f;
+        continue;
+      }
+      float distance = glm::length(center - camera.Position);
+      model.screenSize[i] = distance > radius ? radius / distance : 1.0f;
+    }
+  }
+  // coarsest level whose error projects to at most lodPixelError pixels
+  size_t selectLod(const Camera &camera, const Mesh &mesh,
+                   const glm::mat4 &transform) const
+  {
+    if (mesh.Lods.size() < 2 || !mesh.Sphere.valid())
+    {
+      return 0;
+    }
+    float scale = std::max(glm::length(glm::vec3(transform[0])),
+                           std::max(glm::length(glm::vec3(transform[1])),
+                                    glm::length(glm::vec3(transform[2]))));
+    glm::vec3 center = transform * glm::vec4(mesh.Sphere.center, 1.0f);
+    float radius = mesh.Sphere.radius * scale;
+    float distance =
+        std::max(glm::length(center - camera.Position) - radius, 0.0001f);
+    // Projection[1][1] is 1 / tan(fovy / 2)
+    float pixelsPerUnit =
+        camera.Projection[1][1] * lodViewportHeight * 0.5f / distance;
+    for (size_t i = mesh.Lods.size() - 1; i > 0; --i)
+    {
+      if (mesh.Lods[i].error * scale * pixelsPerUnit <= lodPixelError)
+      {
+        return i;
+      }
+    }
+    return 0;
+  }
 
 private:
+  GpuResidency *residency = nullptr;
+  Material placeholder;
+  QueueStats queueStats;
+  float lodPixelError = 1.0f;
+  float lodViewportHeight = 600.0f;
+  bool clusterCulling = false;
+  OcclusionCuller *occlusion = nullptr;
+  CullingStats cullingStats;
+  BoxList meshBoxes;
+  std::vector<uint8_t> meshVisible;
+  std::vector<GLsizei> drawCounts;
+  std::vector<const void *> drawOffsets;
+  std::vector<GLint> drawBaseVertices;
+  const Material &getPlaceholder(ResourceManager &resourceManager)
+  {
+    if (placeholder.textures.empty())
+    {
+      placeholder.textures.push_back(resourceManager.getPlaceholderTexture());
+    }
+    return placeholder;
+  }
+  void addPacket(RenderQueue &queue, Camera &camera, const Mesh &mesh,
+                 Shader &shader, const Material &mat,
+                 const glm::mat4 &transform, uint8_t pass, bool translucent)
+  {
+    glm::vec3 center =
+        mesh.Sphere.valid() ? mesh.Sphere.center : glm::vec3(0.0f);
+    float depth = glm::dot(glm::vec3(transform * glm::vec4(center, 1.0f)) -
+                               camera.Position,
+                           camera.Front);
+    queue.add(RenderQueue::Packet{&mesh, &mat, &shader, transform, depth, pass,
+                                  translucent});
+  }
+  static glm::mat4 placeholderBox(const AsyncModel &model,
+                                  const glm::mat4 &transform)
+  {
+    glm::mat4 box = glm::translate(transform, model.bounds.center());
+    return glm::scale(box, model.bounds.size());
+  }
+  // State changes of drawing the packets in order, or in submission order
+  // when order is null. Textures count per unit, like the binds flush makes.
+  static StateChanges
+  countStateChanges(const std::vector<RenderQueue::Packet> &packets,
+                    const std::vector<SortItem> *order)
+  {
+    StateChanges changes;
+    unsigned int program = 0;
+    unsigned int vertexArray = 0;
+    std::vector<unsigned int> textures;
+    for (size_t i = 0; i < packets.size(); ++i)
+    {
+      const RenderQueue::Packet &packet =
+          packets[order ? (*order)[i].index : i];
+      ++changes.draws;
+      if (packet.shader->ID != program)
+      {
+        program = packet.shader->ID;
+        ++changes.programs;
+      }
+      if (packet.mesh->Id != vertexArray)
+      {
+        vertexArray = packet.mesh->Id;
+        ++changes.vertexArrays;
+      }
+      changes.textures += countTextureChanges(*packet.material, textures);
+    }
+    return changes;
+  }
+  // units whose texture differs from bound, which is updated
+  static size_t countTextureChanges(const Material &material,
+                                    std::vector<unsigned int> &bound)
+  {
+    const auto &textures = material.textures;
+    if (bound.size() < textures.size())
+    {
+      bound.resize(textures.size(), 0);
+    }
+    size_t changes = 0;
+    for (size_t unit = 0; unit < textures.size(); ++unit)
+    {
+      if (bound[unit] != textures[unit].id)
+      {
+        bound[unit] = textures[unit].id;
+        ++changes;
+      }
+    }
+    return changes;
+  }
+  // One draw call of flush(): a single packet, or instanceCount packets
+  // whose transforms are at instanceOffset in instanceTransforms. Batches
+  // with commands are drawn from indirectCommands instead, callBatches of
+  // them in one call. A call of a program from setMultiDrawShader binds the
+  // materialCount materials at materialOffset in callMaterials.
+  struct DrawBatch
+  {
+    Shader *shader;
+    uint32_t packet;
+    uint32_t lod;
+    uint32_t instanceOffset;
+    uint32_t instanceCount;
+    uint32_t commandOffset;
+    uint32_t commandCount;
+    uint32_t callBatches = 1;
+    uint32_t materialOffset = 0;
+    uint32_t materialCount = 0;
+  };
+  struct InstanceGroup
+  {
+    uint32_t batch;
+    uint32_t count;
+  };
+  std::unordered_map<unsigned int, Shader *> instancedShaders;
+  std::unordered_map<unsigned int, Shader *> multiDrawShaders;
+  std::vector<DrawBatch> batches;
+  std::vector<glm::mat4> instanceTransforms;
+  // per instance index into its call's materials, and the materials
+  std::vector<uint32_t> instanceMaterials;
+  std::vector<const Material *> callMaterials;
+  unsigned int materialBuffer = 0;
+  std::map<std::pair<const Mesh *, uint32_t>, InstanceGroup> instanceGroups;
+  std::vector<uint32_t> packetLods;
+  std::vector<unsigned int> boundTextures;
+  unsigned int instanceBuffer = 0;
+  std::vector<DrawElementsIndirectCommand> indirectCommands;
+  unsigned int indirectBuffer = 0;
+  PFNGLMULTIDRAWELEMENTSINDIRECTPROC multiDrawElementsIndirect = nullptr;
+  LightSelector *lightSelector = nullptr;
+  Shader *depthShader = nullptr;
+  Shader *depthShaderInstanced = nullptr;
+  GLenum prepassDepthFunc = GL_LEQUAL;
+  // depth and blend state flush() found, for opaque batches without a
+  // pre-pass
+  GLint litDepthFunc = GL_LESS;
+  GLboolean litDepthMask = GL_TRUE;
+  GLboolean litBlend = GL_FALSE;
+  bool overdrawCounting = false;
+  std::vector<uint8_t> stencilCounts;
+  static bool sameState(const RenderQueue::Packet &a,
+                        const RenderQueue::Packet &b)
+  {
+    return a.shader->ID == b.shader->ID && a.material == b.material &&
+           a.pass == b.pass && a.translucent == b.translucent;
+  }
+  // Turns the sorted packets into draw calls. Runs of packets sharing
+  // program and material are grouped by mesh and detail level; groups of
+  // two or more become one instanced batch when the program has a variant.
+  void buildBatches(Camera &camera,
+                    const std::vector<RenderQueue::Packet> &packets,
+                    const std::vector<SortItem> &order)
+  {
+    batches.clear();
+    instanceTransforms.clear();
+    size_t runStart = 0;
+    while (runStart < order.size())
+    {
+      const RenderQueue::Packet &first = packets[order[runStart].index];
+      size_t runEnd = runStart + 1;
+      while (runEnd < order.size() &&
+             sameState(packets[order[runEnd].index], first))
+      {
+        ++runEnd;
+      }
+      auto variant = instancedShaders.find(first.shader->ID);
+      // indirect commands take their transform from the instance buffer,
+      // so with multi draw every packet becomes an instance
+      const uint32_t minInstances = multiDrawElementsIndirect ? 1 : 2;
+      if (variant == instancedShaders.end() ||
+          runEnd - runStart < minInstances)
+      {
+        for (size_t i = runStart; i < runEnd; ++i)
+        {
+          batches.push_back(DrawBatch{packets[order[i].index].shader,
+                                      order[i].index, 0, 0, 0, 0, 0});
+        }
+        runStart = runEnd;
+        continue;
+      }
+      Shader *instanced = variant->second;
+      auto multiDraw = multiDrawShaders.find(first.shader->ID);
+      if (multiDrawElementsIndirect && multiDraw != multiDrawShaders.end())
+      {
+        instanced = multiDraw->second;
+      }
+      if (first.translucent)
+      {
+        addTranslucentBatches(camera, packets, order, runStart, runEnd,
+                              instanced, minInstances);
+        runStart = runEnd;
+        continue;
+      }
+      instanceGroups.clear();
+      packetLods.resize(runEnd - runStart);
+      for (size_t i = runStart; i < runEnd; ++i)
+      {
+        const RenderQueue::Packet &packet = packets[order[i].index];
+        uint32_t lod = packet.mesh->Lods.empty()
+                           ? 0
+                           : (uint32_t)selectLod(camera, *packet.mesh,
+                                                 packet.transform);
+        packetLods[i - runStart] = lod;
+        ++instanceGroups[std::make_pair(packet.mesh, lod)].count;
+      }
+      for (auto &entry : instanceGroups)
+      {
+        InstanceGroup &group = entry.second;
+        if (group.count < minInstances)
+        {
+          continue;
+        }
+        group.batch = (uint32_t)batches.size();
+        batches.push_back(DrawBatch{instanced, 0, entry.first.second,
+                                    (uint32_t)instanceTransforms.size(), 0,
+                                    0, 0});
+        instanceTransforms.resize(instanceTransforms.size() + group.count);
+      }
+      for (size_t i = runStart; i < runEnd; ++i)
+      {
+        const RenderQueue::Packet &packet = packets[order[i].index];
+        const InstanceGroup &group = instanceGroups[std::make_pair(
+            packet.mesh, packetLods[i - runStart])];
+        if (group.count < minInstances)
+        {
+          batches.push_back(
+              DrawBatch{packet.shader, order[i].index, 0, 0, 0, 0, 0});
+          continue;
+        }
+        DrawBatch &batch = batches[group.batch];
+        batch.packet = order[i].index;
+        instanceTransforms[batch.instanceOffset + batch.instanceCount++] =
+            packet.transform;
+      }
+      runStart = runEnd;
+    }
+  }
+  // Translucent runs must keep their back to front order, so only
+  // neighbouring packets of one mesh and detail level share a draw
+  void addTranslucentBatches(Camera &camera,
+                             const std::vector<RenderQueue::Packet> &packets,
+                             const std::vector<SortItem> &order,
+                             size_t runStart, size_t runEnd,
+                             Shader *instanced, uint32_t minInstances)
+  {
+    size_t start = runStart;
+    while (start < runEnd)
+    {
+      const RenderQueue::Packet &first = packets[order[start].index];
+      uint32_t lod =
+          first.mesh->Lods.empty()
+              ? 0
+              : (uint32_t)selectLod(camera, *first.mesh, first.transform);
+      size_t end = start + 1;
+      while (end < runEnd)
+      {
+        const RenderQueue::Packet &packet = packets[order[end].index];
+        if (packet.mesh != first.mesh ||
+            (!packet.mesh->Lods.empty() &&
+             selectLod(camera, *packet.mesh, packet.transform) != lod))
+        {
+          break;
+        }
+        ++end;
+      }
+      if (end - start < minInstances)
+      {
+        for (size_t i = start; i < end; ++i)
+        {
+          batches.push_back(DrawBatch{packets[order[i].index].shader,
+                                      order[i].index, 0, 0, 0, 0, 0});
+        }
+        start = end;
+        continue;
+      }
+      batches.push_back(DrawBatch{instanced, order[end - 1].index, lod,
+                                  (uint32_t)instanceTransforms.size(),
+                                  (uint32_t)(end - start), 0, 0});
+      for (size_t i = start; i < end; ++i)
+      {
+        instanceTransforms.push_back(packets[order[i].index].transform);
+      }
+      start = end;
+    }
+  }
+  // model matrix attributes of the bound vertex array, starting at the
+  // transform of instance first
+  void bindInstanceAttributes(uint32_t first)
+  {
+    glBindBuffer(GL_ARRAY_BUFFER, instanceBuffer);
+    for (unsigned int column = 0; column < 4; ++column)
+    {
+      glEnableVertexAttribArray(3 + column);
+      glVertexAttribPointer(3 + column, 4, GL_FLOAT, GL_FALSE,
+                            sizeof(glm::mat4),
+                            (void *)(first * sizeof(glm::mat4) +
+                                     column * sizeof(glm::vec4)));
+      glVertexAttribDivisor(3 + column, 1);
+    }
+    if (multiDrawElementsIndirect && materialBuffer != 0)
+    {
+      glBindBuffer(GL_ARRAY_BUFFER, materialBuffer);
+      glEnableVertexAttribArray(7);
+      glVertexAttribIPointer(7, 1, GL_UNSIGNED_INT, sizeof(uint32_t),
+                             (void *)(first * sizeof(uint32_t)));
+      glVertexAttribDivisor(7, 1);
+    }
+  }
+  // Writes the indirect commands of every instanced batch of an indexed
+  // mesh and uploads them in one buffer, then groups the batches into
+  // calls and gives every instance of a material table program its slot
+  void buildIndirectCommands(Camera &camera,
+                             const std::vector<RenderQueue::Packet> &packets)
+  {
+    indirectCommands.clear();
+    for (DrawBatch &batch : batches)
+    {
+      const Mesh &mesh = *packets[batch.packet].mesh;
+      batch.commandOffset = (uint32_t)indirectCommands.size();
+      if (batch.instanceCount == 0 ||
+          (mesh.Lods.empty() && mesh.IndexCount == 0))
+      {
+        batch.commandCount = 0;
+        continue;
+      }
+      if (clusterCulling && batch.instanceCount == 1 && batch.lod == 0 &&
+          !mesh.Meshlets.empty())
+      {
+        cullMeshlets(camera, mesh, instanceTransforms[batch.instanceOffset]);
+        for (size_t range = 0; range < drawCounts.size(); ++range)
+        {
+          indirectCommands.push_back(DrawElementsIndirectCommand{
+              (GLuint)drawCounts[range], 1,
+              (GLuint)((uintptr_t)drawOffsets[range] / sizeof(unsigned int)),
+              (GLint)mesh.BaseVertex, batch.instanceOffset});
+        }
+      }
+      else
+      {
+        GLuint first = mesh.FirstIndex;
+        GLuint count = mesh.IndexCount;
+        if (!mesh.Lods.empty())
+        {
+          first += mesh.Lods[batch.lod].indexOffset;
+          count = mesh.Lods[batch.lod].indexCount;
+        }
+        indirectCommands.push_back(DrawElementsIndirectCommand{
+            count, batch.instanceCount, first, (GLint)mesh.BaseVertex,
+            batch.instanceOffset});
+      }
+      batch.commandCount =
+          (uint32_t)indirectCommands.size() - batch.commandOffset;
+      // a fully culled mesh still needs a command for its batch to draw
+      if (batch.commandCount == 0)
+      {
+        indirectCommands.push_back(
+            DrawElementsIndirectCommand{0, 0, 0, 0, 0});
+        batch.commandCount = 1;
+      }
+    }
+    buildCalls(packets);
+    if (indirectCommands.empty())
+    {
+      return;
+    }
+    if (indirectBuffer == 0)
+    {
+      glGenBuffers(1, &indirectBuffer);
+    }
+    glBindBuffer(GL_DRAW_INDIRECT_BUFFER, indirectBuffer);
+    glBufferData(GL_DRAW_INDIRECT_BUFFER,
+                 indirectCommands.size() * sizeof(DrawElementsIndirectCommand),
+                 indirectCommands.data(), GL_STREAM_DRAW);
+  }
+  // Joins runs of batches canJoinIndirect accepts into one call each. For
+  // programs from setMultiDrawShader it fills the call's material table
+  // and the slot every instance reads, and uploads the slots.
+  void buildCalls(const std::vector<RenderQueue::Packet> &packets)
+  {
+    callMaterials.clear();
+    instanceMaterials.assign(instanceTransforms.size(), 0);
+    size_t i = 0;
+    while (i < batches.size())
+    {
+      DrawBatch &call = batches[i];
+      bool table = readsMaterialTable(packets[call.packet], call);
+      call.materialOffset = (uint32_t)callMaterials.size();
+      call.materialCount = 0;
+      size_t last = i;
+      while (true)
+      {
+        const DrawBatch &batch = batches[last];
+        if (table)
+        {
+          uint32_t slot =
+              addCallMaterial(call, packets[batch.packet].material);
+          std::fill_n(instanceMaterials.begin() + batch.instanceOffset,
+                      batch.instanceCount, slot);
+        }
+        if (call.commandCount == 0 || last + 1 == batches.size() ||
+            !canJoinIndirect(packets, batches[last + 1], call))
+        {
+          break;
+        }
+        ++last;
+      }
+      call.callBatches = (uint32_t)(last - i + 1);
+      i = last + 1;
+    }
+    if (multiDrawShaders.empty() || instanceMaterials.empty())
+    {
+      return;
+    }
+    if (materialBuffer == 0)
+    {
+      glGenBuffers(1, &materialBuffer);
+    }
+    glBindBuffer(GL_ARRAY_BUFFER, materialBuffer);
+    glBufferData(GL_ARRAY_BUFFER, instanceMaterials.size() * sizeof(uint32_t),
+                 instanceMaterials.data(), GL_STREAM_DRAW);
+  }
+  // whether the batch is drawn with the packet program's variant from
+  // setMultiDrawShader
+  bool readsMaterialTable(const RenderQueue::Packet &packet,
+                          const DrawBatch &batch) const
+  {
+    auto found = multiDrawShaders.find(packet.shader->ID);
+    return found != multiDrawShaders.end() && found->second == batch.shader;
+  }
+  // slot of material in the call's table, MAX_DRAW_MATERIALS when it is
+  // not there
+  uint32_t findCallMaterial(const DrawBatch &call,
+                            const Material *material) const
+  {
+    for (uint32_t slot = 0; slot < call.materialCount; ++slot)
+    {
+      if (callMaterials[call.materialOffset + slot] == material)
+      {
+        return slot;
+      }
+    }
+    return MAX_DRAW_MATERIALS;
+  }
+  // expects the call's table to be the last one in callMaterials and to
+  // have room, see canJoinIndirect
+  uint32_t addCallMaterial(DrawBatch &call, const Material *material)
+  {
+    uint32_t slot = findCallMaterial(call, material);
+    if (slot == MAX_DRAW_MATERIALS)
+    {
+      callMaterials.push_back(material);
+      slot = call.materialCount++;
+    }
+    return slot;
+  }
+  // binds the call's materials to the materials array of its program, two
+  // texture units each: the first diffuse and the first specular texture,
+  // 0 when the material has none. Returns the units whose texture changed.
+  size_t bindMaterialTable(Shader &shader, const DrawBatch &call)
+  {
+    size_t changes = 0;
+    for (uint32_t slot = 0; slot < call.materialCount; ++slot)
+    {
+      const Material &mat = *callMaterials[call.materialOffset + slot];
+      unsigned int textures[2] = {0, 0};
+      for (const auto &text : mat.textures)
+      {
+        unsigned int &texture =
+            textures[text.type == TextureType::Specular ? 1 : 0];
+        if (texture == 0)
+        {
+          texture = text.id;
+        }
+      }
+      const char *samplers[2] = {"texture_diffuse1", "texture_specular1"};
+      for (unsigned int kind = 0; kind < 2; ++kind)
+      {
+        unsigned int unit = slot * 2 + kind;
+        glActiveTexture(GL_TEXTURE0 + unit);
+        int uniformLocation = glGetUniformLocation(
+            shader.ID,
+            getUniformName("materials", samplers[kind], slot).c_str());
+        glUniform1i(uniformLocation, unit);
+        if (residency && textures[kind] != 0)
+        {
+          residency->touch(textures[kind]);
+        }
+        glBindTexture(GL_TEXTURE_2D, textures[kind]);
+        if (boundTextures.size() <= unit)
+        {
+          boundTextures.resize(unit + 1, 0);
+        }
+        changes += boundTextures[unit] != textures[kind];
+        boundTextures[unit] = textures[kind];
+      }
+      int shininess = glGetUniformLocation(
+          shader.ID, getUniformName("materials", "shininess", slot).c_str());
+      glUniform1f(shininess, mat.shininess);
+    }
+    return changes;
+  }
+  // world bounds of the packet or of every instance of the batch
+  BoundingBox batchBounds(const std::vector<RenderQueue::Packet> &packets,
+                          const DrawBatch &batch) const
+  {
+    const RenderQueue::Packet &packet = packets[batch.packet];
+    if (batch.instanceCount == 0)
+    {
+      return packet.mesh->Bounds.transformed(packet.transform);
+    }
+    BoundingBox bounds;
+    for (uint32_t i = 0; i < batch.instanceCount; ++i)
+    {
+      bounds.extend(packet.mesh->Bounds.transformed(
+          instanceTransforms[batch.instanceOffset + i]));
+    }
+    return bounds;
+  }
+  // whether flush() draws the batch in the depth pre-pass
+  bool inDepthPrepass(const RenderQueue::Packet &packet,
+                      const DrawBatch &batch) const
+  {
+    return depthShader && !packet.translucent &&
+           (batch.instanceCount == 0 || depthShaderInstanced);
+  }
+  // The draw loop of flush(), as the lit pass or as the depth pre-pass,
+  // which only draws the batches inDepthPrepass accepts
+  void drawBatches(Camera &camera,
+                   const std::vector<RenderQueue::Packet> &packets,
+                   bool depthOnly)
+  {
+    StateChanges &changes = depthOnly ? queueStats.depthPrepass
+                                      : queueStats.sorted;
+    const Shader *shader = nullptr;
+    const Material *material = nullptr;
+    unsigned int vertexArray = 0;
+    // depth state of the previous lit batch, 1 when it had a pre-pass
+    int prepassed = -1;
+    // 1 when the previous lit batch was translucent
+    int blended = -1;
+    boundTextures.clear();
+    for (size_t i = 0; i < batches.size(); ++i)
+    {
+      const DrawBatch &batch = batches[i];
+      const RenderQueue::Packet &packet = packets[batch.packet];
+      bool hasPrepass = inDepthPrepass(packet, batch);
+      if (depthOnly && !hasPrepass)
+      {
+        continue;
+      }
+      if (!depthOnly && depthShader && prepassed != (int)hasPrepass)
+      {
+        glDepthFunc(hasPrepass ? prepassDepthFunc : litDepthFunc);
+        glDepthMask(hasPrepass ? GL_FALSE : litDepthMask);
+        prepassed = hasPrepass;
+      }
+      if (!depthOnly && blended != (int)packet.translucent)
+      {
+        if (packet.translucent)
+        {
+          glEnable(GL_BLEND);
+          glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+          glDepthMask(GL_FALSE);
+        }
+        else
+        {
+          if (!litBlend)
+          {
+            glDisable(GL_BLEND);
+          }
+          glDepthMask(hasPrepass ? GL_FALSE : litDepthMask);
+        }
+        blended = packet.translucent;
+      }
+      Shader *program = batch.shader;
+      if (depthOnly)
+      {
+        program = batch.instanceCount > 0 ? depthShaderInstanced : depthShader;
+      }
+      bool programChanged = !shader || shader->ID != program->ID;
+      if (programChanged)
+      {
+        program->use();
+        setCameraUniforms(camera, *program);
+        shader = program;
+        ++changes.programs;
+      }
+      // sampler uniforms belong to the program, so rebind after a switch
+      if (!depthOnly && batch.materialCount > 0)
+      {
+        changes.textures += bindMaterialTable(*program, batch);
+        material = nullptr;
+      }
+      else if (!depthOnly && (programChanged || material != packet.material))
+      {
+        bindMaterial(*program, *packet.material);
+        material = packet.material;
+        changes.textures += countTextureChanges(*material, boundTextures);
+      }
+      unsigned int meshArray = depthOnly && packet.mesh->PositionId != 0
+                                   ? packet.mesh->PositionId
+                                   : packet.mesh->Id;
+      if (vertexArray != meshArray)
+      {
+        glBindVertexArray(meshArray);
+        vertexArray = meshArray;
+        ++changes.vertexArrays;
+      }
+      if (batch.commandCount > 0)
+      {
+        // the call buildCalls joined, each command picking its transforms
+        // and material slot by base instance
+        size_t last = i + batch.callBatches - 1;
+        bindInstanceAttributes(0);
+        if (!depthOnly && lightSelector)
+        {
+          BoundingBox bounds;
+          for (size_t joined = i; joined <= last; ++joined)
+          {
+            bounds.extend(batchBounds(packets, batches[joined]));
+          }
+          lightSelector->apply(*program, bounds);
+        }
+        uint32_t commandCount = 0;
+        for (size_t joined = i; joined <= last; ++joined)
+        {
+          commandCount += batches[joined].commandCount;
+          if (!depthOnly)
+          {
+            queueStats.instances += batches[joined].instanceCount;
+          }
+        }
+        multiDrawElementsIndirect(
+            GL_TRIANGLES, GL_UNSIGNED_INT,
+            (void *)(batch.commandOffset *
+                     sizeof(DrawElementsIndirectCommand)),
+            (GLsizei)commandCount, 0);
+        if (!depthOnly)
+        {
+          queueStats.indirectCommands += commandCount;
+        }
+        i = last;
+      }
+      else if (batch.instanceCount > 0)
+      {
+        if (!depthOnly && lightSelector)
+        {
+          lightSelector->apply(*program, batchBounds(packets, batch));
+        }
+        drawInstances(*packet.mesh, batch);
+        if (!depthOnly)
+        {
+          queueStats.instances += batch.instanceCount;
+        }
+      }
+      else
+      {
+        if (!depthOnly && lightSelector)
+        {
+          lightSelector->apply(*program, batchBounds(packets, batch));
+        }
+        drawMesh(camera, *packet.mesh, *program, packet.transform);
+      }
+      ++changes.draws;
+    }
+  }
+  // whether next can be submitted in the same indirect call as call; the
+  // commands of consecutive batches are adjacent in the buffer. Pass,
+  // blending and the pre-pass decide the depth and blend state the call
+  // runs with, so they have to match too. The material may differ when
+  // the program reads it from a table that has room for it.
+  bool canJoinIndirect(const std::vector<RenderQueue::Packet> &packets,
+                       const DrawBatch &next, const DrawBatch &call) const
+  {
+    const RenderQueue::Packet &a = packets[next.packet];
+    const RenderQueue::Packet &b = packets[call.packet];
+    if (next.commandCount == 0 || next.shader->ID != call.shader->ID ||
+        a.mesh->Id != b.mesh->Id || a.mesh->PositionId != b.mesh->PositionId ||
+        inDepthPrepass(a, next) != inDepthPrepass(b, call))
+    {
+      return false;
+    }
+    if (sameState(a, b))
+    {
+      return true;
+    }
+    return readsMaterialTable(b, call) && a.shader->ID == b.shader->ID &&
+           a.pass == b.pass && a.translucent == b.translucent &&
+           (call.materialCount < MAX_DRAW_MATERIALS ||
+            findCallMaterial(call, a.material) < MAX_DRAW_MATERIALS);
+  }
+  // expects the program in use and the mesh's vertex array bound; the
+  // whole level is drawn, instances skip cluster culling
+  void drawInstances(const Mesh &mesh, const DrawBatch &batch)
+  {
+    // GL 3.3 has no base instance, so the attributes point at the batch
+    bindInstanceAttributes(batch.instanceOffset);
+    GLsizei count = (GLsizei)batch.instanceCount;
+    if (!mesh.Lods.empty())
+    {
+      const MeshLod &lod = mesh.Lods[batch.lod];
+      glDrawElementsInstancedBaseVertex(
+          GL_TRIANGLES, (int)lod.indexCount, GL_UNSIGNED_INT,
+          elementOffset(mesh, lod.indexOffset), count, (GLint)mesh.BaseVertex);
+    }
+    else if (mesh.IndexCount > 0)
+    {
+      glDrawElementsInstancedBaseVertex(GL_TRIANGLES, (int)mesh.IndexCount,
+                                        GL_UNSIGNED_INT, elementOffset(mesh),
+                                        count, (GLint)mesh.BaseVertex);
+    }
+    else
+    {
+      glDrawArraysInstanced(GL_TRIANGLES, (GLint)mesh.BaseVertex,
+                            (int)mesh.VertexCount, count);
+    }
+  }
+  void drawMeshlets(Camera &camera, const Mesh &mesh,
+                    const glm::mat4 &transform)
+  {
+    cullMeshlets(camera, mesh, transform);
+    if (!drawCounts.empty())
+    {
+      drawBaseVertices.assign(drawCounts.size(), (GLint)mesh.BaseVertex);
+      glMultiDrawElementsBaseVertex(GL_TRIANGLES, drawCounts.data(),
+                                    GL_UNSIGNED_INT, drawOffsets.data(),
+                                    (GLsizei)drawCounts.size(),
+                                    drawBaseVertices.data());
+    }
+  }
+  // element buffer ranges of the visible meshlets, in drawCounts and
+  // drawOffsets
+  void cullMeshlets(Camera &camera, const Mesh &mesh,
+                    const glm::mat4 &transform)
+  {
+    // cull in object space: planes of the full matrix, camera moved back
+    Frustum frustum(camera.Projection * camera.calculateViewMatrix() *
+                    transform);
+    glm::vec3 eye = glm::inverse(transform) * glm::vec4(camera.Position, 1.0f);
+    drawCounts.clear();
+    drawOffsets.clear();
+    size_t rangeEnd = 0;
+    for (const Meshlet &meshlet : mesh.Meshlets)
+    {
+      ++cullingStats.meshlets;
+      cullingStats.triangles += meshlet.triangleCount;
+      if (meshletBackfacing(meshlet, glm::value_ptr(eye)))
+      {
+        ++cullingStats.meshletsCulled;
+        cullingStats.backfaceTrianglesCulled += meshlet.triangleCount;
+        continue;
+      }
+      glm::vec3 center(meshlet.center[0], meshlet.center[1],
+                       meshlet.center[2]);
+      if (!frustum.intersectsSphere(center, meshlet.radius))
+      {
+        ++cullingStats.meshletsCulled;
+        cullingStats.frustumTrianglesCulled += meshlet.triangleCount;
+        continue;
+      }
+      // neighbouring visible meshlets share one draw
+      if (!drawCounts.empty() && rangeEnd == meshlet.indexOffset)
+      {
+        drawCounts.back() += meshlet.triangleCount * 3;
+      }
+      else
+      {
+        drawCounts.push_back(meshlet.triangleCount * 3);
+        drawOffsets.push_back(elementOffset(mesh, meshlet.indexOffset));
+      }
+      rangeEnd = meshlet.indexOffset + meshlet.triangleCount * 3;
+    }
+    cullingStats.drawRanges += drawCounts.size();
+  }
   void addLight(const Shader &shader, const Light &light, Camera &camera,
                 const std::string &name, int index)
   {
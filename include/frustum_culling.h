@@ -0,0 +1,225 @@
+#ifndef FRUSTUM_CULLING_H
+#define FRUSTUM_CULLING_H
+
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include <cpu_features.h>
+
+#ifdef CPU_FEATURES_X86
+#define FRUSTUM_CULLING_AVX 1
+#endif
+#if defined(__SSE2__) || defined(_M_X64) || \
+    (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define FRUSTUM_CULLING_SSE 1
+#endif
+
+// Axis aligned boxes as centre and half extent arrays so the culling
+// kernels can load 4 or 8 boxes with one instruction per component
+struct BoxList
+{
+  std::vector<float> centerX, centerY, centerZ;
+  std::vector<float> extentX, extentY, extentZ;
+
+  size_t size() const { return centerX.size(); }
+  void clear()
+  {
+    centerX.clear();
+    centerY.clear();
+    centerZ.clear();
+    extentX.clear();
+    extentY.clear();
+    extentZ.clear();
+  }
+  void add(const float min[3], const float max[3])
+  {
+    centerX.push_back((min[0] + max[0]) * 0.5f);
+    centerY.push_back((min[1] + max[1]) * 0.5f);
+    centerZ.push_back((min[2] + max[2]) * 0.5f);
+    extentX.push_back((max[0] - min[0]) * 0.5f);
+    extentY.push_back((max[1] - min[1]) * 0.5f);
+    extentZ.push_back((max[2] - min[2]) * 0.5f);
+  }
+};
+
+// Planes (a, b, c, d) of a column major view projection matrix, pointing
+// inwards and normalized
+inline void extractFrustumPlanes(const float *m, float planes[6][4])
+{
+  for (int i = 0; i < 3; ++i)
+  {
+    for (int k = 0; k < 4; ++k)
+    {
+      float w = m[k * 4 + 3];
+      float row = m[k * 4 + i];
+      planes[i * 2][k] = w + row;
+      planes[i * 2 + 1][k] = w - row;
+    }
+  }
+  for (int p = 0; p < 6; ++p)
+  {
+    float length = std::sqrt(planes[p][0] * planes[p][0] +
+                             planes[p][1] * planes[p][1] +
+                             planes[p][2] * planes[p][2]);
+    for (int k = 0; k < 4; ++k)
+    {
+      planes[p][k] /= length;
+    }
+  }
+}
+
+// A box is outside when its most positive corner along a plane normal is
+// still behind that plane: dot(n, c) + dot(|n|, e) + d < 0
+inline size_t cullBoxesScalar(const float planes[6][4], const BoxList &boxes,
+                              size_t begin, size_t end, uint8_t *visible)
+{
+  size_t count = 0;
+  for (size_t i = begin; i < end; ++i)
+  {
+    bool inside = true;
+    for (int p = 0; p < 6 && inside; ++p)
+    {
+      const float *plane = planes[p];
+      float distance = plane[0] * boxes.centerX[i] +
+                       plane[1] * boxes.centerY[i] +
+                       plane[2] * boxes.centerZ[i] + plane[3];
+      float radius = std::fabs(plane[0]) * boxes.extentX[i] +
+                     std::fabs(plane[1]) * boxes.extentY[i] +
+                     std::fabs(plane[2]) * boxes.extentZ[i];
+      inside = distance + radius >= 0.0f;
+    }
+    visible[i] = inside;
+    count += inside;
+  }
+  return count;
+}
+
+#ifdef FRUSTUM_CULLING_SSE
+// 4 boxes per iteration
+inline size_t cullBoxesSSE(const float planes[6][4], const BoxList &boxes,
+                           uint8_t *visible)
+{
+  const size_t count = boxes.size();
+  const size_t wide = count & ~(size_t)3;
+  __m128 a[6], b[6], c[6], d[6], absA[6], absB[6], absC[6];
+  for (int p = 0; p < 6; ++p)
+  {
+    a[p] = _mm_set1_ps(planes[p][0]);
+    b[p] = _mm_set1_ps(planes[p][1]);
+    c[p] = _mm_set1_ps(planes[p][2]);
+    d[p] = _mm_set1_ps(planes[p][3]);
+    absA[p] = _mm_set1_ps(std::fabs(planes[p][0]));
+    absB[p] = _mm_set1_ps(std::fabs(planes[p][1]));
+    absC[p] = _mm_set1_ps(std::fabs(planes[p][2]));
+  }
+  const __m128 zero = _mm_setzero_ps();
+  size_t visibleCount = 0;
+  for (size_t i = 0; i < wide; i += 4)
+  {
+    __m128 cx = _mm_loadu_ps(&boxes.centerX[i]);
+    __m128 cy = _mm_loadu_ps(&boxes.centerY[i]);
+    __m128 cz = _mm_loadu_ps(&boxes.centerZ[i]);
+    __m128 ex = _mm_loadu_ps(&boxes.extentX[i]);
+    __m128 ey = _mm_loadu_ps(&boxes.extentY[i]);
+    __m128 ez = _mm_loadu_ps(&boxes.extentZ[i]);
+    __m128 outside = zero;
+    for (int p = 0; p < 6; ++p)
+    {
+      __m128 distance = _mm_add_ps(
+          _mm_add_ps(_mm_mul_ps(a[p], cx), _mm_mul_ps(b[p], cy)),
+          _mm_add_ps(_mm_mul_ps(c[p], cz), d[p]));
+      __m128 radius = _mm_add_ps(
+          _mm_add_ps(_mm_mul_ps(absA[p], ex), _mm_mul_ps(absB[p], ey)),
+          _mm_mul_ps(absC[p], ez));
+      outside = _mm_or_ps(outside,
+                          _mm_cmplt_ps(_mm_add_ps(distance, radius), zero));
+    }
+    int mask = _mm_movemask_ps(outside);
+    for (int k = 0; k < 4; ++k)
+    {
+      uint8_t inside = !((mask >> k) & 1);
+      visible[i + k] = inside;
+      visibleCount += inside;
+    }
+  }
+  return visibleCount +
+         cullBoxesScalar(planes, boxes, wide, count, visible);
+}
+#endif
+
+#ifdef FRUSTUM_CULLING_AVX
+// 8 boxes per iteration, only call when cpuHasAVX()
+CPU_TARGET_AVX inline size_t cullBoxesAVX(const float planes[6][4], const BoxList &boxes,
+                           uint8_t *visible)
+{
+  const size_t count = boxes.size();
+  const size_t wide = count & ~(size_t)7;
+  __m256 a[6], b[6], c[6], d[6], absA[6], absB[6], absC[6];
+  for (int p = 0; p < 6; ++p)
+  {
+    a[p] = _mm256_set1_ps(planes[p][0]);
+    b[p] = _mm256_set1_ps(planes[p][1]);
+    c[p] = _mm256_set1_ps(planes[p][2]);
+    d[p] = _mm256_set1_ps(planes[p][3]);
+    absA[p] = _mm256_set1_ps(std::fabs(planes[p][0]));
+    absB[p] = _mm256_set1_ps(std::fabs(planes[p][1]));
+    absC[p] = _mm256_set1_ps(std::fabs(planes[p][2]));
+  }
+  const __m256 zero = _mm256_setzero_ps();
+  size_t visibleCount = 0;
+  for (size_t i = 0; i < wide; i += 8)
+  {
+    __m256 cx = _mm256_loadu_ps(&boxes.centerX[i]);
+    __m256 cy = _mm256_loadu_ps(&boxes.centerY[i]);
+    __m256 cz = _mm256_loadu_ps(&boxes.centerZ[i]);
+    __m256 ex = _mm256_loadu_ps(&boxes.extentX[i]);
+    __m256 ey = _mm256_loadu_ps(&boxes.extentY[i]);
+    __m256 ez = _mm256_loadu_ps(&boxes.extentZ[i]);
+    __m256 outside = zero;
+    for (int p = 0; p < 6; ++p)
+    {
+      __m256 distance = _mm256_add_ps(
+          _mm256_add_ps(_mm256_mul_ps(a[p], cx), _mm256_mul_ps(b[p], cy)),
+          _mm256_add_ps(_mm256_mul_ps(c[p], cz), d[p]));
+      __m256 radius = _mm256_add_ps(
+          _mm256_add_ps(_mm256_mul_ps(absA[p], ex), _mm256_mul_ps(absB[p], ey)),
+          _mm256_mul_ps(absC[p], ez));
+      outside = _mm256_or_ps(
+          outside,
+          _mm256_cmp_ps(_mm256_add_ps(distance, radius), zero, _CMP_LT_OQ));
+    }
+    int mask = _mm256_movemask_ps(outside);
+    for (int k = 0; k < 8; ++k)
+    {
+      uint8_t inside = !((mask >> k) & 1);
+      visible[i + k] = inside;
+      visibleCount += inside;
+    }
+  }
+  return visibleCount +
+         cullBoxesScalar(planes, boxes, wide, count, visible);
+}
+#endif
+
+// Writes 1 to visible[i] for every box touching the frustum, 0 otherwise,
+// with the widest kernel the CPU runs. Returns the visible count.
+inline size_t cullBoxes(const float planes[6][4], const BoxList &boxes,
+                        uint8_t *visible)
+{
+#ifdef FRUSTUM_CULLING_AVX
+  if (cpuHasAVX())
+  {
+    return cullBoxesAVX(planes, boxes, visible);
+  }
+#endif
+#ifdef FRUSTUM_CULLING_SSE
+  return cullBoxesSSE(planes, boxes, visible);
+#else
+  return cullBoxesScalar(planes, boxes, 0, boxes.size(), visible);
+#endif
+}
+
+#endif
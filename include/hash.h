@@ -0,0 +1,62 @@
+#ifndef HASH_H
+#define HASH_H
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+
+// 64-bit content hash (xxHash64 single lane), fast enough to run over every
+// compressed asset we load
+inline uint64_t hashRotl(uint64_t x, int r) { return (x << r) | (x >> (64 - r)); }
+
+inline uint64_t hashBytes(const void *data, size_t size, uint64_t seed = 0)
+{
+  const uint64_t prime1 = 0x9E3779B185EBCA87ULL;
+  const uint64_t prime2 = 0xC2B2AE3D27D4EB4FULL;
+  const uint64_t prime3 = 0x165667B19E3779F9ULL;
+  const uint64_t prime5 = 0x27D4EB2F165667C5ULL;
+  const unsigned char *p = static_cast<const unsigned char *>(data);
+  uint64_t h = seed + prime5 + (uint64_t)size;
+  while (size >= 8)
+  {
+    uint64_t k;
+    std::memcpy(&k, p, 8);
+    k *= prime2;
+    k = hashRotl(k, 31);
+    k *= prime1;
+    h ^= k;
+    h = hashRotl(h, 27) * prime1 + 0x85EBCA77C2B2AE63ULL;
+    p += 8;
+    size -= 8;
+  }
+  if (size >= 4)
+  {
+    uint32_t k;
+    std::memcpy(&k, p, 4);
+    h ^= (uint64_t)k * prime1;
+    h = hashRotl(h, 23) * prime2 + prime3;
+    p += 4;
+    size -= 4;
+  }
+  while (size > 0)
+  {
+    h ^= (*p) * prime5;
+    h = hashRotl(h, 11) * prime1;
+    ++p;
+    --size;
+  }
+  // final avalanche
+  h ^= h >> 33;
+  h *= prime2;
+  h ^= h >> 29;
+  h *= prime3;
+  h ^= h >> 32;
+  return h;
+}
+
+inline uint64_t hashCombine(uint64_t seed, uint64_t value)
+{
+  return hashBytes(&value, sizeof(value), seed);
+}
+
+#endif
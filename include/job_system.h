@@ -0,0 +1,149 @@
+#ifndef JOB_SYSTEM_H
+#define JOB_SYSTEM_H
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Fixed pool of worker threads pulling jobs from a shared queue
+class JobSystem
+{
+public:
+  JobSystem() : JobSystem(defaultThreadCount()) {}
+  JobSystem(unsigned int threadCount)
+  {
+    for (unsigned int i = 0; i < threadCount; ++i)
+    {
+      workers.emplace_back([this]() { workerLoop(); });
+    }
+  }
+  ~JobSystem()
+  {
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      stopping = true;
+    }
+    wakeUp.notify_all();
+    for (auto &worker : workers)
+    {
+      worker.join();
+    }
+  }
+  JobSystem(const JobSystem &) = delete;
+  JobSystem &operator=(const JobSystem &) = delete;
+
+  template <typename F>
+  auto submit(F &&job) -> std::future<decltype(job())>
+  {
+    using Result = decltype(job());
+    auto task =
+        std::make_shared<std::packaged_task<Result()>>(std::forward<F>(job));
+    std::future<Result> result = task->get_future();
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      queue.emplace_back([task]() { (*task)(); });
+    }
+    wakeUp.notify_one();
+    return result;
+  }
+  // Runs job(i) for every i in [0, count), grain indices at a time, on the
+  // workers and the calling thread. Returns once every index is done.
+  void parallelFor(size_t count, const std::function<void(size_t)> &job,
+                   size_t grain = 1)
+  {
+    if (count == 0)
+    {
+      return;
+    }
+    struct Batch
+    {
+      std::atomic<size_t> next{0};
+      std::atomic<size_t> done{0};
+      size_t count, grain;
+      std::function<void(size_t)> job;
+      std::mutex mutex;
+      std::condition_variable finished;
+    };
+    auto batch = std::make_shared<Batch>();
+    batch->count = count;
+    batch->grain = std::max<size_t>(1, grain);
+    batch->job = job;
+    auto run = [batch]() {
+      for (;;)
+      {
+        size_t begin = batch->next.fetch_add(batch->grain);
+        if (begin >= batch->count)
+        {
+          return;
+        }
+        size_t end = std::min(batch->count, begin + batch->grain);
+        for (size_t i = begin; i < end; ++i)
+        {
+          batch->job(i);
+        }
+        if (batch->done.fetch_add(end - begin) + (end - begin) ==
+            batch->count)
+        {
+          std::lock_guard<std::mutex> lock(batch->mutex);
+          batch->finished.notify_all();
+        }
+      }
+    };
+    size_t chunks = (count + batch->grain - 1) / batch->grain;
+    size_t helpers = std::min<size_t>(workers.size(), chunks - 1);
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      for (size_t i = 0; i < helpers; ++i)
+      {
+        queue.emplace_back(run);
+      }
+    }
+    wakeUp.notify_all();
+    run();
+    std::unique_lock<std::mutex> lock(batch->mutex);
+    batch->finished.wait(lock,
+                         [&batch]() { return batch->done == batch->count; });
+  }
+  size_t threadCount() const { return workers.size(); }
+
+  static unsigned int defaultThreadCount()
+  {
+    unsigned int cores = std::thread::hardware_concurrency();
+    // keep one core for the thread owning the GL context
+    return cores > 1 ? cores - 1 : 1;
+  }
+
+private:
+  void workerLoop()
+  {
+    for (;;)
+    {
+      std::function<void()> job;
+      {
+        std::unique_lock<std::mutex> lock(mutex);
+        wakeUp.wait(lock, [this]() { return stopping || !queue.empty(); });
+        if (stopping && queue.empty())
+        {
+          return;
+        }
+        job = std::move(queue.front());
+        queue.pop_front();
+      }
+      job();
+    }
+  }
+  std::vector<std::thread> workers;
+  std::deque<std::function<void()>> queue;
+  std::mutex mutex;
+  std::condition_variable wakeUp;
+  bool stopping = false;
+};
+
+#endif
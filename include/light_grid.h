@@ -0,0 +1,250 @@
+#ifndef LIGHT_GRID_H
+#define LIGHT_GRID_H
+
+#include <glm/glm.hpp>
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+// A light as the grid sees it: a sphere of influence in world space and
+// the attenuation used to rank lights against each other. Spot lights also
+// carry their axis and the cosine and sine of their outer angle.
+struct GridLight
+{
+  glm::vec3 position;
+  float radius;
+  // brightest channel of the light's colors
+  float intensity;
+  float constant;
+  float linear;
+  float quadratic;
+  glm::vec3 direction;
+  float cosAngle;
+  float sinAngle;
+  bool spot;
+};
+
+// Uniform grid over the light spheres, rebuilt whenever the lights move.
+// select() returns the lights that reach a box, ranked by how bright they
+// are at its nearest point, so every object only shades with its closest
+// lights however many the scene has.
+class LightGrid
+{
+public:
+  // cellSize 0 picks twice the mean light radius
+  void build(const std::vector<GridLight> &gridLights, float cellSize = 0.0f)
+  {
+    lights = gridLights;
+    cells.clear();
+    entries.clear();
+    unbounded.clear();
+    stamps.assign(lights.size(), 0);
+    stamp = 0;
+    if (cellSize <= 0.0f)
+    {
+      double sum = 0.0;
+      size_t counted = 0;
+      for (const GridLight &light : lights)
+      {
+        if (light.radius < LARGE_RADIUS)
+        {
+          sum += light.radius;
+          ++counted;
+        }
+      }
+      cellSize = counted ? (float)(2.0 * sum / counted) : 1.0f;
+    }
+    cell = std::max(cellSize, 1e-3f);
+    // light index per covered cell, sorted by cell
+    std::vector<std::pair<uint64_t, uint32_t>> covered;
+    for (uint32_t i = 0; i < lights.size(); ++i)
+    {
+      const GridLight &light = lights[i];
+      glm::ivec3 lo = cellOf(light.position - glm::vec3(light.radius));
+      glm::ivec3 hi = cellOf(light.position + glm::vec3(light.radius));
+      if (light.radius >= LARGE_RADIUS ||
+          cellCount(lo, hi) > MAX_CELLS_PER_LIGHT)
+      {
+        unbounded.push_back(i);
+        continue;
+      }
+      for (int z = lo.z; z <= hi.z; ++z)
+      {
+        for (int y = lo.y; y <= hi.y; ++y)
+        {
+          for (int x = lo.x; x <= hi.x; ++x)
+          {
+            covered.emplace_back(key(x, y, z), i);
+          }
+        }
+      }
+    }
+    std::sort(covered.begin(), covered.end());
+    entries.resize(covered.size());
+    for (size_t i = 0; i < covered.size(); ++i)
+    {
+      entries[i] = covered[i].second;
+      auto found = cells.find(covered[i].first);
+      if (found == cells.end())
+      {
+        cells.emplace(covered[i].first, std::make_pair((uint32_t)i, 1u));
+      }
+      else
+      {
+        ++found->second.second;
+      }
+    }
+  }
+  // Writes to selected the indices of at most maxLights lights reaching
+  // the box, brightest at the box first
+  void select(const glm::vec3 &boxMin, const glm::vec3 &boxMax,
+              size_t maxLights, std::vector<uint32_t> &selected)
+  {
+    selected.clear();
+    ranked.clear();
+    if (++stamp == 0)
+    {
+      std::fill(stamps.begin(), stamps.end(), 0);
+      stamp = 1;
+    }
+    glm::ivec3 lo = cellOf(boxMin);
+    glm::ivec3 hi = cellOf(boxMax);
+    if (cellCount(lo, hi) > (uint64_t)cells.size())
+    {
+      // the box covers more cells than there are in use, test every light
+      for (uint32_t i = 0; i < lights.size(); ++i)
+      {
+        rank(i, boxMin, boxMax);
+      }
+    }
+    else
+    {
+      for (int z = lo.z; z <= hi.z; ++z)
+      {
+        for (int y = lo.y; y <= hi.y; ++y)
+        {
+          for (int x = lo.x; x <= hi.x; ++x)
+          {
+            auto found = cells.find(key(x, y, z));
+            if (found == cells.end())
+            {
+              continue;
+            }
+            const uint32_t *entry = &entries[found->second.first];
+            for (uint32_t i = 0; i < found->second.second; ++i)
+            {
+              rank(entry[i], boxMin, boxMax);
+            }
+          }
+        }
+      }
+      for (uint32_t i : unbounded)
+      {
+        rank(i, boxMin, boxMax);
+      }
+    }
+    candidates += ranked.size();
+    size_t kept = std::min(maxLights, ranked.size());
+    std::partial_sort(ranked.begin(), ranked.begin() + kept, ranked.end(),
+                      [](const std::pair<float, uint32_t> &a,
+                         const std::pair<float, uint32_t> &b) {
+                        return a.first > b.first ||
+                               (a.first == b.first && a.second < b.second);
+                      });
+    for (size_t i = 0; i < kept; ++i)
+    {
+      selected.push_back(ranked[i].second);
+    }
+  }
+  // Brightness of a light at the nearest point of a box, 0 when the box
+  // is out of its range or, for spot lights, outside the cone
+  static float influence(const GridLight &light, const glm::vec3 &boxMin,
+                         const glm::vec3 &boxMax)
+  {
+    glm::vec3 closest = glm::clamp(light.position, boxMin, boxMax);
+    glm::vec3 offset = closest - light.position;
+    float distance2 = glm::dot(offset, offset);
+    if (distance2 > light.radius * light.radius)
+    {
+      return 0.0f;
+    }
+    if (light.spot)
+    {
+      // cone against the box's bounding sphere
+      glm::vec3 center = (boxMin + boxMax) * 0.5f;
+      float boxRadius = glm::length(boxMax - center);
+      glm::vec3 toCenter = center - light.position;
+      float along = glm::dot(toCenter, light.direction);
+      float across = std::sqrt(
+          std::max(glm::dot(toCenter, toCenter) - along * along, 0.0f));
+      if (light.cosAngle * across - along * light.sinAngle > boxRadius ||
+          along < -boxRadius)
+      {
+        return 0.0f;
+      }
+    }
+    float distance = std::sqrt(distance2);
+    return light.intensity /
+           (light.constant + light.linear * distance +
+            light.quadratic * distance2);
+  }
+  const std::vector<GridLight> &getLights() const { return lights; }
+  float cellSize() const { return cell; }
+  size_t cellsUsed() const { return cells.size(); }
+  // lights tested by select() since the last reset
+  size_t candidateCount() const { return candidates; }
+  void resetCandidateCount() { candidates = 0; }
+
+private:
+  // lights reaching further are tested against every box
+  static constexpr float LARGE_RADIUS = 1e29f;
+  static const uint64_t MAX_CELLS_PER_LIGHT = 512;
+  void rank(uint32_t i, const glm::vec3 &boxMin, const glm::vec3 &boxMax)
+  {
+    if (stamps[i] == stamp)
+    {
+      return;
+    }
+    stamps[i] = stamp;
+    float score = influence(lights[i], boxMin, boxMax);
+    if (score > 0.0f)
+    {
+      ranked.emplace_back(score, i);
+    }
+  }
+  glm::ivec3 cellOf(const glm::vec3 &point) const
+  {
+    // clamped so far away boxes still hash into the 21 bits per axis
+    glm::vec3 scaled = glm::clamp(point / cell, glm::vec3(-1e6f),
+                                  glm::vec3(1e6f));
+    return glm::ivec3((int)std::floor(scaled.x), (int)std::floor(scaled.y),
+                      (int)std::floor(scaled.z));
+  }
+  static uint64_t cellCount(const glm::ivec3 &lo, const glm::ivec3 &hi)
+  {
+    return (uint64_t)(hi.x - lo.x + 1) * (uint64_t)(hi.y - lo.y + 1) *
+           (uint64_t)(hi.z - lo.z + 1);
+  }
+  static uint64_t key(int x, int y, int z)
+  {
+    const uint64_t mask = (1u << 21) - 1;
+    return ((uint64_t)x & mask) | ((uint64_t)y & mask) << 21 |
+           ((uint64_t)z & mask) << 42;
+  }
+  std::vector<GridLight> lights;
+  float cell = 1.0f;
+  // first entry and count per non empty cell
+  std::unordered_map<uint64_t, std::pair<uint32_t, uint32_t>> cells;
+  std::vector<uint32_t> entries;
+  std::vector<uint32_t> unbounded;
+  // query a light was last ranked in, so lights spanning cells count once
+  std::vector<uint32_t> stamps;
+  uint32_t stamp = 0;
+  std::vector<std::pair<float, uint32_t>> ranked;
+  size_t candidates = 0;
+};
+
+#endif
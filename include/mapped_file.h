@@ -0,0 +1,91 @@
+#ifndef MAPPED_FILE_H
+#define MAPPED_FILE_H
+
+#include <cstddef>
+#include <fstream>
+#include <string>
+#include <vector>
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+// Read-only view of a whole file. Memory mapped where mmap is available;
+// on Windows the file is read in one go to keep windows.h away from glad.
+class MappedFile
+{
+public:
+  MappedFile() {}
+  MappedFile(const std::string &path) { open(path); }
+  ~MappedFile() { close(); }
+  MappedFile(const MappedFile &) = delete;
+  MappedFile &operator=(const MappedFile &) = delete;
+
+  bool open(const std::string &path)
+  {
+    close();
+#ifndef _WIN32
+    int fd = ::open(path.c_str(), O_RDONLY);
+    if (fd < 0)
+    {
+      return false;
+    }
+    struct stat info;
+    if (fstat(fd, &info) == 0 && info.st_size > 0)
+    {
+      void *mapped =
+          mmap(nullptr, (size_t)info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+      if (mapped != MAP_FAILED)
+      {
+        bytes = static_cast<const unsigned char *>(mapped);
+        length = (size_t)info.st_size;
+      }
+    }
+    ::close(fd);
+    return bytes != nullptr;
+#else
+    std::ifstream file(path, std::ios::binary | std::ios::ate);
+    if (!file)
+    {
+      return false;
+    }
+    buffer.resize((size_t)file.tellg());
+    file.seekg(0);
+    if (buffer.empty() || !file.read((char *)buffer.data(), buffer.size()))
+    {
+      buffer.clear();
+      return false;
+    }
+    bytes = buffer.data();
+    length = buffer.size();
+    return true;
+#endif
+  }
+  void close()
+  {
+#ifndef _WIN32
+    if (bytes)
+    {
+      munmap((void *)bytes, length);
+    }
+#else
+    buffer.clear();
+#endif
+    bytes = nullptr;
+    length = 0;
+  }
+  const unsigned char *data() const { return bytes; }
+  size_t size() const { return length; }
+
+private:
+  const unsigned char *bytes = nullptr;
+  size_t length = 0;
+#ifdef _WIN32
+  std::vector<unsigned char> buffer;
+#endif
+};
+
+#endif
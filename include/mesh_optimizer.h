@@ -0,0 +1,456 @@
+#ifndef MESH_OPTIMIZER_H
+#define MESH_OPTIMIZER_H
+
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <type_traits>
+#include <vector>
+
+// Post-transform vertex cache efficiency of an index buffer, measured with a
+// FIFO cache of the given size
+struct VertexCacheStats
+{
+  size_t misses = 0;
+  // average cache miss ratio: transformed vertices per triangle (0.5 - 3)
+  float acmr = 0.0f;
+  // average transform to vertex ratio: transformed vertices per used vertex
+  // (1 is optimal)
+  float atvr = 0.0f;
+};
+
+inline VertexCacheStats analyzeVertexCache(const unsigned int *indices,
+                                           size_t indexCount,
+                                           size_t vertexCount,
+                                           unsigned int cacheSize = 16)
+{
+  VertexCacheStats stats;
+  // a vertex is cached while fewer than cacheSize misses happened since it
+  // was loaded
+  std::vector<size_t> loadedAt(vertexCount, 0);
+  std::vector<bool> used(vertexCount, false);
+  size_t time = cacheSize + 1;
+  size_t usedCount = 0;
+  for (size_t i = 0; i < indexCount; ++i)
+  {
+    unsigned int vertex = indices[i];
+    if (time - loadedAt[vertex] > cacheSize)
+    {
+      loadedAt[vertex] = time++;
+      ++stats.misses;
+    }
+    if (!used[vertex])
+    {
+      used[vertex] = true;
+      ++usedCount;
+    }
+  }
+  if (indexCount >= 3)
+  {
+    stats.acmr = (float)stats.misses / (float)(indexCount / 3);
+  }
+  if (usedCount > 0)
+  {
+    stats.atvr = (float)stats.misses / (float)usedCount;
+  }
+  return stats;
+}
+
+// Reorders triangles for the post-transform vertex cache with Tom Forsyth's
+// "Linear-Speed Vertex Cache Optimisation": vertices are scored on their
+// position in a simulated LRU cache and on how many triangles still use
+// them, and the best scoring triangle touching the cache is emitted next.
+inline void optimizeVertexCache(unsigned int *indices, size_t indexCount,
+                                size_t vertexCount)
+{
+  const int cacheSize = 32;
+  const size_t triangleCount = indexCount / 3;
+  if (triangleCount == 0)
+  {
+    return;
+  }
+  // triangles using each vertex, packed; the first remaining[v] entries of a
+  // vertex range are the triangles not emitted yet
+  std::vector<unsigned int> remaining(vertexCount, 0);
+  for (size_t i = 0; i < indexCount; ++i)
+  {
+    ++remaining[indices[i]];
+  }
+  std::vector<size_t> offsets(vertexCount + 1, 0);
+  for (size_t v = 0; v < vertexCount; ++v)
+  {
+    offsets[v + 1] = offsets[v] + remaining[v];
+  }
+  std::vector<unsigned int> vertexTriangles(indexCount);
+  {
+    std::vector<size_t> cursor(offsets.begin(), offsets.end() - 1);
+    for (size_t i = 0; i < indexCount; ++i)
+    {
+      vertexTriangles[cursor[indices[i]]++] = (unsigned int)(i / 3);
+    }
+  }
+  std::vector<int> cachePosition(vertexCount, -1);
+  auto vertexScore = [&](unsigned int vertex) {
+    if (remaining[vertex] == 0)
+    {
+      return -1.0f;
+    }
+    float score = 0.0f;
+    int position = cachePosition[vertex];
+    if (position >= 0)
+    {
+      // the last triangle's vertices get a fixed score so the next triangle
+      // does not simply reuse its edge
+      score = position < 3 ? 0.75f
+                           : std::pow(1.0f - (float)(position - 3) /
+                                                 (float)(cacheSize - 3),
+                                      1.5f);
+    }
+    // favour vertices with few triangles left to get rid of them early
+    return score + 2.0f / std::sqrt((float)remaining[vertex]);
+  };
+  std::vector<float> scores(vertexCount);
+  for (size_t v = 0; v < vertexCount; ++v)
+  {
+    scores[v] = vertexScore((unsigned int)v);
+  }
+  std::vector<float> triangleScores(triangleCount);
+  for (size_t t = 0; t < triangleCount; ++t)
+  {
+    triangleScores[t] = scores[indices[t * 3]] + scores[indices[t * 3 + 1]] +
+                        scores[indices[t * 3 + 2]];
+  }
+
+  std::vector<bool> emitted(triangleCount, false);
+  std::vector<unsigned int> output;
+  output.reserve(triangleCount * 3);
+  std::vector<unsigned int> cache, nextCache;
+  cache.reserve(cacheSize + 3);
+  nextCache.reserve(cacheSize + 3);
+  size_t scan = 0;
+  size_t best = 0;
+  float bestScore = triangleScores[0];
+  for (size_t t = 1; t < triangleCount; ++t)
+  {
+    if (triangleScores[t] > bestScore)
+    {
+      best = t;
+      bestScore = triangleScores[t];
+    }
+  }
+  while (output.size() < triangleCount * 3)
+  {
+    if (bestScore < 0.0f)
+    {
+      // nothing in the cache has triangles left, continue with the next
+      // unemitted triangle in input order
+      while (emitted[scan])
+      {
+        ++scan;
+      }
+      best = scan;
+    }
+    emitted[best] = true;
+    const unsigned int *triangle = &indices[best * 3];
+    nextCache.assign(triangle, triangle + 3);
+    for (int k = 0; k < 3; ++k)
+    {
+      unsigned int vertex = triangle[k];
+      output.push_back(vertex);
+      // drop the triangle from the vertex's remaining list
+      unsigned int *list = &vertexTriangles[offsets[vertex]];
+      unsigned int count = remaining[vertex];
+      for (unsigned int j = 0; j < count; ++j)
+      {
+        if (list[j] == best)
+        {
+          std::swap(list[j], list[count - 1]);
+          break;
+        }
+      }
+      --remaining[vertex];
+    }
+    for (unsigned int vertex : cache)
+    {
+      if (vertex != triangle[0] && vertex != triangle[1] &&
+          vertex != triangle[2])
+      {
+        nextCache.push_back(vertex);
+      }
+    }
+    // vertices pushed past the end leave the cache
+    for (size_t i = cacheSize; i < nextCache.size(); ++i)
+    {
+      cachePosition[nextCache[i]] = -1;
+      scores[nextCache[i]] = vertexScore(nextCache[i]);
+    }
+    if (nextCache.size() > (size_t)cacheSize)
+    {
+      nextCache.resize(cacheSize);
+    }
+    std::swap(cache, nextCache);
+    for (size_t i = 0; i < cache.size(); ++i)
+    {
+      cachePosition[cache[i]] = (int)i;
+      scores[cache[i]] = vertexScore(cache[i]);
+    }
+    // only triangles touching the cache changed score
+    bestScore = -1.0f;
+    for (unsigned int vertex : cache)
+    {
+      const unsigned int *list = &vertexTriangles[offsets[vertex]];
+      for (unsigned int j = 0; j < remaining[vertex]; ++j)
+      {
+        size_t t = list[j];
+        float score = scores[indices[t * 3]] + scores[indices[t * 3 + 1]] +
+                      scores[indices[t * 3 + 2]];
+        triangleScores[t] = score;
+        if (score > bestScore)
+        {
+          best = t;
+          bestScore = score;
+        }
+      }
+    }
+  }
+  std::memcpy(indices, output.data(), output.size() * sizeof(unsigned int));
+}
+
+// Reorders clusters of a cache optimized index buffer so triangles facing
+// outwards from the mesh centre are drawn first, which lets the depth test
+// reject more of what is behind them. Clusters are split where a triangle
+// misses the cache on all three vertices, so the cache behaviour inside each
+// cluster is preserved. positions points at the first vertex position,
+// stride is the byte distance between two vertices.
+inline void optimizeOverdraw(unsigned int *indices, size_t indexCount,
+                             const float *positions, size_t stride,
+                             size_t vertexCount, unsigned int cacheSize = 16)
+{
+  const size_t triangleCount = indexCount / 3;
+  if (triangleCount < 2)
+  {
+    return;
+  }
+  auto position = [&](unsigned int vertex) {
+    return reinterpret_cast<const float *>(
+        reinterpret_cast<const char *>(positions) + vertex * stride);
+  };
+  std::vector<size_t> clusterStarts;
+  std::vector<size_t> loadedAt(vertexCount, 0);
+  size_t time = cacheSize + 1;
+  for (size_t t = 0; t < triangleCount; ++t)
+  {
+    int misses = 0;
+    for (int k = 0; k < 3; ++k)
+    {
+      unsigned int vertex = indices[t * 3 + k];
+      if (time - loadedAt[vertex] > cacheSize)
+      {
+        loadedAt[vertex] = time++;
+        ++misses;
+      }
+    }
+    if (t == 0 || misses == 3)
+    {
+      clusterStarts.push_back(t);
+    }
+  }
+  clusterStarts.push_back(triangleCount);
+  const size_t clusterCount = clusterStarts.size() - 1;
+
+  // area weighted centroid and normal per cluster
+  std::vector<float> centroids(clusterCount * 3, 0.0f);
+  std::vector<float> normals(clusterCount * 3, 0.0f);
+  std::vector<float> areas(clusterCount, 0.0f);
+  float meshCentroid[3] = {0.0f, 0.0f, 0.0f};
+  float meshArea = 0.0f;
+  for (size_t c = 0; c < clusterCount; ++c)
+  {
+    for (size_t t = clusterStarts[c]; t < clusterStarts[c + 1]; ++t)
+    {
+      const float *a = position(indices[t * 3]);
+      const float *b = position(indices[t * 3 + 1]);
+      const float *d = position(indices[t * 3 + 2]);
+      float e1[3] = {b[0] - a[0], b[1] - a[1], b[2] - a[2]};
+      float e2[3] = {d[0] - a[0], d[1] - a[1], d[2] - a[2]};
+      float n[3] = {e1[1] * e2[2] - e1[2] * e2[1],
+                    e1[2] * e2[0] - e1[0] * e2[2],
+                    e1[0] * e2[1] - e1[1] * e2[0]};
+      float area = std::sqrt(n[0] * n[0] + n[1] * n[1] + n[2] * n[2]);
+      for (int k = 0; k < 3; ++k)
+      {
+        centroids[c * 3 + k] += (a[k] + b[k] + d[k]) / 3.0f * area;
+        normals[c * 3 + k] += n[k];
+      }
+      areas[c] += area;
+    }
+    for (int k = 0; k < 3; ++k)
+    {
+      meshCentroid[k] += centroids[c * 3 + k];
+    }
+    meshArea += areas[c];
+  }
+  if (meshArea > 0.0f)
+  {
+    for (int k = 0; k < 3; ++k)
+    {
+      meshCentroid[k] /= meshArea;
+    }
+  }
+  std::vector<float> keys(clusterCount);
+  for (size_t c = 0; c < clusterCount; ++c)
+  {
+    float key = 0.0f;
+    float length = std::sqrt(normals[c * 3] * normals[c * 3] +
+                             normals[c * 3 + 1] * normals[c * 3 + 1] +
+                             normals[c * 3 + 2] * normals[c * 3 + 2]);
+    if (areas[c] > 0.0f && length > 0.0f)
+    {
+      for (int k = 0; k < 3; ++k)
+      {
+        key += (centroids[c * 3 + k] / areas[c] - meshCentroid[k]) *
+               normals[c * 3 + k] / length;
+      }
+    }
+    keys[c] = key;
+  }
+  std::vector<size_t> order(clusterCount);
+  for (size_t c = 0; c < clusterCount; ++c)
+  {
+    order[c] = c;
+  }
+  std::stable_sort(order.begin(), order.end(),
+                   [&keys](size_t a, size_t b) { return keys[a] > keys[b]; });
+  std::vector<unsigned int> output;
+  output.reserve(triangleCount * 3);
+  for (size_t c : order)
+  {
+    output.insert(output.end(), indices + clusterStarts[c] * 3,
+                  indices + clusterStarts[c + 1] * 3);
+  }
+  std::memcpy(indices, output.data(), output.size() * sizeof(unsigned int));
+}
+
+// Reorders vertices in the order the index buffer first uses them so vertex
+// fetch walks memory linearly. Unused vertices are dropped.
+template <typename V>
+void optimizeVertexFetch(std::vector<V> &vertices,
+                         std::vector<unsigned int> &indices)
+{
+  const unsigned int unused = 0xFFFFFFFF;
+  std::vector<unsigned int> remap(vertices.size(), unused);
+  std::vector<V> reordered;
+  reordered.reserve(vertices.size());
+  for (auto &index : indices)
+  {
+    if (remap[index] == unused)
+    {
+      remap[index] = (unsigned int)reordered.size();
+      reordered.push_back(vertices[index]);
+    }
+    index = remap[index];
+  }
+  vertices.swap(reordered);
+}
+
+struct WeldStats
+{
+  size_t verticesBefore = 0;
+  size_t verticesAfter = 0;
+  size_t bytesSaved = 0;
+};
+
+// Merges duplicate vertices and rewrites the indices to the unique ones.
+// With epsilon 0 vertices must be bit identical (-0 and 0 match); otherwise
+// every float is snapped to a grid of epsilon and vertices landing in the
+// same cell merge into the first one seen. V must be made of floats only.
+template <typename V>
+WeldStats weldVertices(std::vector<V> &vertices,
+                       std::vector<unsigned int> &indices, float epsilon = 0.0f)
+{
+  static_assert(std::is_trivially_copyable<V>::value &&
+                    sizeof(V) % sizeof(float) == 0,
+                "vertices are compared as arrays of floats");
+  const size_t components = sizeof(V) / sizeof(float);
+  const size_t count = vertices.size();
+  WeldStats stats;
+  stats.verticesBefore = count;
+  stats.verticesAfter = count;
+  if (count == 0)
+  {
+    return stats;
+  }
+  // per vertex key words, compared instead of the floats themselves
+  std::vector<uint32_t> keys(count * components);
+  for (size_t i = 0; i < count; ++i)
+  {
+    const float *values = reinterpret_cast<const float *>(&vertices[i]);
+    uint32_t *key = &keys[i * components];
+    for (size_t k = 0; k < components; ++k)
+    {
+      float value = values[k];
+      if (epsilon > 0.0f)
+      {
+        key[k] = (uint32_t)(int32_t)std::floor(value / epsilon + 0.5f);
+      }
+      else
+      {
+        value = value == 0.0f ? 0.0f : value;
+        std::memcpy(&key[k], &value, sizeof(float));
+      }
+    }
+  }
+  auto hash = [&](size_t vertex) {
+    uint32_t h = 2166136261u;
+    const uint32_t *key = &keys[vertex * components];
+    for (size_t k = 0; k < components; ++k)
+    {
+      h = (h ^ key[k]) * 16777619u;
+      h ^= h >> 15;
+    }
+    return h;
+  };
+  // open addressing table of unique vertex indices, at most half full
+  size_t tableSize = 1;
+  while (tableSize < count * 2)
+  {
+    tableSize *= 2;
+  }
+  const unsigned int empty = 0xFFFFFFFF;
+  std::vector<unsigned int> table(tableSize, empty);
+  std::vector<unsigned int> remap(count);
+  std::vector<V> unique;
+  unique.reserve(count);
+  for (size_t i = 0; i < count; ++i)
+  {
+    size_t slot = hash(i) & (tableSize - 1);
+    while (table[slot] != empty &&
+           std::memcmp(&keys[table[slot] * components], &keys[i * components],
+                       components * sizeof(uint32_t)) != 0)
+    {
+      slot = (slot + 1) & (tableSize - 1);
+    }
+    if (table[slot] == empty)
+    {
+      table[slot] = (unsigned int)i;
+      remap[i] = (unsigned int)unique.size();
+      unique.push_back(vertices[i]);
+    }
+    else
+    {
+      remap[i] = remap[table[slot]];
+    }
+  }
+  for (auto &index : indices)
+  {
+    index = remap[index];
+  }
+  stats.verticesAfter = unique.size();
+  stats.bytesSaved = (count - unique.size()) * sizeof(V);
+  vertices.swap(unique);
+  return stats;
+}
+
+#endif
@@ -0,0 +1,533 @@
+#ifndef MESH_SIMPLIFIER_H
+#define MESH_SIMPLIFIER_H
+
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <unordered_map>
+#include <vector>
+
+// Symmetric 4x4 error quadric (Garland & Heckbert) of a set of weighted
+// planes, with the sum of their weights
+struct Quadric
+{
+  // a2 ab ac ad b2 bc bd c2 cd d2
+  double m[10] = {0, 0, 0, 0, 0, 0, 0, 0, 0, 0};
+  double weight = 0;
+
+  void addPlane(double a, double b, double c, double d, double weight)
+  {
+    addConstraint(a, b, c, d, weight);
+    this->weight += weight;
+  }
+  // a plane adding to the error but not to the weight it is averaged over,
+  // so it does not dilute the planes of the surface
+  void addConstraint(double a, double b, double c, double d, double weight)
+  {
+    m[0] += weight * a * a;
+    m[1] += weight * a * b;
+    m[2] += weight * a * c;
+    m[3] += weight * a * d;
+    m[4] += weight * b * b;
+    m[5] += weight * b * c;
+    m[6] += weight * b * d;
+    m[7] += weight * c * c;
+    m[8] += weight * c * d;
+    m[9] += weight * d * d;
+  }
+  void add(const Quadric &other)
+  {
+    for (int i = 0; i < 10; ++i)
+    {
+      m[i] += other.m[i];
+    }
+    weight += other.weight;
+  }
+  // sum of the weighted squared distances to the planes
+  double error(const float *p) const
+  {
+    double x = p[0], y = p[1], z = p[2];
+    double e = m[0] * x * x + 2 * m[1] * x * y + 2 * m[2] * x * z +
+               2 * m[3] * x + m[4] * y * y + 2 * m[5] * y * z + 2 * m[6] * y +
+               m[7] * z * z + 2 * m[8] * z + m[9];
+    return e > 0 ? e : 0;
+  }
+  // weighted mean of the squared distances, in squared object space units
+  // whatever the weights
+  double meanError(const float *p) const
+  {
+    return weight > 0 ? error(p) / weight : 0;
+  }
+};
+
+// Reduces a triangle list with quadric error edge collapses until it has at
+// most targetIndexCount indices or the next collapse would move the surface
+// further than targetError (object space units). Collapses move a vertex
+// onto one of its neighbours, so the kept vertices and their attributes are
+// unchanged and the result indexes the same vertex buffer. Vertices are
+// classified as in meshoptimizer: vertices on open borders only slide along
+// the border, and UV or normal seams (two vertices sharing a position) only
+// collapse along the seam, together with their twin on the other side. Any
+// other vertex sharing its position is locked, so the mesh has to be welded
+// first. Collapses bending the normal of a vertex or a triangle by more than
+// 60 degrees are rejected.
+// positions and normals point at the first vertex, stride is the byte
+// distance between vertices. Returns the index count written to
+// destination (which may alias indices); error receives the largest
+// collapse error, the root mean squared distance of the moved vertex to
+// the planes of both ends of its edge, with open edges adding a penalty for
+// leaving them.
+inline size_t simplifyMesh(unsigned int *destination, const unsigned int *indices,
+                           size_t indexCount, const float *positions,
+                           const float *normals, size_t stride,
+                           size_t vertexCount, size_t targetIndexCount,
+                           float targetError, float *error = nullptr)
+{
+  auto attribute = [stride](const float *base, unsigned int vertex) {
+    return reinterpret_cast<const float *>(
+        reinterpret_cast<const char *>(base) + vertex * stride);
+  };
+  auto position = [&](unsigned int vertex) {
+    return attribute(positions, vertex);
+  };
+  auto normal = [&](unsigned int vertex) {
+    return attribute(normals, vertex);
+  };
+  std::vector<unsigned int> result(indices, indices + indexCount);
+  float resultError = 0.0f;
+  const unsigned int NONE = 0xFFFFFFFF;
+
+  // positionId is the first vertex at the same position, wedge links the
+  // vertices sharing a position in a ring
+  std::vector<unsigned int> positionId(vertexCount);
+  std::vector<unsigned int> wedge(vertexCount);
+  {
+    struct PositionHash
+    {
+      size_t operator()(const std::vector<float> &p) const
+      {
+        uint32_t h[3];
+        std::memcpy(h, p.data(), sizeof(h));
+        return (h[0] * 73856093u) ^ (h[1] * 19349663u) ^ (h[2] * 83492791u);
+      }
+    };
+    std::unordered_map<std::vector<float>, unsigned int, PositionHash> ids;
+    for (unsigned int v = 0; v < vertexCount; ++v)
+    {
+      const float *p = position(v);
+      auto inserted = ids.insert({std::vector<float>(p, p + 3), v});
+      unsigned int first = inserted.first->second;
+      positionId[v] = first;
+      wedge[v] = inserted.second ? v : wedge[first];
+      wedge[first] = v;
+    }
+  }
+
+  // directed edges of the input by their first vertex
+  std::vector<unsigned int> edgeOffsets(vertexCount + 1, 0);
+  std::vector<unsigned int> edgeTargets(indexCount / 3 * 3);
+  for (size_t i = 0; i + 2 < indexCount; i += 3)
+  {
+    for (int k = 0; k < 3; ++k)
+    {
+      ++edgeOffsets[indices[i + k] + 1];
+    }
+  }
+  for (size_t v = 0; v < vertexCount; ++v)
+  {
+    edgeOffsets[v + 1] += edgeOffsets[v];
+  }
+  {
+    std::vector<unsigned int> cursor(edgeOffsets.begin(),
+                                     edgeOffsets.end() - 1);
+    for (size_t i = 0; i + 2 < indexCount; i += 3)
+    {
+      for (int k = 0; k < 3; ++k)
+      {
+        edgeTargets[cursor[indices[i + k]]++] = indices[i + (k + 1) % 3];
+      }
+    }
+  }
+  auto hasEdge = [&](unsigned int a, unsigned int b) {
+    for (unsigned int e = edgeOffsets[a]; e < edgeOffsets[a + 1]; ++e)
+    {
+      if (edgeTargets[e] == b)
+      {
+        return true;
+      }
+    }
+    return false;
+  };
+  // between any vertices at the positions of a and b
+  auto hasPositionEdge = [&](unsigned int a, unsigned int b) {
+    unsigned int v = a;
+    do
+    {
+      for (unsigned int e = edgeOffsets[v]; e < edgeOffsets[v + 1]; ++e)
+      {
+        if (positionId[edgeTargets[e]] == positionId[b])
+        {
+          return true;
+        }
+      }
+      v = wedge[v];
+    } while (v != a);
+    return false;
+  };
+
+  // the edge leaving and entering each vertex that has no opposite edge,
+  // NONE when there is none and the vertex itself when there are several
+  std::vector<unsigned int> openOut(vertexCount, NONE);
+  std::vector<unsigned int> openIn(vertexCount, NONE);
+  for (unsigned int v = 0; v < vertexCount; ++v)
+  {
+    for (unsigned int e = edgeOffsets[v]; e < edgeOffsets[v + 1]; ++e)
+    {
+      unsigned int t = edgeTargets[e];
+      if (!hasEdge(t, v))
+      {
+        openOut[v] = openOut[v] == NONE ? t : v;
+        openIn[t] = openIn[t] == NONE ? v : t;
+      }
+    }
+  }
+  enum Kind
+  {
+    Manifold,
+    Border,
+    Seam,
+    Locked
+  };
+  std::vector<Kind> kind(vertexCount, Locked);
+  auto singleOpen = [&](unsigned int v) {
+    return openIn[v] != NONE && openIn[v] != v && openOut[v] != NONE &&
+           openOut[v] != v;
+  };
+  for (unsigned int v = 0; v < vertexCount; ++v)
+  {
+    if (wedge[v] == v)
+    {
+      if (openIn[v] == NONE && openOut[v] == NONE)
+      {
+        kind[v] = Manifold;
+      }
+      // a seam ending here opens edges only between attributes
+      else if (singleOpen(v) && !hasPositionEdge(openOut[v], v) &&
+               !hasPositionEdge(v, openIn[v]))
+      {
+        kind[v] = Border;
+      }
+    }
+    else if (wedge[wedge[v]] == v)
+    {
+      // both sides of a seam have one open edge each way, running between
+      // the same positions in opposite directions
+      unsigned int twin = wedge[v];
+      if (singleOpen(v) && singleOpen(twin) &&
+          positionId[openIn[v]] == positionId[openOut[twin]] &&
+          positionId[openOut[v]] == positionId[openIn[twin]] &&
+          positionId[openIn[v]] != positionId[openOut[v]])
+      {
+        kind[v] = Seam;
+      }
+    }
+  }
+
+  // one quadric per position, so both sides of a seam share their planes
+  std::vector<Quadric> quadrics(vertexCount);
+  for (size_t i = 0; i + 2 < indexCount; i += 3)
+  {
+    const float *a = position(indices[i]);
+    const float *b = position(indices[i + 1]);
+    const float *c = position(indices[i + 2]);
+    double e1[3] = {b[0] - a[0], b[1] - a[1], b[2] - a[2]};
+    double e2[3] = {c[0] - a[0], c[1] - a[1], c[2] - a[2]};
+    double n[3] = {e1[1] * e2[2] - e1[2] * e2[1], e1[2] * e2[0] - e1[0] * e2[2],
+                   e1[0] * e2[1] - e1[1] * e2[0]};
+    double length = std::sqrt(n[0] * n[0] + n[1] * n[1] + n[2] * n[2]);
+    if (length == 0)
+    {
+      continue;
+    }
+    n[0] /= length;
+    n[1] /= length;
+    n[2] /= length;
+    double d = -(n[0] * a[0] + n[1] * a[1] + n[2] * a[2]);
+    // weighted by area so large triangles dominate; costs divide by the
+    // summed weight, which keeps them distances squared
+    for (int k = 0; k < 3; ++k)
+    {
+      quadrics[positionId[indices[i + k]]].addPlane(n[0], n[1], n[2], d,
+                                                    length * 0.5);
+    }
+    // open edges also keep to the plane through them at a right angle to
+    // the triangle, so borders and seams hold their outline
+    for (int k = 0; k < 3; ++k)
+    {
+      unsigned int from = indices[i + k];
+      unsigned int to = indices[i + (k + 1) % 3];
+      if (hasEdge(to, from))
+      {
+        continue;
+      }
+      const float *p = position(from);
+      const float *q = position(to);
+      double edge[3] = {q[0] - p[0], q[1] - p[1], q[2] - p[2]};
+      double side[3] = {edge[1] * n[2] - edge[2] * n[1],
+                        edge[2] * n[0] - edge[0] * n[2],
+                        edge[0] * n[1] - edge[1] * n[0]};
+      double sideLength =
+          std::sqrt(side[0] * side[0] + side[1] * side[1] + side[2] * side[2]);
+      if (sideLength == 0)
+      {
+        continue;
+      }
+      double sd = -(side[0] * p[0] + side[1] * p[1] + side[2] * p[2]) /
+                  sideLength;
+      // edge length squared, in the units of the triangle areas
+      double weight = 10.0 * sideLength * sideLength;
+      for (unsigned int v : {from, to})
+      {
+        quadrics[positionId[v]].addConstraint(side[0] / sideLength,
+                                         side[1] / sideLength,
+                                         side[2] / sideLength, sd, weight);
+      }
+    }
+  }
+
+  // a seam collapse moves twinFrom onto twinTo along the other side as well
+  struct Collapse
+  {
+    unsigned int from;
+    unsigned int to;
+    unsigned int twinFrom;
+    unsigned int twinTo;
+    double cost;
+  };
+  auto canCollapse = [&](unsigned int from, unsigned int to) {
+    switch (kind[from])
+    {
+    case Manifold:
+      return true;
+    case Border:
+    case Seam:
+      return (kind[to] == kind[from] || kind[to] == Locked) &&
+             (openOut[from] == to || openIn[from] == to);
+    default:
+      return false;
+    }
+  };
+  auto similarNormals = [&](unsigned int a, unsigned int b) {
+    const float *na = normal(a);
+    const float *nb = normal(b);
+    return na[0] * nb[0] + na[1] * nb[1] + na[2] * nb[2] >= 0.5f;
+  };
+  const double maxCost = (double)targetError * targetError;
+  std::vector<unsigned int> remap(vertexCount);
+  std::vector<bool> touched(vertexCount);
+  std::vector<unsigned int> offsets(vertexCount + 1);
+  std::vector<unsigned int> vertexTriangles;
+  std::vector<Collapse> collapses;
+  // counts the triangles around from that also use to, which the collapse
+  // removes; false when it would flip one of the others
+  auto keepsOrientation = [&](unsigned int from, unsigned int to,
+                              size_t &collapsed) {
+    const float *target = position(to);
+    for (unsigned int t = offsets[from]; t < offsets[from + 1]; ++t)
+    {
+      const unsigned int *triangle = &result[vertexTriangles[t] * 3];
+      if (triangle[0] == to || triangle[1] == to || triangle[2] == to)
+      {
+        ++collapsed;
+        continue;
+      }
+      const float *p[3], *q[3];
+      for (int k = 0; k < 3; ++k)
+      {
+        p[k] = position(triangle[k]);
+        q[k] = triangle[k] == from ? target : p[k];
+      }
+      double before[3], after[3];
+      for (int pass = 0; pass < 2; ++pass)
+      {
+        const float *const *v = pass == 0 ? p : q;
+        double e1[3] = {v[1][0] - v[0][0], v[1][1] - v[0][1],
+                        v[1][2] - v[0][2]};
+        double e2[3] = {v[2][0] - v[0][0], v[2][1] - v[0][1],
+                        v[2][2] - v[0][2]};
+        double *n = pass == 0 ? before : after;
+        n[0] = e1[1] * e2[2] - e1[2] * e2[1];
+        n[1] = e1[2] * e2[0] - e1[0] * e2[2];
+        n[2] = e1[0] * e2[1] - e1[1] * e2[0];
+      }
+      double dot = before[0] * after[0] + before[1] * after[1] +
+                   before[2] * after[2];
+      double lengths =
+          std::sqrt((before[0] * before[0] + before[1] * before[1] +
+                     before[2] * before[2]) *
+                    (after[0] * after[0] + after[1] * after[1] +
+                     after[2] * after[2]));
+      if (dot <= 0.5 * lengths)
+      {
+        return false;
+      }
+    }
+    return true;
+  };
+  auto touchRing = [&](unsigned int vertex) {
+    for (unsigned int t = offsets[vertex]; t < offsets[vertex + 1]; ++t)
+    {
+      const unsigned int *triangle = &result[vertexTriangles[t] * 3];
+      touched[triangle[0]] = touched[triangle[1]] = touched[triangle[2]] = true;
+    }
+  };
+  while (result.size() > targetIndexCount)
+  {
+    // triangles around each vertex
+    std::fill(offsets.begin(), offsets.end(), 0);
+    for (unsigned int vertex : result)
+    {
+      ++offsets[vertex + 1];
+    }
+    for (size_t v = 0; v < vertexCount; ++v)
+    {
+      offsets[v + 1] += offsets[v];
+    }
+    vertexTriangles.resize(result.size());
+    {
+      std::vector<unsigned int> cursor(offsets.begin(), offsets.end() - 1);
+      for (size_t i = 0; i < result.size(); ++i)
+      {
+        vertexTriangles[cursor[result[i]]++] = (unsigned int)(i / 3);
+      }
+    }
+
+    // cheapest collapse of every edge end that may move
+    collapses.clear();
+    for (size_t i = 0; i < result.size(); i += 3)
+    {
+      for (int k = 0; k < 3; ++k)
+      {
+        unsigned int from = result[i + k];
+        unsigned int to = result[i + (k + 1) % 3];
+        for (int direction = 0; direction < 2; ++direction)
+        {
+          if (canCollapse(from, to) && similarNormals(from, to))
+          {
+            unsigned int twinFrom = NONE, twinTo = NONE;
+            if (kind[from] == Seam)
+            {
+              twinFrom = wedge[from];
+              twinTo = openOut[from] == to ? openIn[twinFrom]
+                                           : openOut[twinFrom];
+            }
+            if (twinFrom == NONE ||
+                (twinTo != NONE && positionId[twinTo] == positionId[to] &&
+                 similarNormals(twinFrom, twinTo)))
+            {
+              // planes of both ends, as the merged vertex will carry
+              Quadric merged = quadrics[positionId[from]];
+              merged.add(quadrics[positionId[to]]);
+              collapses.push_back({from, to, twinFrom, twinTo,
+                                   merged.meanError(position(to))});
+            }
+          }
+          std::swap(from, to);
+        }
+      }
+    }
+    std::sort(collapses.begin(), collapses.end(),
+              [](const Collapse &a, const Collapse &b) {
+                return a.cost < b.cost;
+              });
+
+    // apply the cheapest ones that do not overlap, each removes about two
+    // triangles
+    for (size_t v = 0; v < vertexCount; ++v)
+    {
+      remap[v] = (unsigned int)v;
+    }
+    std::fill(touched.begin(), touched.end(), false);
+    size_t triangles = result.size() / 3;
+    size_t trianglesToRemove = triangles - targetIndexCount / 3;
+    size_t removed = 0;
+    size_t applied = 0;
+    for (const Collapse &collapse : collapses)
+    {
+      if (collapse.cost > maxCost || removed >= trianglesToRemove)
+      {
+        break;
+      }
+      bool seam = collapse.twinFrom != NONE;
+      if (touched[collapse.from] || touched[collapse.to] ||
+          (seam && (touched[collapse.twinFrom] || touched[collapse.twinTo])))
+      {
+        continue;
+      }
+      size_t collapsed = 0;
+      if (!keepsOrientation(collapse.from, collapse.to, collapsed) ||
+          (seam &&
+           !keepsOrientation(collapse.twinFrom, collapse.twinTo, collapsed)))
+      {
+        continue;
+      }
+      remap[collapse.from] = collapse.to;
+      if (seam)
+      {
+        remap[collapse.twinFrom] = collapse.twinTo;
+      }
+      quadrics[positionId[collapse.to]].add(
+          quadrics[positionId[collapse.from]]);
+      resultError = std::max(resultError, (float)std::sqrt(collapse.cost));
+      removed += collapsed;
+      ++applied;
+      // the one rings of the moved vertices are now stale for this pass
+      touchRing(collapse.from);
+      if (seam)
+      {
+        touchRing(collapse.twinFrom);
+      }
+    }
+    if (applied == 0)
+    {
+      break;
+    }
+    // open edges pointing at a moved vertex follow it; when it moved onto
+    // the vertex the edge starts from, the edge continues past it
+    for (std::vector<unsigned int> *open : {&openOut, &openIn})
+    {
+      for (unsigned int v = 0; v < vertexCount; ++v)
+      {
+        unsigned int next = (*open)[v];
+        if (next != NONE)
+        {
+          (*open)[v] = remap[next] == v ? (*open)[next] : remap[next];
+        }
+      }
+    }
+    size_t write = 0;
+    for (size_t i = 0; i < result.size(); i += 3)
+    {
+      unsigned int a = remap[result[i]];
+      unsigned int b = remap[result[i + 1]];
+      unsigned int c = remap[result[i + 2]];
+      if (a != b && b != c && a != c)
+      {
+        result[write++] = a;
+        result[write++] = b;
+        result[write++] = c;
+      }
+    }
+    result.resize(write);
+  }
+  std::memcpy(destination, result.data(), result.size() * sizeof(unsigned int));
+  if (error)
+  {
+    *error = resultError;
+  }
+  return result.size();
+}
+
+#endif
@@ -0,0 +1,167 @@
+#ifndef MESHLET_H
+#define MESHLET_H
+
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// Contiguous run of triangles of an index buffer with the data needed to
+// cull it as a whole. All values are in the mesh's object space.
+struct Meshlet
+{
+  uint32_t indexOffset;
+  uint32_t triangleCount;
+  uint32_t vertexCount;
+  // bounding sphere
+  float center[3];
+  float radius;
+  // every triangle normal lies within the cone around axis; cutoff is the
+  // sine of its half angle, 1 when the triangles face too many ways to cull
+  float coneAxis[3];
+  float coneCutoff;
+};
+
+// Splits an index buffer into meshlets of at most maxVertices unique
+// vertices and maxTriangles triangles. Triangles are taken in buffer order,
+// so run the vertex cache optimizer first to get compact meshlets.
+inline std::vector<Meshlet> buildMeshlets(const unsigned int *indices,
+                                          size_t indexCount,
+                                          const float *positions,
+                                          size_t stride, size_t vertexCount,
+                                          size_t maxVertices = 64,
+                                          size_t maxTriangles = 124)
+{
+  auto position = [&](unsigned int vertex) {
+    return reinterpret_cast<const float *>(
+        reinterpret_cast<const char *>(positions) + vertex * stride);
+  };
+  std::vector<Meshlet> meshlets;
+  // meshlet each vertex was last counted in
+  std::vector<uint32_t> seenIn(vertexCount, 0xFFFFFFFF);
+  std::vector<unsigned int> vertices;
+  vertices.reserve(maxVertices);
+  size_t start = 0;
+  auto finish = [&](size_t end) {
+    Meshlet meshlet;
+    meshlet.indexOffset = (uint32_t)start;
+    meshlet.triangleCount = (uint32_t)((end - start) / 3);
+    meshlet.vertexCount = (uint32_t)vertices.size();
+    // sphere around the box centre
+    float lo[3] = {INFINITY, INFINITY, INFINITY};
+    float hi[3] = {-INFINITY, -INFINITY, -INFINITY};
+    for (unsigned int vertex : vertices)
+    {
+      const float *p = position(vertex);
+      for (int k = 0; k < 3; ++k)
+      {
+        lo[k] = std::min(lo[k], p[k]);
+        hi[k] = std::max(hi[k], p[k]);
+      }
+    }
+    float radius2 = 0.0f;
+    for (int k = 0; k < 3; ++k)
+    {
+      meshlet.center[k] = (lo[k] + hi[k]) * 0.5f;
+    }
+    for (unsigned int vertex : vertices)
+    {
+      const float *p = position(vertex);
+      float dx = p[0] - meshlet.center[0], dy = p[1] - meshlet.center[1],
+            dz = p[2] - meshlet.center[2];
+      radius2 = std::max(radius2, dx * dx + dy * dy + dz * dz);
+    }
+    meshlet.radius = std::sqrt(radius2);
+    // normal cone
+    std::vector<float> normals;
+    normals.reserve(meshlet.triangleCount * 3);
+    float axis[3] = {0.0f, 0.0f, 0.0f};
+    for (size_t i = start; i < end; i += 3)
+    {
+      const float *a = position(indices[i]);
+      const float *b = position(indices[i + 1]);
+      const float *c = position(indices[i + 2]);
+      float e1[3] = {b[0] - a[0], b[1] - a[1], b[2] - a[2]};
+      float e2[3] = {c[0] - a[0], c[1] - a[1], c[2] - a[2]};
+      float n[3] = {e1[1] * e2[2] - e1[2] * e2[1],
+                    e1[2] * e2[0] - e1[0] * e2[2],
+                    e1[0] * e2[1] - e1[1] * e2[0]};
+      float length = std::sqrt(n[0] * n[0] + n[1] * n[1] + n[2] * n[2]);
+      if (length == 0.0f)
+      {
+        continue;
+      }
+      for (int k = 0; k < 3; ++k)
+      {
+        normals.push_back(n[k] / length);
+        axis[k] += n[k] / length;
+      }
+    }
+    float axisLength =
+        std::sqrt(axis[0] * axis[0] + axis[1] * axis[1] + axis[2] * axis[2]);
+    float minDot = 1.0f;
+    for (int k = 0; k < 3; ++k)
+    {
+      meshlet.coneAxis[k] = axisLength > 0.0f ? axis[k] / axisLength : 0.0f;
+    }
+    for (size_t i = 0; i < normals.size(); i += 3)
+    {
+      minDot = std::min(minDot, normals[i] * meshlet.coneAxis[0] +
+                                    normals[i + 1] * meshlet.coneAxis[1] +
+                                    normals[i + 2] * meshlet.coneAxis[2]);
+    }
+    // widen the cone by 90 degrees to get the back facing view directions
+    meshlet.coneCutoff = (axisLength == 0.0f || minDot <= 0.0f)
+                             ? 1.0f
+                             : std::sqrt(1.0f - minDot * minDot);
+    meshlets.push_back(meshlet);
+    vertices.clear();
+    start = end;
+  };
+  for (size_t i = 0; i + 2 < indexCount; i += 3)
+  {
+    uint32_t current = (uint32_t)meshlets.size();
+    size_t added = 0;
+    for (int k = 0; k < 3; ++k)
+    {
+      added += seenIn[indices[i + k]] != current;
+    }
+    if (vertices.size() + added > maxVertices ||
+        (i - start) / 3 + 1 > maxTriangles)
+    {
+      finish(i);
+      current = (uint32_t)meshlets.size();
+    }
+    for (int k = 0; k < 3; ++k)
+    {
+      unsigned int vertex = indices[i + k];
+      if (seenIn[vertex] != current)
+      {
+        seenIn[vertex] = current;
+        vertices.push_back(vertex);
+      }
+    }
+  }
+  if (start < indexCount - indexCount % 3)
+  {
+    finish(indexCount - indexCount % 3);
+  }
+  return meshlets;
+}
+
+// True when every triangle of the meshlet faces away from a camera at
+// cameraPosition (object space)
+inline bool meshletBackfacing(const Meshlet &meshlet,
+                              const float *cameraPosition)
+{
+  float d[3] = {meshlet.center[0] - cameraPosition[0],
+                meshlet.center[1] - cameraPosition[1],
+                meshlet.center[2] - cameraPosition[2]};
+  float distance = std::sqrt(d[0] * d[0] + d[1] * d[1] + d[2] * d[2]);
+  return d[0] * meshlet.coneAxis[0] + d[1] * meshlet.coneAxis[1] +
+             d[2] * meshlet.coneAxis[2] >=
+         meshlet.coneCutoff * distance + meshlet.radius;
+}
+
+#endif
@@ -0,0 +1,96 @@
+#ifndef POOL_H
+#define POOL_H
+
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <vector>
+
+// Generational index into a Pool. A handle stays valid until its slot is
+// removed; a reused slot bumps the generation so stale handles are detected.
+template <typename T>
+struct Handle
+{
+  static constexpr uint32_t INVALID = 0xFFFFFFFF;
+  uint32_t index = INVALID;
+  uint32_t generation = 0;
+
+  bool valid() const { return index != INVALID; }
+  bool operator==(const Handle &other) const
+  {
+    return index == other.index && generation == other.generation;
+  }
+  bool operator!=(const Handle &other) const { return !(*this == other); }
+};
+
+// Storage addressed by Handle. Items keep their slot for their whole life,
+// so lookups are a bounds and generation check followed by an index. The
+// slots live in a deque, so adding never moves an item: references stay
+// valid until the item itself is removed.
+template <typename T>
+class Pool
+{
+public:
+  Handle<T> add(T item)
+  {
+    Handle<T> handle;
+    if (!freeSlots.empty())
+    {
+      handle.index = freeSlots.back();
+      freeSlots.pop_back();
+      items[handle.index] = std::move(item);
+      alive[handle.index] = true;
+    }
+    else
+    {
+      handle.index = (uint32_t)items.size();
+      items.push_back(std::move(item));
+      generations.push_back(0);
+      alive.push_back(true);
+    }
+    handle.generation = generations[handle.index];
+    return handle;
+  }
+  void remove(Handle<T> handle)
+  {
+    if (!contains(handle))
+    {
+      return;
+    }
+    items[handle.index] = T();
+    alive[handle.index] = false;
+    ++generations[handle.index];
+    freeSlots.push_back(handle.index);
+  }
+  bool contains(Handle<T> handle) const
+  {
+    return handle.index < items.size() && alive[handle.index] &&
+           generations[handle.index] == handle.generation;
+  }
+  const T &get(Handle<T> handle) const { return items[handle.index]; }
+  T &get(Handle<T> handle) { return items[handle.index]; }
+  const T &operator[](Handle<T> handle) const { return items[handle.index]; }
+  T &operator[](Handle<T> handle) { return items[handle.index]; }
+  // number of live items
+  size_t size() const { return items.size() - freeSlots.size(); }
+  // number of slots, live or not; slot i is addressed by handleAt(i)
+  size_t capacity() const { return items.size(); }
+  Handle<T> handleAt(uint32_t index) const
+  {
+    Handle<T> handle;
+    if (index < items.size() && alive[index])
+    {
+      handle.index = index;
+      handle.generation = generations[index];
+    }
+    return handle;
+  }
+
+private:
+  std::deque<T> items;
+  std::vector<uint32_t> generations;
+  std::vector<bool> alive;
+  std::vector<uint32_t> freeSlots;
+};
+
+#endif
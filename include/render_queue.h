@@ -0,0 +1,240 @@
+#ifndef RENDER_QUEUE_H
+#define RENDER_QUEUE_H
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <functional>
+#include <vector>
+#include <job_system.h>
+
+// Draw order as one 64 bit integer, most significant bits first:
+//   opaque:      pass 4 | 0 | shader 11 | material 16 | depth 32
+//   translucent: pass 4 | 1 | inverted depth 32 | shader 11 | material 16
+// Opaque draws group by state and go front to back within a material;
+// translucent ones go back to front.
+const int SORT_KEY_PASS_BITS = 4;
+const int SORT_KEY_SHADER_BITS = 11;
+const int SORT_KEY_MATERIAL_BITS = 16;
+
+// depth is a non-negative view depth; its float bits order like the value
+inline uint64_t makeSortKey(uint32_t pass, bool translucent, uint32_t shader,
+                            uint32_t material, float depth)
+{
+  const uint32_t maxShader = (1u << SORT_KEY_SHADER_BITS) - 1;
+  const uint32_t maxMaterial = (1u << SORT_KEY_MATERIAL_BITS) - 1;
+  const uint32_t maxPass = (1u << SORT_KEY_PASS_BITS) - 1;
+  shader = shader < maxShader ? shader : maxShader;
+  material = material < maxMaterial ? material : maxMaterial;
+  pass = pass < maxPass ? pass : maxPass;
+  depth = depth > 0.0f ? depth : 0.0f;
+  uint32_t depthBits;
+  std::memcpy(&depthBits, &depth, sizeof(float));
+  uint64_t key = (uint64_t)pass << 60;
+  if (translucent)
+  {
+    return key | 1ull << 59 | (uint64_t)~depthBits << 27 |
+           (uint64_t)shader << 16 | material;
+  }
+  return key | (uint64_t)shader << 48 | (uint64_t)material << 32 | depthBits;
+}
+
+struct SortItem
+{
+  uint64_t key;
+  uint32_t index;
+};
+
+// Stable LSD radix sort on the keys, 8 bits per pass. Bytes that are the
+// same in every key are skipped, so a frame with one pass and few shaders
+// usually needs 5 or 6 passes instead of 8.
+inline void radixSort(std::vector<SortItem> &items,
+                      std::vector<SortItem> &scratch)
+{
+  const size_t count = items.size();
+  if (count < 2)
+  {
+    return;
+  }
+  scratch.resize(count);
+  size_t histograms[8][256] = {};
+  for (const SortItem &item : items)
+  {
+    for (int byte = 0; byte < 8; ++byte)
+    {
+      ++histograms[byte][(item.key >> (byte * 8)) & 0xFF];
+    }
+  }
+  for (int byte = 0; byte < 8; ++byte)
+  {
+    size_t *histogram = histograms[byte];
+    if (histogram[(items[0].key >> (byte * 8)) & 0xFF] == count)
+    {
+      continue;
+    }
+    size_t offset = 0;
+    for (int bucket = 0; bucket < 256; ++bucket)
+    {
+      size_t bucketCount = histogram[bucket];
+      histogram[bucket] = offset;
+      offset += bucketCount;
+    }
+    for (const SortItem &item : items)
+    {
+      scratch[histogram[(item.key >> (byte * 8)) & 0xFF]++] = item;
+    }
+    items.swap(scratch);
+  }
+}
+
+// Translucent draws sort on view depth alone. depth is clamped at zero so
+// its float bits order like the value, and inverted so the farthest draw
+// has the smallest key.
+inline uint32_t backToFrontKey(float depth)
+{
+  depth = depth > 0.0f ? depth : 0.0f;
+  uint32_t depthBits;
+  std::memcpy(&depthBits, &depth, sizeof(float));
+  return ~depthBits;
+}
+
+struct DepthSortItem
+{
+  uint32_t key;
+  uint32_t index;
+};
+
+// Stable LSD radix sort on 32 bit keys, 11 bits per pass, split over the
+// job system. The first read counts every digit of every range at once;
+// those counts decide which digits are the same in every key and get
+// skipped. Each pass then cuts the items into one range per thread, one
+// prefix sum over all counts gives every range its place in each bucket,
+// and the ranges scatter in parallel. A single range needs no other read,
+// since the counts of the whole array do not depend on its order; several
+// ranges recount each later digit in the order the previous pass left.
+// Without jobs, or with few items, it runs on the calling thread.
+// The scatters into 2048 buckets dominate. In transparent_sort_benchmark a
+// million sprites take about 12 ms on one core, so a millisecond is out of
+// reach of any core count a frame can spare; 8 bit digits were twice as
+// slow.
+class ParallelRadixSort
+{
+public:
+  void sort(std::vector<DepthSortItem> &items, JobSystem *jobs = nullptr)
+  {
+    const size_t count = items.size();
+    if (count < 2)
+    {
+      return;
+    }
+    scratch.resize(count);
+    size_t ranges = 1;
+    if (jobs)
+    {
+      ranges = std::min<size_t>(jobs->threadCount() + 1,
+                                (count + MIN_RANGE - 1) / MIN_RANGE);
+      ranges = std::max<size_t>(ranges, 1);
+    }
+    const size_t rangeSize = (count + ranges - 1) / ranges;
+    histograms.resize(ranges * DIGITS * BUCKETS);
+    auto histogram = [&](size_t range, int digit) {
+      return &histograms[(range * DIGITS + digit) * BUCKETS];
+    };
+    run(jobs, ranges, [&](size_t range) {
+      std::fill(histogram(range, 0), histogram(range, 0) + DIGITS * BUCKETS,
+                0);
+      uint32_t *counts[DIGITS];
+      for (int digit = 0; digit < DIGITS; ++digit)
+      {
+        counts[digit] = histogram(range, digit);
+      }
+      size_t end = std::min(count, (range + 1) * rangeSize);
+      for (size_t i = range * rangeSize; i < end; ++i)
+      {
+        uint32_t key = items[i].key;
+        for (int digit = 0; digit < DIGITS; ++digit)
+        {
+          ++counts[digit][(key >> (digit * DIGIT_BITS)) & (BUCKETS - 1)];
+        }
+      }
+    });
+    for (int digit = 0; digit < DIGITS; ++digit)
+    {
+      const int shift = digit * DIGIT_BITS;
+      bool constantDigit = false;
+      for (size_t bucket = 0; bucket < BUCKETS && !constantDigit; ++bucket)
+      {
+        size_t total = 0;
+        for (size_t range = 0; range < ranges; ++range)
+        {
+          total += histogram(range, digit)[bucket];
+        }
+        constantDigit = total == count;
+      }
+      if (constantDigit)
+      {
+        continue;
+      }
+      const DepthSortItem *source = items.data();
+      DepthSortItem *target = scratch.data();
+      if (digit > 0 && ranges > 1)
+      {
+        run(jobs, ranges, [&](size_t range) {
+          uint32_t *counts = histogram(range, digit);
+          std::fill(counts, counts + BUCKETS, 0);
+          size_t end = std::min(count, (range + 1) * rangeSize);
+          for (size_t i = range * rangeSize; i < end; ++i)
+          {
+            ++counts[(source[i].key >> shift) & (BUCKETS - 1)];
+          }
+        });
+      }
+      // bucket by bucket, the ranges in order keep equal keys stable
+      uint32_t offset = 0;
+      for (size_t bucket = 0; bucket < BUCKETS; ++bucket)
+      {
+        for (size_t range = 0; range < ranges; ++range)
+        {
+          uint32_t bucketCount = histogram(range, digit)[bucket];
+          histogram(range, digit)[bucket] = offset;
+          offset += bucketCount;
+        }
+      }
+      run(jobs, ranges, [&](size_t range) {
+        uint32_t *offsets = histogram(range, digit);
+        size_t end = std::min(count, (range + 1) * rangeSize);
+        for (size_t i = range * rangeSize; i < end; ++i)
+        {
+          target[offsets[(source[i].key >> shift) & (BUCKETS - 1)]++] =
+              source[i];
+        }
+      });
+      items.swap(scratch);
+    }
+  }
+
+private:
+  static const int DIGIT_BITS = 11;
+  static const int DIGITS = (32 + DIGIT_BITS - 1) / DIGIT_BITS;
+  static const size_t BUCKETS = (size_t)1 << DIGIT_BITS;
+  // smaller ranges cost more in waking workers than they save
+  static const size_t MIN_RANGE = 16384;
+  static void run(JobSystem *jobs, size_t ranges,
+                  const std::function<void(size_t)> &job)
+  {
+    if (jobs && ranges > 1)
+    {
+      jobs->parallelFor(ranges, job);
+      return;
+    }
+    for (size_t range = 0; range < ranges; ++range)
+    {
+      job(range);
+    }
+  }
+  std::vector<DepthSortItem> scratch;
+  std::vector<uint32_t> histograms;
+};
+
+#endif
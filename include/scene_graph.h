@@ -0,0 +1,149 @@
+#ifndef SCENE_GRAPH_H
+#define SCENE_GRAPH_H
+
+#include <glm/glm.hpp>
+#include <glm/gtc/quaternion.hpp>
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// Node hierarchy stored as flat arrays with every parent before its
+// children, so world matrices are refreshed by one forward pass that only
+// recomputes the subtrees below nodes whose transform changed.
+class SceneGraph
+{
+public:
+  static constexpr uint32_t NO_PARENT = 0xFFFFFFFF;
+
+  // parent must be NO_PARENT or an existing node
+  uint32_t addNode(uint32_t parent, const glm::vec3 &translation,
+                   const glm::quat &rotation, const glm::vec3 &scale,
+                   const std::string &name = "")
+  {
+    uint32_t index = (uint32_t)parents.size();
+    parents.push_back(parent < index ? parent : NO_PARENT);
+    translations.push_back(translation);
+    rotations.push_back(rotation);
+    scales.push_back(scale);
+    locals.push_back(glm::mat4(1.0f));
+    worlds.push_back(glm::mat4(1.0f));
+    dirty.push_back(LOCAL_CHANGED);
+    names.push_back(name);
+    anyDirty = true;
+    return index;
+  }
+  // local matrix split into translation, rotation and scale (no shear)
+  uint32_t addNode(uint32_t parent, const glm::mat4 &local,
+                   const std::string &name = "")
+  {
+    glm::vec3 translation(local[3]);
+    glm::vec3 scale(glm::length(glm::vec3(local[0])),
+                    glm::length(glm::vec3(local[1])),
+                    glm::length(glm::vec3(local[2])));
+    glm::mat3 rotation(glm::vec3(local[0]) / scale.x,
+                       glm::vec3(local[1]) / scale.y,
+                       glm::vec3(local[2]) / scale.z);
+    // mirrored transforms keep a proper rotation and a negative scale
+    if (glm::dot(glm::cross(rotation[0], rotation[1]), rotation[2]) < 0.0f)
+    {
+      scale.x = -scale.x;
+      rotation[0] = -rotation[0];
+    }
+    return addNode(parent, translation, glm::quat_cast(rotation), scale, name);
+  }
+  size_t size() const { return parents.size(); }
+  uint32_t parent(uint32_t node) const { return parents[node]; }
+  const std::string &name(uint32_t node) const { return names[node]; }
+  // first node with that name, NO_PARENT when there is none
+  uint32_t find(const std::string &name) const
+  {
+    auto found = std::find(names.begin(), names.end(), name);
+    return found == names.end() ? NO_PARENT
+                                : (uint32_t)(found - names.begin());
+  }
+
+  const glm::vec3 &translation(uint32_t node) const
+  {
+    return translations[node];
+  }
+  const glm::quat &rotation(uint32_t node) const { return rotations[node]; }
+  const glm::vec3 &scale(uint32_t node) const { return scales[node]; }
+  void setTranslation(uint32_t node, const glm::vec3 &translation)
+  {
+    translations[node] = translation;
+    markDirty(node);
+  }
+  void setRotation(uint32_t node, const glm::quat &rotation)
+  {
+    rotations[node] = rotation;
+    markDirty(node);
+  }
+  void setScale(uint32_t node, const glm::vec3 &scale)
+  {
+    scales[node] = scale;
+    markDirty(node);
+  }
+  // valid after update()
+  const glm::mat4 &local(uint32_t node) const { return locals[node]; }
+  const glm::mat4 &world(uint32_t node) const { return worlds[node]; }
+
+  // Recomputes the world matrix of every changed node and its descendants.
+  // Returns the number of world matrices written.
+  size_t update()
+  {
+    if (!anyDirty)
+    {
+      return 0;
+    }
+    size_t updated = 0;
+    const size_t count = parents.size();
+    for (size_t i = 0; i < count; ++i)
+    {
+      uint32_t parent = parents[i];
+      if (!dirty[i] && parent != NO_PARENT && dirty[parent])
+      {
+        dirty[i] = PARENT_CHANGED;
+      }
+      if (!dirty[i])
+      {
+        continue;
+      }
+      if (dirty[i] == LOCAL_CHANGED)
+      {
+        glm::mat4 m = glm::mat4_cast(rotations[i]);
+        m[0] *= scales[i].x;
+        m[1] *= scales[i].y;
+        m[2] *= scales[i].z;
+        m[3] = glm::vec4(translations[i], 1.0f);
+        locals[i] = m;
+      }
+      worlds[i] = parent == NO_PARENT ? locals[i] : worlds[parent] * locals[i];
+      ++updated;
+    }
+    std::fill(dirty.begin(), dirty.end(), (uint8_t)0);
+    anyDirty = false;
+    return updated;
+  }
+
+private:
+  static constexpr uint8_t LOCAL_CHANGED = 1;
+  static constexpr uint8_t PARENT_CHANGED = 2;
+  void markDirty(uint32_t node)
+  {
+    dirty[node] = LOCAL_CHANGED;
+    anyDirty = true;
+  }
+  std::vector<uint32_t> parents;
+  std::vector<glm::vec3> translations;
+  std::vector<glm::quat> rotations;
+  std::vector<glm::vec3> scales;
+  std::vector<glm::mat4> locals;
+  std::vector<glm::mat4> worlds;
+  std::vector<uint8_t> dirty;
+  std::vector<std::string> names;
+  bool anyDirty = false;
+};
+
+#endif
@@ -0,0 +1,146 @@
+#ifndef VERTEX_CONVERSION_H
+#define VERTEX_CONVERSION_H
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+
+#if defined(__SSE2__) || defined(_M_X64) || \
+    (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define VERTEX_CONVERSION_SSE 1
+#endif
+
+// Bulk converters from importer style attribute arrays (tightly packed
+// float3 positions, normals and texture coordinates, as Assimp stores them)
+// into GPU vertex layouts. They only write to the output, so it can be a
+// pre-sized vector or a mapped buffer.
+
+// One vertex: position (3), normal (3), texture coordinates (2)
+const size_t INTERLEAVED_VERTEX_FLOATS = 8;
+
+inline void interleaveVerticesScalar(const float *positions,
+                                     const float *normals,
+                                     const float *texCoords, size_t begin,
+                                     size_t end, float *out)
+{
+  for (size_t i = begin; i < end; ++i)
+  {
+    float *vertex = out + i * INTERLEAVED_VERTEX_FLOATS;
+    vertex[0] = positions[i * 3];
+    vertex[1] = positions[i * 3 + 1];
+    vertex[2] = positions[i * 3 + 2];
+    vertex[3] = normals ? normals[i * 3] : 0.0f;
+    vertex[4] = normals ? normals[i * 3 + 1] : 0.0f;
+    vertex[5] = normals ? normals[i * 3 + 2] : 0.0f;
+    vertex[6] = texCoords ? texCoords[i * 3] : 0.0f;
+    vertex[7] = texCoords ? texCoords[i * 3 + 1] : 0.0f;
+  }
+}
+
+#ifdef VERTEX_CONVERSION_SSE
+// Outputs at least this many vertices (8 MiB) long are written with non
+// temporal stores; smaller ones are likely read again while still cached
+const size_t STREAMING_VERTEX_COUNT = 1 << 18;
+
+// Two 16 byte stores per vertex built from unaligned loads of each source
+// array. Large 16 byte aligned destinations are written around the cache.
+inline void interleaveVerticesSSE(const float *positions, const float *normals,
+                                  const float *texCoords, size_t count,
+                                  float *out)
+{
+  if (count == 0)
+  {
+    return;
+  }
+  if (!normals || !texCoords)
+  {
+    interleaveVerticesScalar(positions, normals, texCoords, 0, count, out);
+    return;
+  }
+  // every load reads one float past its vertex, so the last one is scalar
+  const size_t wide = count - 1;
+  const bool stream =
+      ((uintptr_t)out & 15) == 0 && count >= STREAMING_VERTEX_COUNT;
+  for (size_t i = 0; i < wide; ++i)
+  {
+    __m128 p = _mm_loadu_ps(positions + i * 3); // px py pz -
+    __m128 n = _mm_loadu_ps(normals + i * 3);   // nx ny nz -
+    __m128 t = _mm_loadu_ps(texCoords + i * 3); // u v - -
+    __m128 zn = _mm_shuffle_ps(p, n, _MM_SHUFFLE(0, 0, 2, 2)); // pz pz nx nx
+    __m128 first = _mm_shuffle_ps(p, zn, _MM_SHUFFLE(2, 0, 1, 0));
+    __m128 second = _mm_shuffle_ps(n, t, _MM_SHUFFLE(1, 0, 2, 1));
+    float *vertex = out + i * INTERLEAVED_VERTEX_FLOATS;
+    if (stream)
+    {
+      _mm_stream_ps(vertex, first);
+      _mm_stream_ps(vertex + 4, second);
+    }
+    else
+    {
+      _mm_storeu_ps(vertex, first);
+      _mm_storeu_ps(vertex + 4, second);
+    }
+  }
+  if (stream)
+  {
+    _mm_sfence();
+  }
+  interleaveVerticesScalar(positions, normals, texCoords, wide, count, out);
+}
+#endif
+
+// Writes count interleaved vertices to out (count * 8 floats). normals and
+// texCoords may be null and are then zero filled.
+inline void interleaveVertices(const float *positions, const float *normals,
+                               const float *texCoords, size_t count, float *out)
+{
+#ifdef VERTEX_CONVERSION_SSE
+  interleaveVerticesSSE(positions, normals, texCoords, count, out);
+#else
+  interleaveVerticesScalar(positions, normals, texCoords, 0, count, out);
+#endif
+}
+
+// Separate attribute streams: positions and normals are already in GPU
+// layout and are copied as is, texture coordinates drop their third float
+inline void splitVertices(const float *positions, const float *normals,
+                          const float *texCoords, size_t count,
+                          float *outPositions, float *outNormals,
+                          float *outTexCoords)
+{
+  std::memcpy(outPositions, positions, count * 3 * sizeof(float));
+  if (normals)
+  {
+    std::memcpy(outNormals, normals, count * 3 * sizeof(float));
+  }
+  else
+  {
+    std::memset(outNormals, 0, count * 3 * sizeof(float));
+  }
+  for (size_t i = 0; i < count; ++i)
+  {
+    outTexCoords[i * 2] = texCoords ? texCoords[i * 3] : 0.0f;
+    outTexCoords[i * 2 + 1] = texCoords ? texCoords[i * 3 + 1] : 0.0f;
+  }
+}
+
+// Flattens triangle faces given as (index count, index pointer) pairs into
+// out, which must hold 3 indices per face. Faces that are not triangles are
+// skipped. Returns the number of indices written.
+template <typename Face>
+size_t flattenTriangles(const Face *faces, size_t faceCount, unsigned int *out)
+{
+  size_t written = 0;
+  for (size_t i = 0; i < faceCount; ++i)
+  {
+    if (faces[i].mNumIndices == 3)
+    {
+      std::memcpy(out + written, faces[i].mIndices, 3 * sizeof(unsigned int));
+      written += 3;
+    }
+  }
+  return written;
+}
+
+#endif
@@ -76,19 +76,37 @@ int main()
   glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
 
   auto renderer = std::make_unique<Renderer>();
+  // every mesh lands in the same buffers, so draws of different meshes can
+  // share a multi draw call
+  renderer->setSharedBuffers(true);
   auto resourceManager = std::make_unique<ResourceManager>(*renderer);
   ModelLoader modelLoader = ModelLoader(*resourceManager);
+  ImportOptions importOptions;
+  importOptions.optimizeMeshes = true;
+  importOptions.generateLods = true;
+  importOptions.buildMeshlets = true;
+  modelLoader.setImportOptions(importOptions);
+  // the backpack is only drawn, nothing reads its vertices back
+  modelLoader.setCpuMeshData(CpuMeshData::Release);
 
-  Model backpackModel =
-      modelLoader.loadModel("./texture/backpack/backpack.obj");
-  for (auto &mesh : backpackModel.meshes)
-  {
-    renderer->createBuffer(mesh);
-  }
+  // the window opens right away; a checker box stands in for the backpack
+  // until the first meshes arrive. Once the mesh cache exists the meshes
+  // stream in coarse first, and textures stream in alongside.
+  auto backpackModel = modelLoader.loadModelStreaming(
+      "./texture/backpack/backpack.obj",
+      [&resourceManager](AsyncModel &model) {
+        resourceManager->printTextureReport();
+        ModelLoader::printMemoryReport(model.model);
+      });
   std::shared_ptr<Shader> lightShader(
       new Shader("./shader/vLight.glsl", "./shader/fModel.glsl"));
   std::shared_ptr<Shader> dLightShader(
       new Shader("./shader/vLight.glsl", "./shader/fWhite.glsl"));
+  // same shaders reading the model matrix per instance
+  Shader lightShaderInstanced("./shader/vLightInstanced.glsl",
+                              "./shader/fModel.glsl");
+  Shader dLightShaderInstanced("./shader/vLightInstanced.glsl",
+                               "./shader/fWhite.glsl");
 
   std::vector<Image> images = {
       Image("./texture/container2.png", false),
@@ -109,7 +127,23 @@ int main()
   Mesh mesh = createCube();
   renderer->createBuffer(mesh);
 
-  MeshRenderer render;
+  MeshRenderer render(renderer->getResidency());
+  render.setClusterCulling(true);
+  render.setInstancedShader(*lightShader, lightShaderInstanced);
+  render.setInstancedShader(*dLightShader, dLightShaderInstanced);
+  // with multi draw the lit draws also read their material from a table,
+  // so the cube and all the backpack's materials go out in one call; the
+  // shader needs GL 4.3, so it is only built when multi draw is available
+  std::unique_ptr<Shader> lightShaderMultiDraw;
+  if (render.setMultiDrawIndirect(true))
+  {
+    lightShaderMultiDraw = std::make_unique<Shader>(
+        "./shader/vLightMultiDraw.glsl", "./shader/fModelMultiDraw.glsl");
+    render.setMultiDrawShader(*lightShader, *lightShaderMultiDraw);
+  }
+  // draws are queued during the frame and submitted sorted by state
+  RenderQueue queue;
+  unsigned int frame = 0;
   // projection
   glm::mat4 projection;
   projection = glm::perspective(
@@ -147,6 +181,23 @@ int main()
     pointLights.push_back(pLight);
   }
 
+  // the containers hide what is behind them; the cube keeps its vertices
+  // on the CPU, so it can be rasterized as an occluder
+  OcclusionCuller occlusion(resourceManager->getJobs());
+  render.setOcclusionCuller(&occlusion);
+  std::vector<glm::mat4> cubeModels;
+  for (unsigned int i = 0; i < 2; i++)
+  {
+    glm::mat4 model = glm::mat4(1.0f);
+    model = glm::translate(model, cubePositions[i]);
+    float angle = 20.0f * i;
+    model =
+        glm::rotate(model, glm::radians(angle), glm::vec3(1.0f, 0.3f, 0.5f));
+    model = glm::scale(model, glm::vec3(0.8f));
+    cubeModels.push_back(model);
+    occlusion.addOccluder(mesh, model);
+  }
+
   while (!glfwWindowShouldClose(window))
   {
     float currentFrame = glfwGetTime();
@@ -155,6 +206,8 @@ int main()
     // input
     // -----
     processInput(window);
+    modelLoader.update();
+    renderer->getResidency().beginFrame();
     // render
     // ------
     glClearColor(0.2f, 0.3f, 0.3f, 1.0f);
@@ -162,32 +215,63 @@ int main()
 
     camera.Position = glm::vec3(0.2f, 0.0f, 3.0f);
     camera.Target = glm::vec3(0.0f, 0.0f, 0.0f);
+    // rasterized on the workers while the lights are set up
+    occlusion.render(camera);
     glm::vec3 cameraFront = glm::normalize(camera.Target - camera.Position);
     light.Direction = glm::vec3(cameraFront);
     light.Position = camera.Position;
     /*         render.useLight(*lightShader, light, camera); */
     render.addSpotLights(*lightShader, pointLights, camera);
-    for (unsigned int i = 0; i < 2; i++)
+    render.addSpotLights(lightShaderInstanced, pointLights, camera);
+    if (lightShaderMultiDraw)
     {
-      glm::mat4 model = glm::mat4(1.0f);
-      model = glm::translate(model, cubePositions[i]);
-      float angle = 20.0f * i;
-      model =
-          glm::rotate(model, glm::radians(angle), glm::vec3(1.0f, 0.3f, 0.5f));
-      model = glm::scale(model, glm::vec3(0.8f));
-      render.render(camera, mesh, mat, model);
+      render.addSpotLights(*lightShaderMultiDraw, pointLights, camera);
+    }
+    for (const glm::mat4 &model : cubeModels)
+    {
+      render.submit(queue, camera, mesh, *mat.shader, mat, model);
     }
     for (auto pointLightPosition : pointLightPositions)
     {
       glm::mat4 model = glm::mat4(1.0f);
       model = glm::translate(model, pointLightPosition);
       model = glm::scale(model, glm::vec3(0.2f));
-      render.render(camera, mesh, lMat, model);
+      render.submit(queue, camera, mesh, *lMat.shader, lMat, model);
     }
     glm::mat4 model = glm::mat4(1.0f);
     model = glm::rotate(model, glm::radians(0.0f), glm::vec3(0.0f, 1.0f, 0.0f));
     model = glm::translate(model, glm::vec3(0.0f));
-    render.render(camera, backpackModel, *lightShader, *resourceManager, model);
+    render.submit(queue, camera, *backpackModel, *lightShader,
+                  *resourceManager, model);
+    render.flush(camera, queue);
+    const auto &culling = render.getCullingStats();
+    const auto &submitted = render.getQueueStats();
+    if (frame % 120 == 119)
+    {
+      std::cout << "draws " << submitted.unsorted.draws << " -> "
+                << submitted.sorted.draws << " (" << submitted.instances
+                << " instanced, " << submitted.indirectCommands
+                << " indirect commands), program switches "
+                << submitted.unsorted.programs << " -> "
+                << submitted.sorted.programs << ", texture switches "
+                << submitted.unsorted.textures << " -> "
+                << submitted.sorted.textures << ", vertex array switches "
+                << submitted.unsorted.vertexArrays << " -> "
+                << submitted.sorted.vertexArrays << "\n";
+    }
+    render.resetQueueStats();
+    if (++frame % 120 == 0 && culling.triangles > 0)
+    {
+      std::cout << "Meshes culled " << culling.meshesCulled << "/"
+                << culling.meshes << ", occluded " << culling.meshesOccluded
+                << ", clusters culled "
+                << culling.meshletsCulled << "/"
+                << culling.meshlets << ", triangles culled "
+                << culling.backfaceTrianglesCulled << " back facing + "
+                << culling.frustumTrianglesCulled << " off screen of "
+                << culling.triangles << "\n";
+    }
+    render.resetCullingStats();
     glfwSwapBuffers(window);
     glfwPollEvents();
   }
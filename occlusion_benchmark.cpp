@@ -0,0 +1,220 @@
+#include <occlusion_culling.h>
+#include <job_system.h>
+#include <glm/glm.hpp>
+#include <glm/gtc/matrix_transform.hpp>
+#include <glm/gtc/type_ptr.hpp>
+#include <algorithm>
+#include <chrono>
+#include <functional>
+#include <iostream>
+#include <random>
+#include <string>
+#include <vector>
+
+// Rasterizes a street of box shaped buildings as occluders, builds the
+// depth pyramid and tests 100k random boxes behind and between them. Prints
+// the best of several runs per stage, and checks the result against a
+// full resolution buffer tested pixel by pixel. The SIMD rasterizers run
+// when the CPU supports them.
+const size_t BOX_COUNT = 100000;
+const int BUILDING_COUNT = 40;
+const int WIDTH = 256;
+const int HEIGHT = 128;
+const int REFERENCE_SCALE = 4;
+const int RUNS = 20;
+
+double bestRunMs(const std::function<void()> &run)
+{
+  double best = 1e30;
+  for (int i = 0; i < RUNS; ++i)
+  {
+    auto start = std::chrono::steady_clock::now();
+    run();
+    std::chrono::duration<double, std::milli> elapsed =
+        std::chrono::steady_clock::now() - start;
+    best = std::min(best, elapsed.count());
+  }
+  return best;
+}
+
+// unit cube, 8 corners and 12 triangles
+const float CUBE_POSITIONS[] = {-1, -1, -1, 1, -1, -1, -1, 1, -1, 1, 1, -1,
+                                -1, -1, 1,  1, -1, 1,  -1, 1, 1,  1, 1, 1};
+const unsigned int CUBE_INDICES[] = {0, 1, 3, 0, 3, 2, 4, 7, 5, 4, 6, 7,
+                                     0, 4, 5, 0, 5, 1, 2, 3, 7, 2, 7, 6,
+                                     0, 2, 6, 0, 6, 4, 1, 5, 7, 1, 7, 3};
+
+void addBuildings(OcclusionBuffer &buffer, const glm::mat4 &viewProjection,
+                  const std::vector<glm::mat4> &buildings)
+{
+  buffer.clear();
+  for (const glm::mat4 &building : buildings)
+  {
+    glm::mat4 mvp = viewProjection * building;
+    buffer.addOccluder(glm::value_ptr(mvp), CUBE_POSITIONS, 3 * sizeof(float),
+                       8, CUBE_INDICES, 36);
+  }
+}
+
+// Hidden when every full resolution pixel the rectangle touches holds a
+// nearer occluder; the reference the pyramid test should never beat
+bool referenceVisible(const OcclusionBuffer &buffer, const glm::mat4 &mvp,
+                      const float center[3], const float extent[3])
+{
+  float minX = 1e30f, minY = 1e30f, maxX = -1e30f, maxY = -1e30f;
+  float nearest = 0.0f;
+  for (int corner = 0; corner < 8; ++corner)
+  {
+    glm::vec4 p(center[0] + (corner & 1 ? extent[0] : -extent[0]),
+                center[1] + (corner & 2 ? extent[1] : -extent[1]),
+                center[2] + (corner & 4 ? extent[2] : -extent[2]), 1.0f);
+    glm::vec4 clip = mvp * p;
+    if (clip.w <= 1e-4f)
+    {
+      return true;
+    }
+    minX = std::min(minX, clip.x / clip.w);
+    maxX = std::max(maxX, clip.x / clip.w);
+    minY = std::min(minY, clip.y / clip.w);
+    maxY = std::max(maxY, clip.y / clip.w);
+    nearest = std::max(nearest, 1.0f / clip.w);
+  }
+  int x0 = std::max(0, (int)std::floor((minX * 0.5f + 0.5f) * buffer.width()));
+  int x1 = std::min(buffer.width() - 1,
+                    (int)std::floor((maxX * 0.5f + 0.5f) * buffer.width()));
+  int y0 =
+      std::max(0, (int)std::floor((minY * 0.5f + 0.5f) * buffer.height()));
+  int y1 = std::min(buffer.height() - 1,
+                    (int)std::floor((maxY * 0.5f + 0.5f) * buffer.height()));
+  for (int y = y0; y <= y1; ++y)
+  {
+    for (int x = x0; x <= x1; ++x)
+    {
+      if (buffer.depth(0, x, y) <= nearest)
+      {
+        return true;
+      }
+    }
+  }
+  return x0 > x1 || y0 > y1;
+}
+
+int main()
+{
+  std::mt19937 rng(42);
+  glm::mat4 projection = glm::perspective(
+      glm::radians(60.0f), (float)WIDTH / HEIGHT, 0.1f, 200.0f);
+  glm::mat4 view = glm::lookAt(glm::vec3(0.0f, 1.7f, 0.0f),
+                               glm::vec3(0.0f, 1.7f, -1.0f),
+                               glm::vec3(0.0f, 1.0f, 0.0f));
+  glm::mat4 viewProjection = projection * view;
+
+  // buildings on both sides of a street running down -z, plus a few across
+  std::uniform_real_distribution<float> height(4.0f, 20.0f);
+  std::uniform_real_distribution<float> depth(-150.0f, -10.0f);
+  std::vector<glm::mat4> buildings;
+  for (int i = 0; i < BUILDING_COUNT; ++i)
+  {
+    float side = i % 4 == 3 ? 0.0f : (i % 2 ? 12.0f : -12.0f);
+    float h = height(rng);
+    glm::mat4 building =
+        glm::translate(glm::mat4(1.0f), glm::vec3(side, h, depth(rng)));
+    buildings.push_back(glm::scale(building, glm::vec3(8.0f, h, 4.0f)));
+  }
+  std::uniform_real_distribution<float> x(-40.0f, 40.0f);
+  std::uniform_real_distribution<float> y(0.0f, 10.0f);
+  std::uniform_real_distribution<float> z(-190.0f, -5.0f);
+  std::uniform_real_distribution<float> extent(0.2f, 2.0f);
+  BoxList boxes;
+  for (size_t i = 0; i < BOX_COUNT; ++i)
+  {
+    float center[3] = {x(rng), y(rng), z(rng)};
+    float half = extent(rng);
+    float min[3] = {center[0] - half, center[1] - half, center[2] - half};
+    float max[3] = {center[0] + half, center[1] + half, center[2] + half};
+    boxes.add(min, max);
+  }
+  const float *mvp = glm::value_ptr(viewProjection);
+
+  OcclusionBuffer buffer(WIDTH, HEIGHT);
+  double ms =
+      bestRunMs([&]() { addBuildings(buffer, viewProjection, buildings); });
+  std::cout << "setup " << buffer.triangleCount() << " triangles: " << ms
+            << " ms\n";
+  ms = bestRunMs([&]() {
+    buffer.clearDepth();
+    buffer.rasterizeScalar(0, HEIGHT);
+  });
+  std::cout << "rasterize scalar: " << ms << " ms\n";
+  std::vector<float> reference(buffer.depthData(),
+                               buffer.depthData() + WIDTH * HEIGHT);
+  [[maybe_unused]] auto compare = [&](const std::string &name) {
+    size_t differing = 0;
+    for (size_t i = 0; i < reference.size(); ++i)
+    {
+      differing += std::fabs(buffer.depthData()[i] - reference[i]) > 1e-6f;
+    }
+    std::cout << name << " pixels differing from scalar: " << differing
+              << "\n";
+    return differing * 1000 <= reference.size();
+  };
+#ifdef OCCLUSION_CULLING_SSE
+  if (cpuHasSSE41())
+  {
+    ms = bestRunMs([&]() {
+      buffer.clearDepth();
+      buffer.rasterizeSSE(0, HEIGHT);
+    });
+    std::cout << "rasterize SSE (4 pixels): " << ms << " ms\n";
+    if (!compare("SSE"))
+    {
+      return 1;
+    }
+  }
+#endif
+  // one band of rows per job, as OcclusionCuller runs it
+  JobSystem jobs;
+  const int bands = (int)jobs.threadCount() + 1;
+  ms = bestRunMs([&]() {
+    buffer.clearDepth();
+    jobs.parallelFor(bands, [&](size_t band) {
+      buffer.rasterize((int)band * HEIGHT / bands,
+                       (int)(band + 1) * HEIGHT / bands);
+    });
+  });
+  std::cout << "rasterize on " << bands << " threads: " << ms << " ms\n";
+  ms = bestRunMs([&]() { buffer.buildPyramid(); });
+  std::cout << "pyramid of " << buffer.levelCount() << " levels: " << ms
+            << " ms\n";
+
+  std::vector<uint8_t> visible(BOX_COUNT);
+  size_t visibleCount = 0;
+  ms = bestRunMs([&]() {
+    std::fill(visible.begin(), visible.end(), 1);
+    visibleCount = buffer.testBoxes(mvp, boxes, visible.data());
+  });
+  std::cout << "test " << BOX_COUNT << " boxes: " << ms << " ms, "
+            << ms * 1e6 / BOX_COUNT << " ns/box, " << BOX_COUNT - visibleCount
+            << " hidden\n";
+
+  // accuracy against a buffer with 16 times the pixels, without pyramid
+  OcclusionBuffer fine(WIDTH * REFERENCE_SCALE, HEIGHT * REFERENCE_SCALE);
+  addBuildings(fine, viewProjection, buildings);
+  fine.rasterizeScalar(0, fine.height());
+  size_t referenceHidden = 0, falselyHidden = 0;
+  for (size_t i = 0; i < BOX_COUNT; ++i)
+  {
+    const float center[3] = {boxes.centerX[i], boxes.centerY[i],
+                             boxes.centerZ[i]};
+    const float half[3] = {boxes.extentX[i], boxes.extentY[i],
+                           boxes.extentZ[i]};
+    bool shown = referenceVisible(fine, viewProjection, center, half);
+    referenceHidden += !shown;
+    falselyHidden += shown && !visible[i];
+  }
+  std::cout << "reference hides " << referenceHidden << ", pyramid finds "
+            << (BOX_COUNT - visibleCount) * 100.0 /
+                   std::max<size_t>(1, referenceHidden)
+            << "% of them, " << falselyHidden << " visible boxes culled\n";
+  return 0;
+}
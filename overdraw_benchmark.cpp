@@ -0,0 +1,216 @@
+// clang-format off
+#include <glad/glad.h>
+// clang-format on
+#include <GLFW/glfw3.h>
+#include <chrono>
+#include <functional>
+#include <iostream>
+#include <string>
+#include <vector>
+#include <shader.h>
+#define STB_IMAGE_IMPLEMENTATION
+#include "stb_image.h"
+#include <glm/glm.hpp>
+#include <glm/gtc/matrix_transform.hpp>
+#include <glm/gtc/type_ptr.hpp>
+#include "engine.h"
+
+// Renders a few scenes offscreen with fMultiLightTexture.glsl, without and
+// with the depth pre-pass, and prints the fragments the lighting shader
+// ran per covered pixel (counted with stencil increments) and the GPU time
+// per frame. The window stays hidden.
+const int WIDTH = 800;
+const int HEIGHT = 600;
+const int FRAMES = 50;
+
+struct Scene
+{
+  std::string name;
+  const Mesh *mesh;
+  std::vector<glm::mat4> models;
+  glm::vec3 eye;
+  glm::vec3 target;
+};
+
+// a field of cubes seen at a grazing angle, submitted back to front
+Scene cubeField(const Mesh &cube)
+{
+  Scene scene{"cube field", &cube, {}, glm::vec3(0.0f, 1.0f, 22.0f),
+              glm::vec3(0.0f, 0.0f, 0.0f)};
+  for (int z = -20; z < 20; ++z)
+  {
+    for (int x = -20; x < 20; ++x)
+    {
+      glm::mat4 model =
+          glm::translate(glm::mat4(1.0f), glm::vec3(x * 1.5f, 0.0f, z * 1.5f));
+      scene.models.push_back(glm::scale(model, glm::vec3(1.2f)));
+    }
+  }
+  return scene;
+}
+// spheres nested in each other around one center, so distance sorting
+// cannot order them
+Scene nestedShells(const Mesh &sphere)
+{
+  Scene scene{"nested shells", &sphere, {}, glm::vec3(0.0f, 0.0f, 30.0f),
+              glm::vec3(0.0f)};
+  for (int shell = 1; shell <= 16; ++shell)
+  {
+    scene.models.push_back(
+        glm::scale(glm::mat4(1.0f), glm::vec3(shell * 0.6f)));
+  }
+  return scene;
+}
+
+int main()
+{
+  glfwInit();
+  glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 3);
+  glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 3);
+  glfwWindowHint(GLFW_OPENGL_PROFILE, GLFW_OPENGL_CORE_PROFILE);
+  glfwWindowHint(GLFW_VISIBLE, GLFW_FALSE);
+  GLFWwindow *window =
+      glfwCreateWindow(WIDTH, HEIGHT, "Overdraw benchmark", NULL, NULL);
+  if (window == NULL)
+  {
+    std::cout << "Failed to create GLFW window" << std::endl;
+    glfwTerminate();
+    return -1;
+  }
+  glfwMakeContextCurrent(window);
+  if (!gladLoadGLLoader((GLADloadproc)glfwGetProcAddress))
+  {
+    std::cout << "Failed to initialize GLAD" << std::endl;
+    return -1;
+  }
+
+  // offscreen target with a stencil to count in
+  unsigned int fbo, color, depthStencil;
+  glGenFramebuffers(1, &fbo);
+  glBindFramebuffer(GL_FRAMEBUFFER, fbo);
+  glGenRenderbuffers(1, &color);
+  glBindRenderbuffer(GL_RENDERBUFFER, color);
+  glRenderbufferStorage(GL_RENDERBUFFER, GL_RGBA8, WIDTH, HEIGHT);
+  glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0,
+                            GL_RENDERBUFFER, color);
+  glGenRenderbuffers(1, &depthStencil);
+  glBindRenderbuffer(GL_RENDERBUFFER, depthStencil);
+  glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH24_STENCIL8, WIDTH, HEIGHT);
+  glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_STENCIL_ATTACHMENT,
+                            GL_RENDERBUFFER, depthStencil);
+  if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE)
+  {
+    std::cout << "ERROR::FRAMEBUFFER:: Framebuffer is not complete!"
+              << std::endl;
+    return -1;
+  }
+  glViewport(0, 0, WIDTH, HEIGHT);
+  glEnable(GL_DEPTH_TEST);
+
+  auto renderer = std::make_unique<Renderer>();
+  renderer->setPositionStreams(true);
+  auto resourceManager = std::make_unique<ResourceManager>(*renderer);
+
+  std::shared_ptr<Shader> lightShader(
+      new Shader("./shader/vLight.glsl", "./shader/fMultiLightTexture.glsl"));
+  Shader lightShaderInstanced("./shader/vLightInstanced.glsl",
+                              "./shader/fMultiLightTexture.glsl");
+  Shader depthShader("./shader/vDepthPrepass.glsl",
+                     "./shader/fDepthPrepass.glsl");
+  Shader depthShaderInstanced("./shader/vDepthPrepassInstanced.glsl",
+                              "./shader/fDepthPrepass.glsl");
+
+  Material mat = Material(lightShader);
+  resourceManager->addMaterial(mat);
+  Image diffuseImage("./texture/container2.png", false);
+  Texture diffuse = resourceManager->loadTexture2D(diffuseImage);
+  diffuse.type = TextureType::Diffuse;
+  mat.textures.push_back(diffuse);
+  Image specularImage("./texture/container2_specular.png", false);
+  Texture specular = resourceManager->loadTexture2D(specularImage);
+  specular.type = TextureType::Specular;
+  mat.textures.push_back(specular);
+
+  Mesh cube = createCube();
+  renderer->createBuffer(cube);
+  Mesh sphere = createSphere(16, 32);
+  renderer->createBuffer(sphere);
+
+  MeshRenderer render(renderer->getResidency());
+  render.setInstancedShader(*lightShader, lightShaderInstanced);
+  render.setOverdrawCounting(true);
+  RenderQueue queue;
+  glm::mat4 projection = glm::perspective(
+      glm::radians(60.0f), (float)WIDTH / (float)HEIGHT, 0.1f, 100.0f);
+  auto camera = Camera(projection);
+
+  Light sun = Light();
+  sun.Position = glm::vec3(0.0f);
+  sun.Direction = glm::vec3(-0.3f, -1.0f, -0.2f);
+  sun.Ambiant = glm::vec3(0.2f);
+  sun.Diffuse = glm::vec3(0.5f);
+  sun.Specular = glm::vec3(0.5f);
+  std::vector<Light> pointLights(8);
+  for (size_t i = 0; i < pointLights.size(); ++i)
+  {
+    pointLights[i].Position =
+        glm::vec3(i * 4.0f - 14.0f, 2.0f, (i % 2) * 10.0f - 5.0f);
+    pointLights[i].Ambiant = glm::vec3(0.05f);
+    pointLights[i].Diffuse = glm::vec3(0.8f);
+    pointLights[i].Specular = glm::vec3(1.0f);
+  }
+
+  std::vector<Scene> scenes = {cubeField(cube), nestedShells(sphere)};
+  for (const Scene &scene : scenes)
+  {
+    camera.Position = scene.eye;
+    camera.Target = scene.target;
+    for (Shader *shader : {lightShader.get(), &lightShaderInstanced})
+    {
+      render.useLight(*shader, sun, camera);
+      render.addPointLights(*shader, pointLights, camera);
+    }
+    for (bool prepass : {false, true})
+    {
+      if (prepass)
+      {
+        render.setDepthPrepass(&depthShader, &depthShaderInstanced);
+      }
+      else
+      {
+        render.setDepthPrepass(nullptr);
+      }
+      auto drawFrame = [&]() {
+        glClearColor(0.0f, 0.0f, 0.0f, 1.0f);
+        glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT |
+                GL_STENCIL_BUFFER_BIT);
+        for (const glm::mat4 &model : scene.models)
+        {
+          render.submit(queue, camera, *scene.mesh, *mat.shader, mat, model);
+        }
+        render.flush(camera, queue);
+      };
+      drawFrame();
+      glFinish();
+      auto start = std::chrono::steady_clock::now();
+      for (int frame = 0; frame < FRAMES; ++frame)
+      {
+        drawFrame();
+      }
+      glFinish();
+      std::chrono::duration<double, std::milli> elapsed =
+          std::chrono::steady_clock::now() - start;
+      MeshRenderer::OverdrawStats stats = render.readOverdraw(WIDTH, HEIGHT);
+      std::cout << scene.name << (prepass ? ", depth pre-pass: " : ": ")
+                << stats.fragments << " lit fragments over "
+                << stats.coveredPixels << " pixels, overdraw "
+                << stats.overdraw() << " (max " << stats.maxFragments
+                << "), " << elapsed.count() / FRAMES << " ms per frame\n";
+    }
+  }
+  glDeleteFramebuffers(1, &fbo);
+  glDeleteRenderbuffers(1, &color);
+  glDeleteRenderbuffers(1, &depthStencil);
+  glfwTerminate();
+  return 0;
+}
@@ -0,0 +1,134 @@
+#version 330 core
+
+struct Material {
+  sampler2D texture_diffuse1;
+  sampler2D texture_diffuse2;
+  sampler2D texture_diffuse3;
+  sampler2D texture_specular1;
+  sampler2D texture_specular2;
+  float shininess;
+};
+
+struct Light {
+  vec3 position;
+  vec3 ambient;
+  vec3 diffuse;
+  vec3 specular;
+  vec3 direction;
+
+  float constant;
+  float linear;
+  float quadratic;
+
+  float cutOff;
+  float outerCutOff;
+};
+
+out vec4 FragColor;
+
+in vec3 Normal;
+in vec3 FragPos;
+in vec2 TexCoord;
+
+uniform Material material;
+
+// Light
+uniform Light light;
+
+// Clustered point and spot lights, see ClusteredLights. Five texels per
+// light: position and constant, direction and linear, ambient and
+// quadratic, diffuse and cos(cutOff), specular and cos(outerCutOff);
+// point lights have a cutOff below -1.
+uniform samplerBuffer clusterLights;
+// light index offset and count per cluster
+uniform usamplerBuffer clusterGrid;
+uniform usamplerBuffer clusterIndices;
+uniform ivec3 clusterCount;
+uniform vec2 clusterTileSize;
+uniform float clusterSliceScale;
+uniform float clusterSliceBias;
+
+vec3 CalcDirLight(Light light, vec3 normal, vec3 viewDir) {
+  vec3 lightDir = normalize(-light.direction);
+  // diffuse shading
+  float diff = max(dot(normal, lightDir), 0.0);
+  // specular shading
+  vec3 reflectDir = reflect(-lightDir, normal);
+  float spec = pow(max(dot(viewDir, reflectDir), 0.0), material.shininess);
+  // combine results
+  vec3 ambient =
+      light.ambient * vec3(texture(material.texture_diffuse1, TexCoord));
+  vec3 diffuse =
+      light.diffuse * diff * vec3(texture(material.texture_diffuse1, TexCoord));
+  vec3 specular = light.specular * spec *
+                  vec3(texture(material.texture_specular1, TexCoord));
+  return (ambient + diffuse + specular);
+}
+Light FetchLight(int index) {
+  Light light;
+  vec4 t0 = texelFetch(clusterLights, index * 5);
+  vec4 t1 = texelFetch(clusterLights, index * 5 + 1);
+  vec4 t2 = texelFetch(clusterLights, index * 5 + 2);
+  vec4 t3 = texelFetch(clusterLights, index * 5 + 3);
+  vec4 t4 = texelFetch(clusterLights, index * 5 + 4);
+  light.position = t0.xyz;
+  light.constant = t0.w;
+  light.direction = t1.xyz;
+  light.linear = t1.w;
+  light.ambient = t2.xyz;
+  light.quadratic = t2.w;
+  light.diffuse = t3.xyz;
+  light.cutOff = t3.w;
+  light.specular = t4.xyz;
+  light.outerCutOff = t4.w;
+  return light;
+}
+// point light, or spot light when cutOff is a cosine; attenuated in both
+// cases, since the clusters cut every light off at its range
+vec3 CalcClusteredLight(Light light, vec3 normal, vec3 fragPos, vec3 viewDir,
+                        vec3 diffuseColor, vec3 specularColor) {
+  vec3 lightDir = normalize(light.position - fragPos);
+  float intensity = 1.0;
+  if (light.cutOff >= -1.0) {
+    float theta = dot(lightDir, normalize(-light.direction));
+    float epsilon = light.cutOff - light.outerCutOff;
+    intensity = clamp((theta - light.outerCutOff) / epsilon, 0.0, 1.0);
+  }
+  // diffuse shading
+  float diff = max(dot(normal, lightDir), 0.0);
+  // specular shading
+  vec3 reflectDir = reflect(-lightDir, normal);
+  float spec = pow(max(dot(viewDir, reflectDir), 0.0), material.shininess);
+  // attenuation
+  float distance = length(light.position - fragPos);
+  float attenuation = 1.0 / (light.constant + light.linear * distance +
+                             light.quadratic * (distance * distance));
+  vec3 ambient = light.ambient * diffuseColor;
+  vec3 diffuse = light.diffuse * diff * diffuseColor;
+  vec3 specular = light.specular * spec * specularColor;
+  return (ambient + diffuse + specular) * attenuation * intensity;
+}
+void main() {
+
+  // properties
+  vec3 norm = normalize(Normal);
+  vec3 viewDir = normalize(-FragPos);
+  vec3 diffuseColor = vec3(texture(material.texture_diffuse1, TexCoord));
+  vec3 specularColor = vec3(texture(material.texture_specular1, TexCoord));
+
+  // phase 1: Directional lighting
+  vec3 result = CalcDirLight(light, norm, viewDir);
+  // phase 2: the point and spot lights of this fragment's cluster
+  ivec2 tile = min(ivec2(gl_FragCoord.xy / clusterTileSize), clusterCount.xy - 1);
+  int slice = int(log(-FragPos.z) * clusterSliceScale + clusterSliceBias);
+  slice = clamp(slice, 0, clusterCount.z - 1);
+  int cluster = (slice * clusterCount.y + tile.y) * clusterCount.x + tile.x;
+  uvec2 range = texelFetch(clusterGrid, cluster).xy;
+  for (uint i = 0u; i < range.y; i++) {
+    int index = int(texelFetch(clusterIndices, int(range.x + i)).x);
+    result += CalcClusteredLight(FetchLight(index), norm, FragPos, viewDir,
+                                 diffuseColor, specularColor);
+  }
+
+  FragColor = vec4(result, 1);
+}
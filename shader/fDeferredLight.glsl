@@ -0,0 +1,60 @@
+#version 330 core
+out vec4 FragColor;
+
+struct Light {
+  vec3 position;
+  vec3 ambient;
+  vec3 diffuse;
+  vec3 specular;
+  vec3 direction;
+
+  float constant;
+  float linear;
+  float quadratic;
+
+  float cutOff;
+  float outerCutOff;
+};
+
+// G-buffer, see DeferredRenderer
+uniform sampler2D gAlbedoSpec;
+uniform sampler2D gNormal;
+uniform sampler2D gDepth;
+uniform vec2 screenSize;
+// 1 / projection[0][0] and 1 / projection[1][1]
+uniform vec2 viewRay;
+
+// point light, or spot light when cutOff is a cosine
+uniform Light light;
+
+void main() {
+  ivec2 texel = ivec2(gl_FragCoord.xy);
+  float depth = texelFetch(gDepth, texel, 0).r;
+  vec4 albedoSpec = texelFetch(gAlbedoSpec, texel, 0);
+  vec4 normalShininess = texelFetch(gNormal, texel, 0);
+  vec2 ndc = gl_FragCoord.xy / screenSize * 2.0 - 1.0;
+  vec3 fragPos = vec3(ndc * viewRay * depth, -depth);
+  vec3 normal = normalShininess.xyz;
+  vec3 viewDir = normalize(-fragPos);
+
+  vec3 lightDir = normalize(light.position - fragPos);
+  float intensity = 1.0;
+  if (light.cutOff >= -1.0) {
+    float theta = dot(lightDir, normalize(-light.direction));
+    float epsilon = light.cutOff - light.outerCutOff;
+    intensity = clamp((theta - light.outerCutOff) / epsilon, 0.0, 1.0);
+  }
+  // diffuse shading
+  float diff = max(dot(normal, lightDir), 0.0);
+  // specular shading
+  vec3 reflectDir = reflect(-lightDir, normal);
+  float spec = pow(max(dot(viewDir, reflectDir), 0.0), normalShininess.w);
+  // attenuation
+  float distance = length(light.position - fragPos);
+  float attenuation = 1.0 / (light.constant + light.linear * distance +
+                             light.quadratic * (distance * distance));
+  vec3 ambient = light.ambient * albedoSpec.rgb;
+  vec3 diffuse = light.diffuse * diff * albedoSpec.rgb;
+  vec3 specular = light.specular * spec * albedoSpec.a;
+  FragColor = vec4((ambient + diffuse + specular) * attenuation * intensity, 1);
+}
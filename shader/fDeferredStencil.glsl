@@ -0,0 +1,3 @@
+#version 330 core
+// the stencil pass writes no color
+void main() {}
@@ -0,0 +1,27 @@
+#version 330 core
+layout(location = 0) out vec4 gAlbedoSpec;
+layout(location = 1) out vec4 gNormal;
+layout(location = 2) out float gDepth;
+
+struct Material {
+  sampler2D texture_diffuse1;
+  sampler2D texture_diffuse2;
+  sampler2D texture_diffuse3;
+  sampler2D texture_specular1;
+  sampler2D texture_specular2;
+  float shininess;
+};
+
+in vec3 Normal;
+in vec3 FragPos;
+in vec2 TexCoord;
+
+uniform Material material;
+
+void main() {
+  gAlbedoSpec.rgb = texture(material.texture_diffuse1, TexCoord).rgb;
+  gAlbedoSpec.a = texture(material.texture_specular1, TexCoord).r;
+  gNormal = vec4(normalize(Normal), material.shininess);
+  // linear view depth, 0 is left where nothing was drawn
+  gDepth = -FragPos.z;
+}
@@ -0,0 +1,29 @@
+#version 330 core
+// Weighted blended transparency, see WeightedBlendedTransparency
+layout(location = 0) out vec4 Accumulation;
+layout(location = 1) out float Revealage;
+
+in vec2 TexCoord;
+in vec3 FragPos;
+
+struct Material {
+  sampler2D texture_diffuse1;
+  sampler2D texture_diffuse2;
+  sampler2D texture_diffuse3;
+  sampler2D texture_specular1;
+  sampler2D texture_specular2;
+  float shininess;
+};
+
+uniform Material material;
+
+void main() {
+  vec4 color = texture(material.texture_diffuse1, TexCoord);
+  // near surfaces weigh more, equation 7 of McGuire and Bavoil 2013
+  float z = abs(FragPos.z);
+  float weight =
+      color.a * clamp(10.0 / (1e-5 + pow(z / 5.0, 2.0) + pow(z / 200.0, 6.0)),
+                      1e-2, 3e3);
+  Accumulation = vec4(color.rgb * color.a, color.a) * weight;
+  Revealage = color.a;
+}
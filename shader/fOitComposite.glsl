@@ -0,0 +1,25 @@
+#version 330 core
+out vec4 FragColor;
+
+in vec2 TexCoord;
+
+// targets of WeightedBlendedTransparency, same size as the screen
+uniform sampler2D accumulation;
+uniform sampler2D revealage;
+
+void main() {
+  ivec2 texel = ivec2(gl_FragCoord.xy);
+  float revealed = texelFetch(revealage, texel, 0).r;
+  if (revealed >= 1.0) {
+    // nothing translucent here
+    discard;
+  }
+  vec4 accum = texelFetch(accumulation, texel, 0);
+  // many bright layers can overflow the half floats
+  if (isinf(max(max(abs(accum.r), abs(accum.g)), abs(accum.b)))) {
+    accum.rgb = vec3(accum.a);
+  }
+  vec3 average = accum.rgb / max(accum.a, 1e-5);
+  // blended with GL_ONE_MINUS_SRC_ALPHA, GL_SRC_ALPHA
+  FragColor = vec4(average, revealed);
+}
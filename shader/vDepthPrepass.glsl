@@ -0,0 +1,10 @@
+#version 330 core
+// Depth pre-pass, see MeshRenderer::setDepthPrepass. Only the position
+// stream is read, and gl_Position is computed exactly like vLight.glsl.
+layout(location = 0) in vec3 aPos;
+
+uniform mat4 model;
+uniform mat4 view;
+uniform mat4 projection;
+
+void main() { gl_Position = projection * view * model * vec4(aPos, 1.0); }
@@ -0,0 +1,11 @@
+#version 330 core
+// Depth pre-pass of instanced batches, gl_Position computed exactly like
+// vLightInstanced.glsl
+layout(location = 0) in vec3 aPos;
+// model matrix, one column per location from 3 to 6
+layout(location = 3) in mat4 aModel;
+
+uniform mat4 view;
+uniform mat4 projection;
+
+void main() { gl_Position = projection * view * aModel * vec4(aPos, 1.0); }
@@ -0,0 +1,21 @@
+#version 330 core
+layout(location = 0) in vec3 aPos;
+layout(location = 1) in vec2 aTexCoord;
+layout(location = 2) in vec3 aNormal;
+
+out vec3 Normal;
+out vec2 TexCoord;
+out vec3 FragPos;
+
+uniform mat4 model;
+uniform mat4 view;
+uniform mat4 projection;
+
+void main() {
+  vec4 viewPos = view * model * vec4(aPos, 1.0);
+  gl_Position = projection * viewPos;
+  FragPos = vec3(viewPos);
+  TexCoord = aTexCoord;
+  // the G-buffer keeps view space normals, like the light positions
+  Normal = mat3(transpose(inverse(view * model))) * aNormal;
+}
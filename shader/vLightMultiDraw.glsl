@@ -0,0 +1,25 @@
+#version 430 core
+layout(location = 0) in vec3 aPos;
+layout(location = 1) in vec2 aTexCoord;
+layout(location = 2) in vec3 aNormal;
+// model matrix, one column per location from 3 to 6
+layout(location = 3) in mat4 aModel;
+// slot of the draw's material in the materials array
+layout(location = 7) in uint aMaterial;
+
+out vec3 Normal;
+out vec2 TexCoord;
+out vec3 FragPos;
+flat out uint MaterialIndex;
+
+uniform mat4 view;
+uniform mat4 projection;
+uniform mat4 transform;
+
+void main() {
+  gl_Position = projection * view * aModel * vec4(aPos, 1.0);
+  FragPos = vec3(view * aModel * vec4(aPos, 1.0));
+  TexCoord = aTexCoord;
+  Normal = mat3(transpose(inverse(aModel))) * aNormal;
+  MaterialIndex = aMaterial;
+}
\ No newline at end of file
@@ -78,7 +78,8 @@ int main() {
   std::vector<Image> images = {
       Image("./texture/atlas.png", true),
   };
-  std::vector<Material> materials = {Material(lightShader)};
+  Pool<Material> materials;
+  MaterialHandle spriteMaterial = materials.add(Material(lightShader));
 
   for (auto image : images) {
     // load image
@@ -88,7 +89,7 @@ int main() {
     Texture texture;
     texture.id = manager.createTexture2D(image);
     texture.type = TextureType::Diffuse;
-    materials[0].textures.push_back(texture);
+    materials[spriteMaterial].textures.push_back(texture);
     stbi_image_free(image.data);
   }
   MeshRenderer render;
@@ -151,7 +152,8 @@ int main() {
       currentSprite[i] = spritesheet[animated.Sprites[animated.CurrentFrame]];
     }
 
-    spriterender.render(camera, currentSprite, 0, materials, transforms);
+    spriterender.render(camera, currentSprite, spriteMaterial, materials,
+                        transforms);
     glfwSwapBuffers(window);
     glfwPollEvents();
     if (currentFrame - lastTime >=
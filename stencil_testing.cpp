@@ -85,6 +85,10 @@ int main()
       new Shader("./shader/vLight.glsl", "./shader/fMultiLightTexture.glsl"));
   std::shared_ptr<Shader> shaderSingleColor(
       new Shader("./shader/vLight.glsl", "./shader/fStencilTesting.glsl"));
+  Shader normalShaderInstanced("./shader/vLightInstanced.glsl",
+                               "./shader/fMultiLightTexture.glsl");
+  Shader shaderSingleColorInstanced("./shader/vLightInstanced.glsl",
+                                    "./shader/fStencilTesting.glsl");
 
   std::vector<Image> images = {
       Image("./texture/container2.png", false),
@@ -106,6 +110,10 @@ int main()
   renderer->createBuffer(mesh);
 
   MeshRenderer render;
+  // each stencil pass is one instanced draw of all the cubes
+  render.setInstancedShader(*normalShader, normalShaderInstanced);
+  render.setInstancedShader(*shaderSingleColor, shaderSingleColorInstanced);
+  RenderQueue queue;
   // projection
   glm::mat4 projection;
   projection = glm::perspective(
@@ -146,6 +154,7 @@ int main()
     camera.Target = glm::vec3(0.0f, 0.0f, 0.0f);
     glm::vec3 cameraFront = glm::normalize(camera.Target - camera.Position);
     render.useLight(*normalShader, light, camera);
+    render.useLight(normalShaderInstanced, light, camera);
     glStencilOp(GL_KEEP, GL_KEEP, GL_REPLACE);
     glStencilFunc(GL_ALWAYS, 1,
                   0xFF); // all fragments should pass the stencil test
@@ -158,8 +167,9 @@ int main()
       model =
           glm::rotate(model, glm::radians(angle), glm::vec3(1.0f, 0.3f, 0.5f));
       model = glm::scale(model, glm::vec3(0.8f));
-      render.render(camera, mesh, *normalShader, mat, model);
+      render.submit(queue, camera, mesh, *normalShader, mat, model);
     }
+    render.flush(camera, queue);
     glStencilFunc(GL_NOTEQUAL, 1, 0xFF);
     glStencilMask(0x00); // disable writing to the stencil buffer
     glDisable(GL_DEPTH_TEST);
@@ -171,8 +181,9 @@ int main()
       model =
           glm::rotate(model, glm::radians(angle), glm::vec3(1.0f, 0.3f, 0.5f));
       model = glm::scale(model, glm::vec3(0.9f));
-      render.render(camera, mesh, *shaderSingleColor, lMat, model);
+      render.submit(queue, camera, mesh, *shaderSingleColor, lMat, model);
     }
+    render.flush(camera, queue);
     glStencilMask(0xFF);
     glStencilFunc(GL_ALWAYS, 1, 0xFF);
     glEnable(GL_DEPTH_TEST);
@@ -0,0 +1,119 @@
+#include <vertex_conversion.h>
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <functional>
+#include <iostream>
+#include <random>
+#include <string>
+#include <vector>
+
+// Converts a synthetic 10M vertex mesh in Assimp's layout (float3
+// positions, normals and texture coordinates) to the engine's interleaved
+// vertex and to separate streams, and prints the best of several runs.
+const size_t VERTEX_COUNT = 10000000;
+const int RUNS = 10;
+
+struct Float3
+{
+  float x, y, z;
+};
+struct Vertex
+{
+  float position[3];
+  float normal[3];
+  float texCoords[2];
+};
+
+double bestRunMs(const std::function<void()> &convert)
+{
+  double best = 1e30;
+  for (int run = 0; run < RUNS; ++run)
+  {
+    auto start = std::chrono::steady_clock::now();
+    convert();
+    std::chrono::duration<double, std::milli> elapsed =
+        std::chrono::steady_clock::now() - start;
+    best = std::min(best, elapsed.count());
+  }
+  return best;
+}
+
+void report(const std::string &name, double ms, size_t bytesWritten)
+{
+  // every kernel reads the three float3 arrays once
+  double bytes = VERTEX_COUNT * 9.0 * sizeof(float) + bytesWritten;
+  std::cout << name << ": " << ms << " ms, " << bytes / (ms * 1e6)
+            << " GB/s\n";
+}
+
+int main()
+{
+  std::mt19937 rng(42);
+  std::uniform_real_distribution<float> value(-1.0f, 1.0f);
+  std::vector<Float3> positions(VERTEX_COUNT), normals(VERTEX_COUNT),
+      texCoords(VERTEX_COUNT);
+  for (size_t i = 0; i < VERTEX_COUNT; ++i)
+  {
+    positions[i] = {value(rng), value(rng), value(rng)};
+    normals[i] = {value(rng), value(rng), value(rng)};
+    texCoords[i] = {value(rng), value(rng), 0.0f};
+  }
+  const float *p = &positions[0].x;
+  const float *n = &normals[0].x;
+  const float *t = &texCoords[0].x;
+  const size_t interleavedBytes = VERTEX_COUNT * sizeof(Vertex);
+
+  // what the import used to do: a field at a time into a growing vector
+  std::vector<Vertex> pushed;
+  double ms = bestRunMs([&]() {
+    pushed.clear();
+    pushed.shrink_to_fit();
+    for (size_t i = 0; i < VERTEX_COUNT; ++i)
+    {
+      Vertex vertex;
+      vertex.position[0] = positions[i].x;
+      vertex.position[1] = positions[i].y;
+      vertex.position[2] = positions[i].z;
+      vertex.normal[0] = normals[i].x;
+      vertex.normal[1] = normals[i].y;
+      vertex.normal[2] = normals[i].z;
+      vertex.texCoords[0] = texCoords[i].x;
+      vertex.texCoords[1] = texCoords[i].y;
+      pushed.push_back(vertex);
+    }
+  });
+  report("per vertex push_back", ms, interleavedBytes);
+
+  std::vector<float> reference(VERTEX_COUNT * INTERLEAVED_VERTEX_FLOATS);
+  std::vector<float> interleaved(reference.size());
+  ms = bestRunMs([&]() {
+    interleaveVerticesScalar(p, n, t, 0, VERTEX_COUNT, reference.data());
+  });
+  report("interleave scalar", ms, interleavedBytes);
+  if (std::memcmp(reference.data(), pushed.data(), interleavedBytes) != 0)
+  {
+    std::cout << "scalar result differs from push_back\n";
+    return 1;
+  }
+#ifdef VERTEX_CONVERSION_SSE
+  ms = bestRunMs([&]() {
+    interleaveVerticesSSE(p, n, t, VERTEX_COUNT, interleaved.data());
+  });
+  report("interleave SSE", ms, interleavedBytes);
+  if (interleaved != reference)
+  {
+    std::cout << "SSE result differs from scalar\n";
+    return 1;
+  }
+#endif
+
+  std::vector<float> outPositions(VERTEX_COUNT * 3),
+      outNormals(VERTEX_COUNT * 3), outTexCoords(VERTEX_COUNT * 2);
+  ms = bestRunMs([&]() {
+    splitVertices(p, n, t, VERTEX_COUNT, outPositions.data(),
+                  outNormals.data(), outTexCoords.data());
+  });
+  report("split streams", ms, interleavedBytes);
+  return 0;
+}
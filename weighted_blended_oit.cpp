@@ -0,0 +1,209 @@
+// clang-format off
+#include <glad/glad.h>
+// clang-format on
+#include <GLFW/glfw3.h>
+#include <iostream>
+#include <random>
+#include <string>
+#include <vector>
+#include <shader.h>
+#define STB_IMAGE_IMPLEMENTATION
+#include "stb_image.h"
+#include <glm/glm.hpp>
+#include <glm/gtc/matrix_transform.hpp>
+#include <glm/gtc/type_ptr.hpp>
+#include "engine.h"
+
+// settings
+const unsigned int SCR_WIDTH = 800;
+const unsigned int SCR_HEIGHT = 600;
+// a meadow of grass sprites around a few containers; space switches
+// between weighted blended transparency and sorted blending
+const int GRASS_COUNT = 20000;
+const float FIELD_SIZE = 40.0f;
+
+int viewportWidth = SCR_WIDTH;
+int viewportHeight = SCR_HEIGHT;
+bool weightedBlended = true;
+bool spaceDown = false;
+
+void processInput(GLFWwindow *window)
+{
+  if (glfwGetKey(window, GLFW_KEY_ESCAPE) == GLFW_PRESS)
+    glfwSetWindowShouldClose(window, true);
+  bool space = glfwGetKey(window, GLFW_KEY_SPACE) == GLFW_PRESS;
+  if (space && !spaceDown)
+  {
+    weightedBlended = !weightedBlended;
+  }
+  spaceDown = space;
+}
+
+void framebuffer_size_callback(GLFWwindow *window, int width, int height)
+{
+  glViewport(0, 0, width, height);
+  viewportWidth = width;
+  viewportHeight = height;
+}
+
+int main()
+{
+  // GLFW
+  glfwInit();
+  glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 3);
+  glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 3);
+  glfwWindowHint(GLFW_OPENGL_PROFILE, GLFW_OPENGL_CORE_PROFILE);
+
+  GLFWwindow *window = glfwCreateWindow(
+      SCR_WIDTH, SCR_HEIGHT, "Weighted blended transparency", NULL, NULL);
+  if (window == NULL)
+  {
+    std::cout << "Failed to create GLFW window" << std::endl;
+    glfwTerminate();
+    return -1;
+  }
+  glfwMakeContextCurrent(window);
+  glfwSetFramebufferSizeCallback(window, framebuffer_size_callback);
+  // vsync off so the frame time shows the cost of the sprites
+  glfwSwapInterval(0);
+
+  // INIT GLAD
+  if (!gladLoadGLLoader((GLADloadproc)glfwGetProcAddress))
+  {
+    std::cout << "Failed to initialize GLAD" << std::endl;
+    return -1;
+  }
+  glViewport(0, 0, SCR_WIDTH, SCR_HEIGHT);
+  glEnable(GL_DEPTH_TEST);
+
+  auto renderer = std::make_unique<Renderer>();
+  auto resourceManager = std::make_unique<ResourceManager>(*renderer);
+
+  std::shared_ptr<Shader> opaqueShader(
+      new Shader("./shader/vLight.glsl", "./shader/fSprite.glsl"));
+  Shader opaqueShaderInstanced("./shader/vSprite.glsl",
+                               "./shader/fSprite.glsl");
+  std::shared_ptr<Shader> grassShader(
+      new Shader("./shader/vLight.glsl", "./shader/fOitAccumulate.glsl"));
+  Shader grassShaderInstanced("./shader/vSprite.glsl",
+                              "./shader/fOitAccumulate.glsl");
+
+  Material containerMat = Material(opaqueShader);
+  resourceManager->addMaterial(containerMat);
+  Image containerImage("./texture/container.jpg", true);
+  Texture containerTexture = resourceManager->loadTexture2D(containerImage);
+  containerTexture.type = TextureType::Diffuse;
+  containerMat.textures.push_back(containerTexture);
+
+  // the same grass texture for both modes, only the shader differs
+  Material grassMat = Material(grassShader);
+  Material sortedGrassMat = Material(opaqueShader);
+  resourceManager->addMaterial(grassMat);
+  resourceManager->addMaterial(sortedGrassMat);
+  Image grassImage("./texture/grass.png", true);
+  Texture grassTexture = resourceManager->loadTexture2D(grassImage);
+  grassTexture.type = TextureType::Diffuse;
+  grassMat.textures.push_back(grassTexture);
+  sortedGrassMat.textures.push_back(grassTexture);
+
+  Mesh cube = createCube();
+  renderer->createBuffer(cube);
+  Mesh blade = createPlane();
+  renderer->createBuffer(blade);
+
+  MeshRenderer render(renderer->getResidency());
+  render.setInstancedShader(*opaqueShader, opaqueShaderInstanced);
+  render.setInstancedShader(*grassShader, grassShaderInstanced);
+  RenderQueue queue(&resourceManager->getJobs());
+  WeightedBlendedTransparency transparency(*renderer);
+  if (!transparency.available())
+  {
+    weightedBlended = false;
+  }
+
+  glm::mat4 projection = glm::perspective(
+      glm::radians(60.0f), (float)SCR_WIDTH / (float)SCR_HEIGHT, 0.1f, 100.0f);
+  auto camera = Camera(projection);
+
+  std::vector<glm::mat4> containers;
+  // ground
+  containers.push_back(glm::scale(
+      glm::translate(glm::mat4(1.0f), glm::vec3(0.0f, -0.5f, 0.0f)),
+      glm::vec3(FIELD_SIZE * 2.0f, 0.1f, FIELD_SIZE * 2.0f)));
+  for (int i = 0; i < 5; ++i)
+  {
+    containers.push_back(glm::translate(
+        glm::mat4(1.0f), glm::vec3(i * 4.0f - 8.0f, 0.0f, -i * 3.0f)));
+  }
+
+  std::mt19937 rng(5);
+  std::uniform_real_distribution<float> unit(0.0f, 1.0f);
+  std::vector<glm::mat4> grass(GRASS_COUNT);
+  for (glm::mat4 &model : grass)
+  {
+    glm::vec3 position((unit(rng) - 0.5f) * FIELD_SIZE, 0.0f,
+                       (unit(rng) - 0.5f) * FIELD_SIZE);
+    model = glm::translate(glm::mat4(1.0f), position);
+    model = glm::rotate(model, unit(rng) * glm::pi<float>(),
+                        glm::vec3(0.0f, 1.0f, 0.0f));
+    model = glm::scale(model, glm::vec3(0.5f + unit(rng) * 0.5f));
+  }
+
+  double frameTimes = 0.0;
+  unsigned int frame = 0;
+  while (!glfwWindowShouldClose(window))
+  {
+    double frameStart = glfwGetTime();
+    processInput(window);
+    if (!transparency.available())
+    {
+      weightedBlended = false;
+    }
+    float time = (float)glfwGetTime();
+
+    glClearColor(0.5f, 0.7f, 0.9f, 1.0f);
+    glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+
+    camera.Position = glm::vec3(std::sin(time * 0.2f) * 5.0f, 1.5f, 22.0f);
+    for (const glm::mat4 &model : containers)
+    {
+      render.submit(queue, camera, cube, *opaqueShader, containerMat, model);
+    }
+    if (weightedBlended)
+    {
+      render.flush(camera, queue);
+      // any order will do, so the grass goes in as one opaque batch
+      transparency.begin(viewportWidth, viewportHeight);
+      for (const glm::mat4 &model : grass)
+      {
+        render.submit(queue, camera, blade, *grassShader, grassMat, model);
+      }
+      render.flush(camera, queue);
+      transparency.composite();
+    }
+    else
+    {
+      for (const glm::mat4 &model : grass)
+      {
+        render.submit(queue, camera, blade, *opaqueShader, sortedGrassMat,
+                      model, 0, true);
+      }
+      render.flush(camera, queue);
+    }
+
+    glfwSwapBuffers(window);
+    glfwPollEvents();
+    frameTimes += glfwGetTime() - frameStart;
+    if (++frame % 120 == 0)
+    {
+      const auto &stats = render.getQueueStats();
+      std::cout << (weightedBlended ? "weighted blended: " : "sorted: ")
+                << stats.sorted.draws / 120 << " draws, frame "
+                << frameTimes * 1000.0 / 120 << " ms\n";
+      render.resetQueueStats();
+      frameTimes = 0.0;
+    }
+  }
+  glfwTerminate();
+  return 0;
+}